@@ -0,0 +1,423 @@
+/*
+ *  analysis.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "state.h"
+#include "parser.h"
+#include "builtins.h"
+#include "analysis.h"
+
+/*
+ *  returns the kind of the object an expression evaluates to, if it can be
+ *  determined without evaluating the expression; globals which have already
+ *  been evaluated are looked up, since they can no longer change
+ */
+uint8_t atto_expression_value_kind(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e)
+{
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+    return ATTO_OBJECT_KIND_NUMBER;
+
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    return ATTO_OBJECT_KIND_SYMBOL;
+
+  case ATTO_EXPRESSION_KIND_LAMBDA:
+    return ATTO_OBJECT_KIND_LAMBDA;
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL:
+    if (e->container.list_literal_expression->number_of_elements == 0) {
+      return ATTO_OBJECT_KIND_NULL;
+    }
+    return ATTO_OBJECT_KIND_LIST;
+
+  case ATTO_EXPRESSION_KIND_REFERENCE: {
+    struct atto_environment_object *eo = atto_find_in_environment(env, e->container.reference_identifier);
+    uint8_t kind;
+
+    if ((eo == NULL) ||
+        (eo->kind != ATTO_ENVIRONMENT_OBJECT_KIND_GLOBAL) ||
+        (eo->offset >= a->vm_state->data_stack_size)) {
+      return ATTO_ANALYSIS_KIND_UNKNOWN;
+    }
+
+    kind = a->vm_state->heap[atto_get_object(a, eo)].kind;
+    if (kind == ATTO_OBJECT_KIND_THUNK) {
+      return ATTO_ANALYSIS_KIND_UNKNOWN;
+    }
+
+    return kind;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    uint8_t true_kind  = atto_expression_value_kind(a, env, ie->true_evaluation_expression),
+            false_kind = atto_expression_value_kind(a, env, ie->false_evaluation_expression);
+
+    if (true_kind == false_kind) {
+      return true_kind;
+    }
+
+    return ATTO_ANALYSIS_KIND_UNKNOWN;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    const struct atto_builtin *b = atto_find_builtin(e->container.application_expression->identifier);
+
+    if (b == NULL) {
+      return ATTO_ANALYSIS_KIND_UNKNOWN;
+    }
+
+    return b->result_kind;
+  }
+
+  default:
+    return ATTO_ANALYSIS_KIND_UNKNOWN;
+  }
+}
+
+/*
+ *  returns a rough estimate of the work needed to evaluate an expression,
+ *  ignoring the cost of any function calls it contains
+ */
+size_t atto_expression_cost(struct atto_expression *e)
+{
+  size_t cost = 1;
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      cost += atto_expression_cost(lle->elements[i]);
+    }
+    break;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    cost += atto_expression_cost(ie->condition_expression);
+    cost += atto_expression_cost(ie->true_evaluation_expression);
+    cost += atto_expression_cost(ie->false_evaluation_expression);
+    break;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      cost += atto_expression_cost(ae->parameters[i]);
+    }
+    break;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    for (i = 0; i < le->number_of_bindings; i++) {
+      cost += atto_expression_cost(le->binding_expressions[i]);
+    }
+    cost += atto_expression_cost(le->body);
+    break;
+  }
+
+  default:
+    break;
+  }
+
+  return cost;
+}
+
+/*
+ *  returns whether an expression is guaranteed to evaluate without failing,
+ *  without diverging, and without forcing any thunk; such expressions may be
+ *  evaluated ahead of time without changing the meaning of the program
+ */
+int atto_is_expression_safe(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+  case ATTO_EXPRESSION_KIND_LAMBDA:
+    return 1;
+
+  /*  a reference is only copied, not forced */
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    return (atto_find_in_environment(env, e->container.reference_identifier) != NULL);
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      if (!atto_is_expression_safe(a, env, lle->elements[i])) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (atto_is_expression_safe(a, env, ie->condition_expression) &&
+            (atto_expression_value_kind(a, env, ie->condition_expression) == ATTO_OBJECT_KIND_SYMBOL) &&
+            atto_is_expression_safe(a, env, ie->true_evaluation_expression) &&
+            atto_is_expression_safe(a, env, ie->false_evaluation_expression));
+  }
+
+  /*  applications of builtins are safe as long as their operands are safe
+   *  and of the right kind; calls of user-defined functions might never
+   *  return, and native functions might fail, so they are never considered
+   *  safe */
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    const struct atto_builtin *b = atto_find_builtin(ae->identifier);
+
+    if ((b == NULL) || (b->flags & ATTO_BUILTIN_FLAG_NATIVE) || (b->arity != ae->number_of_parameters)) {
+      return 0;
+    }
+
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      uint8_t kind;
+
+      if (!atto_is_expression_safe(a, env, ae->parameters[i])) {
+        return 0;
+      }
+
+      if (!(b->flags & ATTO_BUILTIN_FLAG_STRICT)) {
+        continue;
+      }
+
+      kind = atto_expression_value_kind(a, env, ae->parameters[i]);
+      if ((kind == ATTO_ANALYSIS_KIND_UNKNOWN) ||
+          ((b->operand_kind != ATTO_ANALYSIS_KIND_UNKNOWN) && (kind != b->operand_kind))) {
+        return 0;
+      }
+    }
+
+    return 1;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  returns whether a definition body should be evaluated at definition time
+ *  instead of being wrapped in a thunk
+ */
+int atto_is_expression_eager(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e)
+{
+  return ((atto_expression_cost(e) <= ATTO_ANALYSIS_MAX_EAGER_COST) &&
+          atto_is_expression_safe(a, env, e));
+}
+
+/*
+ *  returns whether the value produced by an expression might be an
+ *  unevaluated thunk, and thus needs to be forced before being used
+ */
+int atto_may_be_thunk(struct atto_environment *env, struct atto_expression *e)
+{
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_REFERENCE: {
+    struct atto_environment_object *eo = atto_find_in_environment(env, e->container.reference_identifier);
+    return ((eo == NULL) || !(eo->flags & ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED));
+  }
+
+  case ATTO_EXPRESSION_KIND_IF:
+    return (atto_may_be_thunk(env, e->container.if_expression->true_evaluation_expression) ||
+            atto_may_be_thunk(env, e->container.if_expression->false_evaluation_expression));
+
+  /*  the bindings of a let expression are not visible from here, so its
+   *  value is always assumed to need forcing */
+  case ATTO_EXPRESSION_KIND_LET:
+    return 1;
+
+  /*  list elements are stored unforced, and functions may return thunks */
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    const struct atto_builtin *b = atto_find_builtin(e->container.application_expression->identifier);
+    return ((b == NULL) || (b->result_kind == ATTO_ANALYSIS_KIND_UNKNOWN));
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  the names bound by the let expressions a part of a lambda body is found
+ *  in, innermost first; only the first `number_of_names' bindings of each
+ *  are visible, since a sequential let binds them one at a time
+ */
+struct let_scope {
+  struct atto_let_expression *let_expression;
+  uint32_t number_of_names;
+  const struct let_scope *next;
+};
+
+static int is_let_bound(const struct let_scope *scope, const char *name)
+{
+  uint32_t i;
+
+  for (; scope != NULL; scope = scope->next) {
+    for (i = 0; i < scope->number_of_names; i++) {
+      if (strcmp(scope->let_expression->binding_names[i], name) == 0) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ *  returns the bit of the parameter a name refers to, or zero if it refers
+ *  to something else, including a let binding which shadows a parameter
+ */
+static uint32_t parameter_bit(struct atto_lambda_expression *le,
+  const struct let_scope *scope, const char *name)
+{
+  uint32_t i;
+
+  if (is_let_bound(scope, name)) {
+    return 0;
+  }
+
+  for (i = 0; (i < le->number_of_parameters) && (i < ATTO_ANALYSIS_MAX_STRICT_PARAMETERS); i++) {
+    if (strcmp(le->parameter_names[i], name) == 0) {
+      return ((uint32_t)1 << i);
+    }
+  }
+
+  return 0;
+}
+
+static uint32_t demanded_parameters(struct atto_environment *env,
+  struct atto_lambda_expression *le, const struct let_scope *scope, struct atto_expression *e);
+
+/*
+ *  returns the parameters which are forced when an expression is evaluated
+ *  and its value is forced as well
+ */
+static uint32_t forced_parameters(struct atto_environment *env,
+  struct atto_lambda_expression *le, const struct let_scope *scope, struct atto_expression *e)
+{
+  if (e->kind == ATTO_EXPRESSION_KIND_REFERENCE) {
+    return parameter_bit(le, scope, e->container.reference_identifier);
+  }
+
+  return demanded_parameters(env, le, scope, e);
+}
+
+/*
+ *  returns the parameters which are always forced when an expression is
+ *  evaluated; nested lambdas are not entered, since their bodies may never
+ *  run
+ */
+static uint32_t demanded_parameters(struct atto_environment *env,
+  struct atto_lambda_expression *le, const struct let_scope *scope, struct atto_expression *e)
+{
+  uint32_t demanded = 0;
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      demanded |= demanded_parameters(env, le, scope, lle->elements[i]);
+    }
+    return demanded;
+  }
+
+  /*  the condition is always forced, but a parameter used in the branches is
+   *  only demanded if both of them force it */
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (forced_parameters(env, le, scope, ie->condition_expression) |
+           (demanded_parameters(env, le, scope, ie->true_evaluation_expression) &
+            demanded_parameters(env, le, scope, ie->false_evaluation_expression)));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    const struct atto_builtin *b = atto_find_builtin(ae->identifier);
+    uint32_t callee = parameter_bit(le, scope, ae->identifier);
+    uint32_t callee_strictness = 0;
+
+    if (b != NULL) {
+      for (i = 0; i < ae->number_of_parameters; i++) {
+        if (b->flags & ATTO_BUILTIN_FLAG_STRICT) {
+          demanded |= forced_parameters(env, le, scope, ae->parameters[i]);
+        } else {
+          demanded |= demanded_parameters(env, le, scope, ae->parameters[i]);
+        }
+      }
+      return demanded;
+    }
+
+    /*  calling a parameter forces it; calling a global lambda forces the
+     *  arguments passed in its strict parameters, while nothing is known
+     *  of lambdas bound by a let, even if they are named like a global */
+    if ((callee == 0) && !is_let_bound(scope, ae->identifier)) {
+      struct atto_environment_object *eo = atto_find_in_environment(env, ae->identifier);
+      if (eo != NULL) {
+        callee_strictness = eo->strict_parameters;
+      }
+    }
+
+    demanded |= callee;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      if ((i < ATTO_ANALYSIS_MAX_STRICT_PARAMETERS) && (callee_strictness & ((uint32_t)1 << i))) {
+        demanded |= forced_parameters(env, le, scope, ae->parameters[i]);
+      } else {
+        demanded |= demanded_parameters(env, le, scope, ae->parameters[i]);
+      }
+    }
+    return demanded;
+  }
+
+  /*  the bindings are evaluated with the names bound before them in sight
+   *  if the let is sequential, and with none of them otherwise; uses of
+   *  these names do not count as uses of the parameters they shadow */
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct let_scope inner;
+
+    inner.let_expression = e->container.let_expression;
+    inner.number_of_names = 0;
+    inner.next = scope;
+
+    for (i = 0; i < inner.let_expression->number_of_bindings; i++) {
+      demanded |= demanded_parameters(env, le, inner.let_expression->sequential ? &inner : scope,
+        inner.let_expression->binding_expressions[i]);
+      inner.number_of_names++;
+    }
+
+    return (demanded | demanded_parameters(env, le, &inner, inner.let_expression->body));
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  returns a bit mask of the parameters of a lambda which are forced every
+ *  time its body is evaluated; these can be forced on entry, sparing the
+ *  body from checking them at every use
+ */
+uint32_t atto_analyze_strictness(struct atto_environment *env, struct atto_lambda_expression *le)
+{
+  return demanded_parameters(env, le, NULL, le->body);
+}
+
@@ -0,0 +1,38 @@
+/*
+ *  analysis.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdint.h>
+
+#include "state.h"
+#include "parser.h"
+#include "builtins.h"
+
+#pragma once
+
+/*  definitions whose bodies are larger than this are kept lazy even if they
+ *  are safe to evaluate, since they might never be used */
+#define ATTO_ANALYSIS_MAX_EAGER_COST 64
+
+/*  strictness information is kept as a bit mask, so only the first few
+ *  parameters of a lambda may be marked as strict */
+#define ATTO_ANALYSIS_MAX_STRICT_PARAMETERS 32
+
+#define ATTO_ANALYSIS_KIND_UNKNOWN ATTO_BUILTIN_KIND_UNKNOWN
+
+uint8_t atto_expression_value_kind(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e);
+
+size_t atto_expression_cost(struct atto_expression *e);
+
+int atto_is_expression_safe(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e);
+
+int atto_is_expression_eager(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e);
+
+int atto_may_be_thunk(struct atto_environment *env, struct atto_expression *e);
+
+uint32_t atto_analyze_strictness(struct atto_environment *env, struct atto_lambda_expression *le);
+
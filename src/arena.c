@@ -0,0 +1,103 @@
+/*
+ *  arena.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*  allocations are aligned so that any of the structures the frontend
+ *  builds may be placed at the start of one */
+#define ALIGNMENT sizeof(union { double d; void *p; uint64_t u; size_t s; })
+
+#define BLOCK_HEADER_SIZE ((sizeof(struct atto_arena_block) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+static struct atto_arena_block *allocate_block(size_t size, struct atto_arena_block *previous)
+{
+  struct atto_arena_block *b = (struct atto_arena_block *)malloc(BLOCK_HEADER_SIZE + size);
+  assert(b != NULL);
+
+  b->previous = previous;
+  b->size = size;
+  b->used = 0;
+
+  return b;
+}
+
+struct atto_arena *atto_allocate_arena(size_t block_size)
+{
+  struct atto_arena *arena = (struct atto_arena *)malloc(sizeof(struct atto_arena));
+  assert(arena != NULL);
+
+  arena->block_size = block_size;
+  arena->current = allocate_block(block_size, NULL);
+
+  return arena;
+}
+
+void atto_destroy_arena(struct atto_arena *arena)
+{
+  struct atto_arena_block *b = arena->current;
+
+  while (b != NULL) {
+    struct atto_arena_block *previous = b->previous;
+    free(b);
+    b = previous;
+  }
+
+  free(arena);
+}
+
+/*
+ *  releases everything allocated from the arena, keeping only the most
+ *  recent block around for the next allocations
+ */
+void atto_reset_arena(struct atto_arena *arena)
+{
+  struct atto_arena_block *b = arena->current->previous;
+
+  while (b != NULL) {
+    struct atto_arena_block *previous = b->previous;
+    free(b);
+    b = previous;
+  }
+
+  arena->current->previous = NULL;
+  arena->current->used = 0;
+}
+
+/*
+ *  objects larger than a block get a block of their own
+ */
+void *atto_arena_allocate(struct atto_arena *arena, size_t size)
+{
+  struct atto_arena_block *b = arena->current;
+  void *p = NULL;
+
+  size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+  if (b->used + size > b->size) {
+    b = allocate_block((size > arena->block_size) ? size : arena->block_size, b);
+    arena->current = b;
+  }
+
+  p = (char *)b + BLOCK_HEADER_SIZE + b->used;
+  b->used += size;
+
+  return p;
+}
+
+char *atto_arena_copy_string(struct atto_arena *arena, const char *string, size_t length)
+{
+  char *copy = (char *)atto_arena_allocate(arena, length + 1);
+
+  memcpy(copy, string, length);
+  copy[length] = 0;
+
+  return copy;
+}
+
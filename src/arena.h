@@ -0,0 +1,33 @@
+/*
+ *  arena.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+
+#pragma once
+
+#define ATTO_ARENA_DEFAULT_BLOCK_SIZE (size_t)4096
+
+/*
+ *  objects are allocated from blocks by bumping an offset, and are never
+ *  freed one by one; the whole arena is released at once instead
+ */
+struct atto_arena_block {
+  struct atto_arena_block *previous;
+  size_t size;
+  size_t used;
+};
+
+struct atto_arena {
+  struct atto_arena_block *current;
+  size_t block_size;
+};
+
+struct atto_arena *atto_allocate_arena(size_t block_size);
+void atto_destroy_arena(struct atto_arena *arena);
+void atto_reset_arena(struct atto_arena *arena);
+
+void *atto_arena_allocate(struct atto_arena *arena, size_t size);
+char *atto_arena_copy_string(struct atto_arena *arena, const char *string, size_t length);
+
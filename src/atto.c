@@ -6,6 +6,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -14,6 +16,16 @@
 #include "parser.h"
 #include "lexer.h"
 #include "compiler.h"
+#include "optimizer.h"
+#include "frontend.h"
+#include "memo.h"
+#include "reader.h"
+#include "loader.h"
+#include "image.h"
+#include "cache.h"
+#include "prepared.h"
+#include "snapshot.h"
+#include "natives.h"
 
 #define COLOR_GREEN  "\e[32m"
 #define COLOR_YELLOW "\e[33m"
@@ -21,6 +33,13 @@
 
 size_t result_count = 0;
 
+/*  the object printed last, which is remembered along with the compiled
+ *  form when forms are cached */
+size_t last_result = 0;
+
+/*  set with `-cache <directory>' */
+struct atto_cache *cache = NULL;
+
 static void pretty_print_list(struct atto_state *a, size_t index);
 
 void pretty_print_object(struct atto_state *a, size_t index)
@@ -44,7 +63,7 @@ void pretty_print_object(struct atto_state *a, size_t index)
     break;
 
   case ATTO_OBJECT_KIND_LAMBDA:
-    printf("lambda#%lu", a->vm_state->heap[index].container.instruction_stream_index);
+    printf("lambda#%lu", a->vm_state->heap[index].container.lambda.instruction_stream_index);
     break;
 
   case ATTO_OBJECT_KIND_THUNK:
@@ -69,55 +88,87 @@ static void pretty_print_list(struct atto_state *a, size_t index)
 
 static void pretty_print_result(struct atto_state *a, size_t index)
 {
+  last_result = index;
   printf(COLOR_YELLOW "[%lu] " COLOR_RESET, result_count++);
   pretty_print_object(a, index);
   printf("\n");
 }
 
-void evaluate_string(struct atto_state *a, char *str)
+/*
+ *  runs a top-level expression which was compiled into the given stream,
+ *  and prints its value, unless it failed
+ */
+static void run_expression(struct atto_state *a, size_t index)
 {
-  struct atto_token *token_list  = atto_lex_string(str);
-  struct atto_token *left = NULL;
-  struct atto_ast_node *root = atto_parse_token_list(a, token_list, &left);
-  struct atto_expression *e = NULL;
+  atto_claim_global_slot(a->vm_state);
+  atto_run_instruction_stream(a->vm_state, index);
+
+  /*  expressions which failed have no value to show */
+  if (!(a->vm_state->flags & ATTO_VM_FLAG_FAILED)) {
+    pretty_print_result(a, a->vm_state->data_stack[a->vm_state->data_stack_size - 1]);
+  }
+}
+
+/*
+ *  compiles an expression through the single pass frontend, if it is one
+ *  the frontend knows; returns whether it was, in which case `index' is set
+ *  to the stream it was compiled into
+ */
+static int compile_string_fast(struct atto_state *a, const char *str, size_t *index)
+{
+  struct atto_instruction_stream *is = allocate_instruction_stream();
+
+  if (!atto_compile_source(a, str, is)) {
+    free(is->stream);
+    free(is);
+    return 0;
+  }
+
+  *index = atto_add_instruction_stream(a->vm_state, is);
 
-  struct atto_instruction_stream *is = (struct atto_instruction_stream *)malloc(sizeof(struct atto_instruction_stream));
-  is->length = 0;
-  is->allocated_length = 32;
-  is->stream = (struct atto_instruction *)malloc(sizeof(struct atto_instruction) * is->allocated_length);
+  return 1;
+}
+
+/*
+ *  compiles and runs a top-level form, given as a syntax tree; returns
+ *  whether it was an expression, in which case `index' is set to the
+ *  stream it was compiled into
+ */
+static int evaluate_form(struct atto_state *a, struct atto_ast_node *root, size_t *index)
+{
+  struct atto_expression *e = NULL;
 
   if (root->kind == ATTO_AST_NODE_IDENTIFIER) {
-    struct atto_environment_object *current = a->global_environment->head;
-
-    while (current) {
-      if (strcmp(current->name, root->container.identifier) == 0) {
-        size_t o = atto_get_object(a, current);
-        
-        if (a->vm_state->heap[o].kind == ATTO_OBJECT_KIND_THUNK) {
-          evaluate_thunk(a->vm_state, o);
-        }
-
-        pretty_print_result(a, o);
-        break;
+    struct atto_environment_object *eo = atto_find_in_environment(a->global_environment, root->container.identifier);
+
+    if (eo != NULL) {
+      size_t o = atto_get_object(a, eo);
+
+      if (a->vm_state->heap[o].kind == ATTO_OBJECT_KIND_THUNK) {
+        evaluate_thunk(a->vm_state, o);
       }
 
-      current = current->next;
+      pretty_print_result(a, o);
     }
   } else if (root->kind == ATTO_AST_NODE_LIST) {
     struct atto_ast_node *head = root->container.list;
 
-    if (head->kind != ATTO_AST_NODE_IDENTIFIER) {
+    if ((head == NULL) || (head->kind != ATTO_AST_NODE_IDENTIFIER)) {
       printf("error: invalid syntax\n");
-
-      destroy_ast(root);
-      destroy_token_list(token_list);
-      return;
+      a->number_of_errors++;
+      return 0;
     }
 
-    if (strcmp(head->container.identifier, "define") == 0) {
+    if ((strcmp(head->container.identifier, "define") == 0) ||
+        (strcmp(head->container.identifier, "define-memo") == 0)) {
       struct atto_definition *definition = parse_definition(head);
       /*pretty_print_definition(definition);*/
 
+      if (definition == NULL) {
+        a->number_of_errors++;
+        return 0;
+      }
+
       compile_definition(a, definition);
       /*pretty_print_stack(a->vm_state);*/
       
@@ -127,51 +178,319 @@ void evaluate_string(struct atto_state *a, char *str)
       free(definition->identifier);
       free(definition);
     } else {
+      struct atto_instruction_stream *is = NULL;
+
       e = parse_expression(root);
+
+      if (e == NULL) {
+        printf("syntax error: unable to parse expression; giving up\n");
+        a->number_of_errors++;
+        return 0;
+      }
+
+      is = allocate_instruction_stream();
+      e = atto_fuse_traversals(a, a->global_environment, e, NULL);
+      e = atto_specialize_applications(a, a->global_environment, atto_fold_constants(e), NULL);
+      e = atto_optimize_expression(a, a->global_environment, e);
       /*pretty_print_expression(e, 0);
       printf("-------------------------------------------------\n");*/
       compile_expression(a, a->global_environment, is, e);
 
-      a->vm_state->instruction_streams[a->vm_state->number_of_instruction_streams] = is;
-      a->vm_state->number_of_instruction_streams += 1;
+      *index = atto_add_instruction_stream(a->vm_state, is);
+      run_expression(a, *index);
 
-      a->vm_state->current_instruction_stream_index = a->vm_state->number_of_instruction_streams - 1;
-      a->vm_state->current_instruction_offset = 0;
-      atto_run_vm(a->vm_state);
+      destroy_expression(e);
+      return 1;
+    }
+  }
 
-      pretty_print_result(a, a->vm_state->data_stack[a->vm_state->data_stack_size - 1]);
+  return 0;
+}
 
-      destroy_expression(e);
+/*
+ *  compiles and runs a top-level form, given as a syntax tree
+ */
+void evaluate_ast(struct atto_state *a, struct atto_ast_node *root)
+{
+  size_t index;
+
+  evaluate_form(a, root, &index);
+}
+
+/*
+ *  compiles and runs a top-level form, given as source text; expressions
+ *  which were evaluated before are run again without being compiled anew,
+ *  and those which were not are remembered, unless they failed to compile
+ */
+void evaluate_string(struct atto_state *a, const char *str)
+{
+  struct atto_token_array *tokens = NULL;
+  struct atto_ast_node *root = NULL;
+  size_t left = 0, index = 0, errors = a->number_of_errors;
+
+  if (atto_find_prepared_expression(a->prepared_expressions, a->global_environment, str, &index)) {
+    run_expression(a, index);
+    return;
+  }
+
+  if (a->use_fast_frontend && compile_string_fast(a, str, &index)) {
+    run_expression(a, index);
+
+    if (a->number_of_errors == errors) {
+      atto_prepare_expression(a->prepared_expressions, a->global_environment, str, index);
     }
+
+    return;
   }
 
-  destroy_token_list(token_list);
-  destroy_ast(root);
+  tokens = atto_lex_string(str);
+
+  if (tokens == NULL) {
+    return;
+  }
+
+  root = atto_parse_token_array(a, tokens, a->parse_arena, &left);
+
+  if ((root != NULL) && evaluate_form(a, root, &index) && (a->number_of_errors == errors)) {
+    atto_prepare_expression(a->prepared_expressions, a->global_environment, str, index);
+  }
+
+  destroy_token_array(tokens);
+  atto_reset_arena(a->parse_arena);
 }
 
-int main(int argc, char **argv)
+/*
+ *  evaluates a top-level form, loading it from the cache if it was compiled
+ *  before, and storing it there otherwise; forms which failed are not
+ *  stored, so that their errors are shown every time
+ */
+static void evaluate_string_cached(struct atto_state *a, const char *str)
+{
+  struct atto_state_mark m;
+  size_t count = result_count, errors = a->number_of_errors, result = 0;
+  int found = atto_cache_lookup(cache, a, str, &result);
+
+  if (found < 0) {
+    evaluate_string(a, str);
+    return;
+  }
+
+  if (found) {
+    pretty_print_result(a, result);
+    atto_cache_finish_form(cache, a);
+    return;
+  }
+
+  atto_mark_state(a, &m);
+  evaluate_string(a, str);
+
+  /*  the bodies of lambdas are compiled right away, since stored forms are
+   *  only code, and errors in them count as errors in the form */
+  atto_compile_pending_lambdas(a, m.number_of_instruction_streams);
+
+  if ((result_count != count) && (a->number_of_errors == errors)) {
+    atto_cache_store(cache, a, &m, last_result);
+  }
+
+  atto_release_state_mark(&m);
+  atto_cache_finish_form(cache, a);
+}
+
+/*
+ *  evaluates the complete forms read so far, in order; only forms read from
+ *  files are cached, since the key of each form covers all forms before it
+ */
+static void evaluate_forms(struct atto_state *a, struct atto_reader *r, int use_cache)
 {
-  (void) argc;
-  (void) argv;
+  const char *form = NULL;
+
+  while ((form = atto_reader_next_form(r)) != NULL) {
+    if (use_cache && (cache != NULL)) {
+      evaluate_string_cached(a, form);
+    } else {
+      evaluate_string(a, form);
+    }
+  }
+}
+
+/*
+ *  reads a whole source file, and hands it to the parallel loader
+ */
+static int load_file_parallel(struct atto_state *a, const char *path, size_t number_of_threads)
+{
+  FILE *f = fopen(path, "r");
+  char *source = NULL;
+  size_t length = 0, allocated_length = ATTO_READER_CHUNK_SIZE, read;
+
+  if (f == NULL) {
+    printf("error: unable to open `%s'\n", path);
+    return 0;
+  }
+
+  source = (char *)malloc(sizeof(char) * allocated_length);
+  assert(source != NULL);
+
+  while ((read = fread(source + length, sizeof(char), allocated_length - length, f)) > 0) {
+    length += read;
+
+    if (length == allocated_length) {
+      allocated_length *= 2;
+      source = (char *)realloc(source, sizeof(char) * allocated_length);
+      assert(source != NULL);
+    }
+  }
+
+  atto_load_source_parallel(a, source, length, number_of_threads, evaluate_ast);
+
+  free(source);
+  fclose(f);
+
+  return 1;
+}
+
+/*
+ *  reads a source file in chunks, evaluating each form as soon as it has
+ *  been read in full
+ */
+static int load_file(struct atto_state *a, const char *path)
+{
+  FILE *f = fopen(path, "r");
+  struct atto_reader *r = NULL;
+  char chunk[ATTO_READER_CHUNK_SIZE];
+  size_t length;
+
+  if (f == NULL) {
+    printf("error: unable to open `%s'\n", path);
+    return 0;
+  }
+
+  r = atto_allocate_reader();
+
+  while ((length = fread(chunk, sizeof(char), ATTO_READER_CHUNK_SIZE, f)) > 0) {
+    atto_reader_feed(r, chunk, length);
+    evaluate_forms(a, r, 1);
+  }
+
+  atto_reader_finish(r);
+  evaluate_forms(a, r, 1);
 
+  atto_destroy_reader(r);
+  fclose(f);
+
+  return 1;
+}
+
+/*
+ *  source files named on the command line are loaded before the REPL is
+ *  started; with `-j <n>', they are parsed on `n' threads, or on as many
+ *  threads as there are cores if `n' is zero. with `-cache <directory>',
+ *  the compiled forms of files loaded one form at a time are kept in the
+ *  given directory, and forms which did not change are not compiled again,
+ *  for as long as the state holds nothing but the prelude and such forms.
+ *  `-image <path>', given first, loads a saved image instead of compiling
+ *  any source, and `-save-image <path>' saves everything loaded so far;
+ *  `-snapshot <path>' and `-save-snapshot <path>' do the same with
+ *  snapshots, which are mapped into memory rather than read.
+ *  `-inline-size <n>' and `-specialize-size <n>' set the same limits as
+ *  the REPL commands of the same name, for the files after them
+ */
+int main(int argc, char **argv)
+{
   char *line_buffer = NULL;
+  size_t number_of_threads = 1;
+  int i;
 
   printf("atto alpha -- https://github.com/deveah/atto\n");
   printf("type " COLOR_YELLOW "-help" COLOR_RESET " in case of emergency\n");
   
   rl_variable_bind("blink-matching-paren", "on");
 
+  atto_register_standard_natives();
+
   struct atto_state *a = atto_allocate_state();
-  a->vm_state = atto_allocate_vm_state();
+
+  struct atto_reader *r = atto_allocate_reader();
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) {
+      number_of_threads = strtoul(argv[++i], NULL, 10);
+
+      if (number_of_threads == 0) {
+        number_of_threads = atto_number_of_cores();
+      }
+
+      continue;
+    }
+
+    if ((strcmp(argv[i], "-cache") == 0) && (i + 1 < argc)) {
+      if (cache != NULL) {
+        atto_destroy_cache(cache);
+      }
+
+      cache = atto_allocate_cache(argv[++i]);
+      continue;
+    }
+
+    if ((strcmp(argv[i], "-inline-size") == 0) && (i + 1 < argc)) {
+      a->inline_size_limit = strtoul(argv[++i], NULL, 10);
+      atto_forget_prepared_expressions(a->prepared_expressions);
+      continue;
+    }
+
+    if ((strcmp(argv[i], "-specialize-size") == 0) && (i + 1 < argc)) {
+      a->specialization_size_limit = strtoul(argv[++i], NULL, 10);
+      atto_forget_prepared_expressions(a->prepared_expressions);
+      continue;
+    }
+
+    if ((strcmp(argv[i], "-image") == 0) && (i + 1 < argc)) {
+      atto_load_image(a, argv[++i]);
+      continue;
+    }
+
+    if ((strcmp(argv[i], "-save-image") == 0) && (i + 1 < argc)) {
+      atto_save_image(a, argv[++i]);
+      continue;
+    }
+
+    if ((strcmp(argv[i], "-snapshot") == 0) && (i + 1 < argc)) {
+      atto_load_snapshot(a, argv[++i]);
+      continue;
+    }
+
+    if ((strcmp(argv[i], "-save-snapshot") == 0) && (i + 1 < argc)) {
+      atto_save_snapshot(a, argv[++i]);
+      continue;
+    }
+
+    if (number_of_threads > 1) {
+      load_file_parallel(a, argv[i], number_of_threads);
+    } else {
+      load_file(a, argv[i]);
+    }
+  }
 
   while (1) {
-    line_buffer = readline(COLOR_GREEN "atto" COLOR_RESET "> ");
+    /*  forms may span several lines, and a line may hold several forms */
+    if (atto_reader_is_inside_form(r)) {
+      line_buffer = readline(COLOR_GREEN "...." COLOR_RESET "> ");
+    } else {
+      line_buffer = readline(COLOR_GREEN "atto" COLOR_RESET "> ");
+    }
     add_history(line_buffer);
 
     if (line_buffer == NULL) {
       break;
     }
 
+    if (atto_reader_is_inside_form(r)) {
+      atto_reader_feed(r, line_buffer, strlen(line_buffer));
+      atto_reader_feed(r, "\n", 1);
+      evaluate_forms(a, r, 0);
+      free(line_buffer);
+      continue;
+    }
+
     if (strcmp(line_buffer, "-exit") == 0) {
       free(line_buffer);
       break;
@@ -184,7 +503,20 @@ int main(int argc, char **argv)
       printf(COLOR_YELLOW "  -env\t\t" COLOR_RESET "displays the global environment\n");
       printf(COLOR_YELLOW "  -verbose-on\n" COLOR_RESET);
       printf(COLOR_YELLOW "  -verbose-off\n" COLOR_RESET);
+      printf(COLOR_YELLOW "  -fast-frontend-on\t" COLOR_RESET "compiles simple expressions straight from source\n");
+      printf(COLOR_YELLOW "  -fast-frontend-off\n" COLOR_RESET);
+      printf(COLOR_YELLOW "  -hash-cons-on\t" COLOR_RESET "shares numbers, symbols and list cells which hold the same values\n");
+      printf(COLOR_YELLOW "  -hash-cons-off\n" COLOR_RESET);
       printf(COLOR_YELLOW "  -heap-usage\n" COLOR_RESET);
+      printf(COLOR_YELLOW "  -save-image <path>\t" COLOR_RESET "saves the compiled code and values, to be loaded with -image\n");
+      printf(COLOR_YELLOW "  -save-snapshot <path>\t" COLOR_RESET "saves the whole state, to be mapped with -snapshot\n");
+      printf(COLOR_YELLOW "  -memo-usage\t" COLOR_RESET "displays the hits and misses of the memo cache\n");
+      printf(COLOR_YELLOW "  -cache-usage\t" COLOR_RESET "displays the hits and misses of the compile cache\n");
+      printf(COLOR_YELLOW "  -prepared-usage\t" COLOR_RESET "displays the hits and misses of the prepared expressions\n");
+      printf(COLOR_YELLOW "  -inline-size <n>\t" COLOR_RESET "sets the largest lambda body to inline\n");
+      printf(COLOR_YELLOW "  -inline-depth <n>\t" COLOR_RESET "sets how deep inlined bodies are inlined into\n");
+      printf(COLOR_YELLOW "  -specialize-size <n>\t" COLOR_RESET "sets the largest lambda body to specialize\n");
+      printf(COLOR_YELLOW "  -specialize-depth <n>\t" COLOR_RESET "sets how deep specialized bodies are specialized into\n");
       free(line_buffer);
       continue;
     }
@@ -213,19 +545,114 @@ int main(int argc, char **argv)
       continue;
     }
 
+    if (strcmp(line_buffer, "-fast-frontend-on") == 0) {
+      a->use_fast_frontend = 1;
+      free(line_buffer);
+      continue;
+    }
+
+    if (strcmp(line_buffer, "-fast-frontend-off") == 0) {
+      a->use_fast_frontend = 0;
+      free(line_buffer);
+      continue;
+    }
+
+    if (strcmp(line_buffer, "-hash-cons-on") == 0) {
+      a->vm_state->flags |= ATTO_VM_FLAG_HASH_CONS;
+      atto_forget_prepared_expressions(a->prepared_expressions);
+      free(line_buffer);
+      continue;
+    }
+
+    if (strcmp(line_buffer, "-hash-cons-off") == 0) {
+      a->vm_state->flags &= ~(ATTO_VM_FLAG_HASH_CONS);
+      atto_forget_prepared_expressions(a->prepared_expressions);
+      free(line_buffer);
+      continue;
+    }
+
+    if (strcmp(line_buffer, "-memo-usage") == 0) {
+      pretty_print_memo_cache_usage(a->vm_state->memo_cache);
+      free(line_buffer);
+      continue;
+    }
+
+    if (strcmp(line_buffer, "-prepared-usage") == 0) {
+      pretty_print_prepared_cache_usage(a->prepared_expressions);
+      free(line_buffer);
+      continue;
+    }
+
+    if (strcmp(line_buffer, "-cache-usage") == 0) {
+      if (cache != NULL) {
+        pretty_print_cache_usage(cache);
+      } else {
+        printf("cache: disabled\n");
+      }
+      free(line_buffer);
+      continue;
+    }
+
     if (strcmp(line_buffer, "-heap-usage") == 0) {
       pretty_print_heap_usage(a->vm_state);
       free(line_buffer);
       continue;
     }
 
-    evaluate_string(a, line_buffer);
+    if (strncmp(line_buffer, "-save-image ", strlen("-save-image ")) == 0) {
+      atto_save_image(a, line_buffer + strlen("-save-image "));
+      free(line_buffer);
+      continue;
+    }
+
+    if (strncmp(line_buffer, "-save-snapshot ", strlen("-save-snapshot ")) == 0) {
+      atto_save_snapshot(a, line_buffer + strlen("-save-snapshot "));
+      free(line_buffer);
+      continue;
+    }
+
+    if (strncmp(line_buffer, "-inline-size ", strlen("-inline-size ")) == 0) {
+      a->inline_size_limit = strtoul(line_buffer + strlen("-inline-size "), NULL, 10);
+      atto_forget_prepared_expressions(a->prepared_expressions);
+      free(line_buffer);
+      continue;
+    }
+
+    if (strncmp(line_buffer, "-inline-depth ", strlen("-inline-depth ")) == 0) {
+      a->inline_depth_limit = strtoul(line_buffer + strlen("-inline-depth "), NULL, 10);
+      atto_forget_prepared_expressions(a->prepared_expressions);
+      free(line_buffer);
+      continue;
+    }
+
+    if (strncmp(line_buffer, "-specialize-size ", strlen("-specialize-size ")) == 0) {
+      a->specialization_size_limit = strtoul(line_buffer + strlen("-specialize-size "), NULL, 10);
+      atto_forget_prepared_expressions(a->prepared_expressions);
+      free(line_buffer);
+      continue;
+    }
+
+    if (strncmp(line_buffer, "-specialize-depth ", strlen("-specialize-depth ")) == 0) {
+      a->specialization_depth_limit = strtoul(line_buffer + strlen("-specialize-depth "), NULL, 10);
+      atto_forget_prepared_expressions(a->prepared_expressions);
+      free(line_buffer);
+      continue;
+    }
+
+    atto_reader_feed(r, line_buffer, strlen(line_buffer));
+    atto_reader_feed(r, "\n", 1);
+    evaluate_forms(a, r, 0);
 
     free(line_buffer);
   }
 
+  atto_destroy_reader(r);
   atto_destroy_state(a);
 
+  if (cache != NULL) {
+    atto_destroy_cache(cache);
+  }
+
   return 0;
 }
 
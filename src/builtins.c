@@ -0,0 +1,204 @@
+/*
+ *  builtins.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "state.h"
+#include "builtins.h"
+
+struct core_builtin {
+  const char *name;
+  uint32_t arity;
+  uint8_t opcode;
+  uint8_t operand_kind;
+  uint8_t result_kind;
+  uint8_t flags;
+};
+
+#define STRICT_AND_PURE (ATTO_BUILTIN_FLAG_STRICT | ATTO_BUILTIN_FLAG_PURE)
+
+static const struct core_builtin core_builtins[] = {
+  { "add",  2, ATTO_VM_OP_ADD,    ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_NUMBER,   STRICT_AND_PURE },
+  { "sub",  2, ATTO_VM_OP_SUB,    ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_NUMBER,   STRICT_AND_PURE },
+  { "mul",  2, ATTO_VM_OP_MUL,    ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_NUMBER,   STRICT_AND_PURE },
+  { "div",  2, ATTO_VM_OP_DIV,    ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_NUMBER,   STRICT_AND_PURE },
+  { "gt",   2, ATTO_VM_OP_ISGT,   ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "get",  2, ATTO_VM_OP_ISGET,  ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "lt",   2, ATTO_VM_OP_ISLT,   ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "let",  2, ATTO_VM_OP_ISLET,  ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "eq",   2, ATTO_VM_OP_ISEQ,   ATTO_OBJECT_KIND_NUMBER,   ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "is",   2, ATTO_VM_OP_ISSEQ,  ATTO_BUILTIN_KIND_UNKNOWN, ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "and",  2, ATTO_VM_OP_AND,    ATTO_OBJECT_KIND_SYMBOL,   ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "or",   2, ATTO_VM_OP_OR,     ATTO_OBJECT_KIND_SYMBOL,   ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "not",  1, ATTO_VM_OP_NOT,    ATTO_OBJECT_KIND_SYMBOL,   ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { "car",  1, ATTO_VM_OP_CAR,    ATTO_OBJECT_KIND_LIST,     ATTO_BUILTIN_KIND_UNKNOWN, STRICT_AND_PURE },
+  { "cdr",  1, ATTO_VM_OP_CDR,    ATTO_OBJECT_KIND_LIST,     ATTO_BUILTIN_KIND_UNKNOWN, STRICT_AND_PURE },
+  { "cons", 2, ATTO_VM_OP_CONS,   ATTO_BUILTIN_KIND_UNKNOWN, ATTO_OBJECT_KIND_LIST,     ATTO_BUILTIN_FLAG_PURE },
+  { "null", 1, ATTO_VM_OP_ISNULL, ATTO_BUILTIN_KIND_UNKNOWN, ATTO_OBJECT_KIND_SYMBOL,   STRICT_AND_PURE },
+  { NULL,   0, 0,                 0,                         0,                         0 }
+};
+
+/*
+ *  builtins are shared by every state; they are kept in an open addressing
+ *  table indexed by the hash of their names, while native functions are
+ *  also listed in the order in which they were registered, which gives the
+ *  operand of ATTO_VM_OP_CALLNATIVE
+ */
+static struct atto_builtin **slots = NULL;
+static size_t number_of_slots = 0;
+static size_t number_of_builtins = 0;
+
+static struct atto_builtin **natives = NULL;
+static size_t number_of_natives = 0;
+static size_t number_of_allocated_natives = 0;
+
+static void insert_builtin(struct atto_builtin *b)
+{
+  size_t i = b->hash & (number_of_slots - 1);
+
+  while (slots[i] != NULL) {
+    i = (i + 1) & (number_of_slots - 1);
+  }
+
+  slots[i] = b;
+}
+
+static void grow_slots(void)
+{
+  struct atto_builtin **previous_slots = slots;
+  size_t previous_number_of_slots = number_of_slots, i;
+
+  number_of_slots = number_of_slots ? number_of_slots * 2 : ATTO_BUILTIN_MINIMUM_SLOTS;
+  slots = (struct atto_builtin **)calloc(number_of_slots, sizeof(struct atto_builtin *));
+  assert(slots != NULL);
+
+  for (i = 0; i < previous_number_of_slots; i++) {
+    if (previous_slots[i] != NULL) {
+      insert_builtin(previous_slots[i]);
+    }
+  }
+
+  free(previous_slots);
+}
+
+static struct atto_builtin *add_builtin(const char *name, uint32_t arity, uint8_t opcode, uint8_t flags)
+{
+  struct atto_builtin *b = (struct atto_builtin *)malloc(sizeof(struct atto_builtin));
+  assert(b != NULL);
+
+  b->name = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+  assert(b->name != NULL);
+  strcpy(b->name, name);
+
+  b->hash = atto_hash_name(name);
+  b->arity = arity;
+  b->opcode = opcode;
+  b->native_index = 0;
+  b->function = NULL;
+  b->operand_kind = ATTO_BUILTIN_KIND_UNKNOWN;
+  b->result_kind = ATTO_BUILTIN_KIND_UNKNOWN;
+  b->flags = flags;
+
+  /*  the table is kept at most half full */
+  if (2 * (number_of_builtins + 1) > number_of_slots) {
+    grow_slots();
+  }
+
+  insert_builtin(b);
+  number_of_builtins++;
+
+  return b;
+}
+
+static struct atto_builtin *lookup(const char *name)
+{
+  uint32_t hash = atto_hash_name(name);
+  size_t i = hash & (number_of_slots - 1);
+
+  while (slots[i] != NULL) {
+    if ((slots[i]->hash == hash) && (strcmp(slots[i]->name, name) == 0)) {
+      return slots[i];
+    }
+
+    i = (i + 1) & (number_of_slots - 1);
+  }
+
+  return NULL;
+}
+
+/*
+ *  the table is filled in with the builtins implemented by the virtual
+ *  machine the first time it is used
+ */
+static void initialize(void)
+{
+  const struct core_builtin *current = core_builtins;
+
+  if (slots != NULL) {
+    return;
+  }
+
+  grow_slots();
+
+  while (current->name) {
+    struct atto_builtin *b = add_builtin(current->name, current->arity, current->opcode, current->flags);
+    b->operand_kind = current->operand_kind;
+    b->result_kind = current->result_kind;
+    current++;
+  }
+}
+
+const struct atto_builtin *atto_find_builtin(const char *name)
+{
+  initialize();
+
+  return lookup(name);
+}
+
+const struct atto_builtin *atto_get_native(size_t index)
+{
+  assert(index < number_of_natives);
+
+  return natives[index];
+}
+
+/*
+ *  makes a C function callable from atto code under a given name; native
+ *  functions always force their arguments, and are considered impure unless
+ *  flagged otherwise. the returned description may be used to declare the
+ *  operand and result kinds of the function. returns NULL if the name is
+ *  already taken by another builtin
+ */
+struct atto_builtin *atto_register_native(const char *name, uint32_t arity, uint8_t flags,
+  atto_native_function function)
+{
+  struct atto_builtin *b = NULL;
+
+  initialize();
+
+  if (lookup(name) != NULL) {
+    return NULL;
+  }
+
+  b = add_builtin(name, arity, ATTO_VM_OP_CALLNATIVE,
+    (uint8_t)(flags | ATTO_BUILTIN_FLAG_STRICT | ATTO_BUILTIN_FLAG_NATIVE));
+  b->function = function;
+
+  if (number_of_natives == number_of_allocated_natives) {
+    number_of_allocated_natives = number_of_allocated_natives ? number_of_allocated_natives * 2 : 16;
+    natives = (struct atto_builtin **)realloc(natives, sizeof(struct atto_builtin *) * number_of_allocated_natives);
+    assert(natives != NULL);
+  }
+
+  b->native_index = number_of_natives;
+  natives[number_of_natives] = b;
+  number_of_natives++;
+
+  return b;
+}
+
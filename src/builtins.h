@@ -0,0 +1,52 @@
+/*
+ *  builtins.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdint.h>
+
+#include "vm.h"
+
+#pragma once
+
+#define ATTO_BUILTIN_MINIMUM_SLOTS 64
+
+#define ATTO_BUILTIN_KIND_UNKNOWN 0xff
+
+/*
+ *  a native function receives the heap indices of its arguments, in the
+ *  order in which they were written, already forced; it fills in the object
+ *  it evaluates to, and returns zero if it failed
+ */
+typedef int (*atto_native_function)(struct atto_vm_state *vm, size_t *arguments, struct atto_object *result);
+
+struct atto_builtin {
+  char *name;
+  uint32_t hash;
+  uint32_t arity;
+
+  /*  the instruction implementing the builtin; native functions are called
+   *  through ATTO_VM_OP_CALLNATIVE, by their index in the native table */
+  uint8_t opcode;
+  size_t native_index;
+  atto_native_function function;
+
+  /*  the kind every operand must have for the builtin to be unable to fail,
+   *  and the kind of the object it produces, if known in advance */
+  uint8_t operand_kind;
+  uint8_t result_kind;
+
+  /*  strict builtins force their operands; pure ones depend on nothing but
+   *  their operands, and may be evaluated fewer times than written */
+  #define ATTO_BUILTIN_FLAG_STRICT (1<<0)
+  #define ATTO_BUILTIN_FLAG_PURE   (1<<1)
+  #define ATTO_BUILTIN_FLAG_NATIVE (1<<2)
+  uint8_t flags;
+};
+
+const struct atto_builtin *atto_find_builtin(const char *name);
+const struct atto_builtin *atto_get_native(size_t index);
+
+struct atto_builtin *atto_register_native(const char *name, uint32_t arity, uint8_t flags,
+  atto_native_function function);
+
@@ -0,0 +1,276 @@
+/*
+ *  cache.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "state.h"
+#include "image.h"
+#include "cache.h"
+#include "prelude.h"
+
+/*
+ *  keys are made of two hashes started from different seeds, so that they
+ *  are wide enough to tell forms apart by their keys alone
+ */
+static uint64_t hash_bytes(uint64_t key, const void *bytes, size_t length)
+{
+  uint32_t high = atto_hash_bytes((uint32_t)(key >> 32), bytes, length);
+  uint32_t low = atto_hash_bytes((uint32_t)key, bytes, length);
+
+  return ((uint64_t)high << 32) | low;
+}
+
+static int is_whitespace(char c)
+{
+  return ((c == ' ') || (c == '\n') || (c == '\t'));
+}
+
+/*
+ *  forms are hashed with runs of whitespace taken as a single space, and
+ *  with whitespace next to parantheses left out, so that reindenting a form
+ *  does not make it look like a different one
+ */
+static uint64_t hash_form(uint64_t hash, const char *form)
+{
+  const char space = ' ';
+  char previous = '(';
+
+  while (*form != 0) {
+    if (is_whitespace(*form)) {
+      while (is_whitespace(*form)) {
+        form++;
+      }
+
+      if ((*form != 0) && (*form != ')') && (previous != '(')) {
+        hash = hash_bytes(hash, &space, 1);
+      }
+
+      continue;
+    }
+
+    previous = *form;
+    hash = hash_bytes(hash, form++, 1);
+  }
+
+  return hash;
+}
+
+static uint64_t hash_settings(uint64_t hash, struct atto_state *a)
+{
+  uint64_t settings[6];
+
+  settings[0] = a->inline_size_limit;
+  settings[1] = a->inline_depth_limit;
+  settings[2] = a->specialization_size_limit;
+  settings[3] = a->specialization_depth_limit;
+  settings[4] = a->use_fast_frontend;
+  settings[5] = (a->vm_state->flags & ATTO_VM_FLAG_HASH_CONS) != 0;
+
+  return hash_bytes(hash, settings, sizeof(settings));
+}
+
+struct atto_cache *atto_allocate_cache(const char *directory)
+{
+  struct atto_cache *c = (struct atto_cache *)malloc(sizeof(struct atto_cache));
+  uint32_t version = ATTO_COMPILER_VERSION;
+  assert(c != NULL);
+
+  c->directory = (char *)malloc(sizeof(char) * (strlen(directory) + 1));
+  assert(c->directory != NULL);
+  strcpy(c->directory, directory);
+
+  /*  the directory may well exist already */
+  mkdir(directory, 0755);
+
+  /*  entries are deltas on top of the prelude, so another prelude makes
+   *  them all stale */
+  c->key = hash_bytes(((uint64_t)ATTO_HASH_SEED << 32) | (uint32_t)~ATTO_HASH_SEED, &version, sizeof(uint32_t));
+  c->key = hash_bytes(c->key, atto_prelude_image, atto_prelude_image_length);
+
+  c->is_started = 0;
+  c->is_disabled = 0;
+
+  c->hits = 0;
+  c->misses = 0;
+  c->stores = 0;
+  c->invalidations = 0;
+
+  return c;
+}
+
+void atto_destroy_cache(struct atto_cache *c)
+{
+  free(c->directory);
+  free(c);
+}
+
+static char *entry_path(struct atto_cache *c, const char *suffix)
+{
+  char *path = (char *)malloc(sizeof(char) * (strlen(c->directory) + 32));
+  assert(path != NULL);
+
+  sprintf(path, "%s/%08lx%08lx.attoc%s", c->directory,
+    (unsigned long)(c->key >> 32), (unsigned long)(c->key & 0xffffffffu), suffix);
+
+  return path;
+}
+
+struct entry_header {
+  uint32_t magic;
+  uint32_t format_version;
+  uint32_t compiler_version;
+  uint64_t key;
+  uint64_t result;
+};
+
+/*
+ *  checks that the state holds nothing but the prelude, before the first
+ *  form is looked up, and nothing but what the forms looked up since left
+ *  in it afterwards
+ */
+static int is_state_covered(struct atto_cache *c, struct atto_state *a)
+{
+  if (!c->is_started) {
+    return atto_is_new_state(a);
+  }
+
+  return (a->vm_state->number_of_instruction_streams == c->number_of_instruction_streams) &&
+         (a->number_of_symbols == c->number_of_symbols) &&
+         (a->global_environment->number_of_objects == c->number_of_globals) &&
+         (a->vm_state->heap_size == c->heap_size) &&
+         (a->vm_state->data_stack_size == c->data_stack_size);
+}
+
+/*
+ *  looks up the compiled form of a top-level form, given as source text,
+ *  and, if it is found, applies it to the state, and sets `result' to the
+ *  object the form evaluated to. returns whether the form was found; if it
+ *  was not, it has to be compiled and run as usual, and stored afterwards.
+ *  returns -1 if the state was changed by more than the forms looked up,
+ *  in which case the form is neither looked up nor to be stored
+ */
+int atto_cache_lookup(struct atto_cache *c, struct atto_state *a, const char *form, size_t *result)
+{
+  struct entry_header header;
+  char *path = NULL;
+  FILE *f = NULL;
+  int applied;
+
+  if (!c->is_disabled && !is_state_covered(c, a)) {
+    printf("cache: the state holds more than the prelude and cached forms, so forms are no longer cached\n");
+    c->is_disabled = 1;
+  }
+
+  if (c->is_disabled) {
+    return -1;
+  }
+
+  c->is_started = 1;
+  c->key = hash_form(hash_settings(c->key, a), form);
+  path = entry_path(c, "");
+  f = fopen(path, "rb");
+  free(path);
+
+  if (f == NULL) {
+    c->misses++;
+    return 0;
+  }
+
+  if ((fread(&header, sizeof(struct entry_header), 1, f) != 1) ||
+      (header.magic != ATTO_CACHE_MAGIC) ||
+      (header.format_version != ATTO_IMAGE_FORMAT_VERSION) ||
+      (header.compiler_version != ATTO_COMPILER_VERSION) ||
+      (header.key != c->key)) {
+    fclose(f);
+    c->misses++;
+    c->invalidations++;
+    return 0;
+  }
+
+  applied = atto_read_state_changes(f, a);
+  fclose(f);
+
+  if (applied < 0) {
+    printf("error: cache entry for form `%s' is damaged\n", form);
+    exit(1);
+  }
+
+  if (applied == 0) {
+    c->misses++;
+    c->invalidations++;
+    return 0;
+  }
+
+  *result = header.result;
+  c->hits++;
+
+  return 1;
+}
+
+/*
+ *  stores what the form last looked up changed in the state since it was
+ *  marked, along with the object it evaluated to; lambdas it made must have
+ *  had their bodies compiled; entries are written aside first, and then moved in place, so
+ *  that an entry is never seen half written
+ */
+void atto_cache_store(struct atto_cache *c, struct atto_state *a, struct atto_state_mark *m, size_t result)
+{
+  struct entry_header header;
+  char *path = entry_path(c, ""), *temporary_path = entry_path(c, ".tmp");
+  FILE *f = fopen(temporary_path, "wb");
+  int written;
+
+  if (f == NULL) {
+    free(path);
+    free(temporary_path);
+    return;
+  }
+
+  memset(&header, 0, sizeof(struct entry_header));
+  header.magic = ATTO_CACHE_MAGIC;
+  header.format_version = ATTO_IMAGE_FORMAT_VERSION;
+  header.compiler_version = ATTO_COMPILER_VERSION;
+  header.key = c->key;
+  header.result = result;
+
+  written = (fwrite(&header, sizeof(struct entry_header), 1, f) == 1) && atto_write_state_changes(f, a, m);
+
+  if ((fclose(f) == 0) && written && (rename(temporary_path, path) == 0)) {
+    c->stores++;
+  } else {
+    remove(temporary_path);
+  }
+
+  free(path);
+  free(temporary_path);
+}
+
+/*
+ *  notes the size of the state once the form last looked up was evaluated,
+ *  whether it was found, stored, or neither
+ */
+void atto_cache_finish_form(struct atto_cache *c, struct atto_state *a)
+{
+  c->number_of_instruction_streams = a->vm_state->number_of_instruction_streams;
+  c->number_of_symbols = a->number_of_symbols;
+  c->number_of_globals = a->global_environment->number_of_objects;
+  c->heap_size = a->vm_state->heap_size;
+  c->data_stack_size = a->vm_state->data_stack_size;
+}
+
+void pretty_print_cache_usage(struct atto_cache *c)
+{
+  printf("cache: `%s', %lu hits, %lu misses, %lu invalidations, %lu stores\n",
+    c->directory, c->hits, c->misses, c->invalidations, c->stores);
+}
+
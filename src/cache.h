@@ -0,0 +1,61 @@
+/*
+ *  cache.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "state.h"
+#include "image.h"
+
+#pragma once
+
+#define ATTO_CACHE_MAGIC 0x63747461u  /*  "attc" */
+
+/*
+ *  compiled forms are kept in a directory, one file per form, named after
+ *  the key of the form; the key of a form is the hash of its text, of the
+ *  compiler settings, and of the key of the form before it, since what a
+ *  form compiles to depends on everything which was defined before it
+ */
+struct atto_cache {
+  char *directory;
+
+  /*  the key of the form last looked up; entries only hold what their form
+   *  changed in the state, so each key is chained over the keys of all
+   *  forms before it, and the key moves on with every lookup, whether the
+   *  form is then found, stored, or neither, as forms which fail are. an
+   *  edited form thus makes the entries of all forms after it stale */
+  uint64_t key;
+
+  /*  keys only cover the prelude and the forms looked up, so the size of
+   *  the state is noted once each form was evaluated; a state which is
+   *  then found to have grown was changed by something else, such as a file
+   *  loaded on threads or an image, and forms are no longer cached for it */
+  int is_started;
+  int is_disabled;
+  size_t number_of_instruction_streams;
+  uint32_t number_of_symbols;
+  size_t number_of_globals;
+  size_t heap_size;
+  size_t data_stack_size;
+
+  size_t hits;
+  size_t misses;
+  size_t stores;
+
+  /*  entries which were found, but were made by another compiler, or for
+   *  a state which no longer looks the same, and were compiled again */
+  size_t invalidations;
+};
+
+struct atto_cache *atto_allocate_cache(const char *directory);
+void atto_destroy_cache(struct atto_cache *c);
+
+int atto_cache_lookup(struct atto_cache *c, struct atto_state *a, const char *form, size_t *result);
+void atto_cache_store(struct atto_cache *c, struct atto_state *a, struct atto_state_mark *m, size_t result);
+void atto_cache_finish_form(struct atto_cache *c, struct atto_state *a);
+
+void pretty_print_cache_usage(struct atto_cache *c);
+
@@ -12,8 +12,16 @@
 #include "vm.h"
 #include "state.h"
 #include "compiler.h"
+#include "builtins.h"
+#include "analysis.h"
+#include "optimizer.h"
 
-static struct atto_instruction_stream *allocate_instruction_stream(void)
+int is_builtin_function(const char *name)
+{
+  return atto_find_builtin(name) != NULL;
+}
+
+struct atto_instruction_stream *allocate_instruction_stream(void)
 {
   struct atto_instruction_stream *is = (struct atto_instruction_stream *)malloc(sizeof(struct atto_instruction_stream));
   assert(is != NULL);
@@ -23,56 +31,144 @@ static struct atto_instruction_stream *allocate_instruction_stream(void)
   is->stream = (struct atto_instruction *)malloc(sizeof(struct atto_instruction) * is->allocated_length);
   assert(is->stream != NULL);
 
+  is->stack_depth = 0;
+  is->number_of_captures = 0;
+  is->number_of_arguments = 0;
+  is->memoize = 0;
+  is->stub = NULL;
+
   return is;
 }
 
+/*
+ *  lambda bodies which were never called still hold on to their stubs
+ */
+void destroy_instruction_stream(struct atto_instruction_stream *is)
+{
+  if (is->stub != NULL) {
+    atto_destroy_environment(is->stub->locals);
+    destroy_expression(is->stub->expression);
+    free(is->stub);
+  }
+
+  free(is->stream);
+  free(is);
+}
+
 static void check_buffer(struct atto_instruction_stream *is)
 {
-  if (is->allocated_length == is->length - 1) {
+  if (is->allocated_length == is->length) {
     is->allocated_length *= 2;
-    is->stream = realloc(is->stream, sizeof(struct atto_instruction_stream) * is->allocated_length);
+    is->stream = realloc(is->stream, sizeof(struct atto_instruction) * is->allocated_length);
   }
 }
 
+/*
+ *  appends an instruction stream to another; since branch targets are
+ *  absolute, those of the appended instructions are moved along with them
+ */
 static void concat_buffers(struct atto_instruction_stream *dest, struct atto_instruction_stream *src)
 {
   if (dest->allocated_length - dest->length <= src->length) {
     dest->allocated_length += src->length;
-    dest->stream = realloc(dest->stream, sizeof(struct atto_instruction_stream) * dest->allocated_length);
+    dest->stream = realloc(dest->stream, sizeof(struct atto_instruction) * dest->allocated_length);
   }
 
   size_t i;
   for (i = 0; i < src->length; i++) {
     dest->stream[dest->length+i] = src->stream[i];
+
+    if ((src->stream[i].opcode == ATTO_VM_OP_B) ||
+        (src->stream[i].opcode == ATTO_VM_OP_BT) ||
+        (src->stream[i].opcode == ATTO_VM_OP_BF)) {
+      dest->stream[dest->length+i].container.offset += dest->length;
+    }
   }
 
   dest->length += src->length;
 }
 
-static void write_op_noarg(struct atto_instruction_stream *is, uint8_t opcode)
+/*
+ *  keeps track of the number of values left in the current frame by the
+ *  instructions written so far; this gives the slots of local bindings
+ */
+static void track_stack_depth(struct atto_instruction_stream *is, uint8_t opcode, size_t offset)
+{
+  switch (opcode) {
+
+  case ATTO_VM_OP_PUSHN:
+  case ATTO_VM_OP_PUSHS:
+  case ATTO_VM_OP_PUSHL:
+  case ATTO_VM_OP_PUSHZ:
+  case ATTO_VM_OP_PUSHK:
+  case ATTO_VM_OP_DUP:
+  case ATTO_VM_OP_GETGL:
+  case ATTO_VM_OP_GETLC:
+  case ATTO_VM_OP_GETAG:
+    is->stack_depth++;
+    break;
+
+  case ATTO_VM_OP_BT:
+  case ATTO_VM_OP_BF:
+  case ATTO_VM_OP_ADD:
+  case ATTO_VM_OP_SUB:
+  case ATTO_VM_OP_MUL:
+  case ATTO_VM_OP_DIV:
+  case ATTO_VM_OP_ISEQ:
+  case ATTO_VM_OP_ISLT:
+  case ATTO_VM_OP_ISLET:
+  case ATTO_VM_OP_ISGT:
+  case ATTO_VM_OP_ISGET:
+  case ATTO_VM_OP_ISSEQ:
+  case ATTO_VM_OP_OR:
+  case ATTO_VM_OP_AND:
+  case ATTO_VM_OP_CONS:
+  case ATTO_VM_OP_DROP:
+    is->stack_depth--;
+    break;
+
+  case ATTO_VM_OP_CLOSE:
+    is->stack_depth -= offset;
+    break;
+
+  case ATTO_VM_OP_CALLNATIVE:
+    is->stack_depth = is->stack_depth + 1 - atto_get_native(offset)->arity;
+    break;
+
+  default:
+    break;
+  }
+}
+
+void write_op_noarg(struct atto_instruction_stream *is, uint8_t opcode)
 {
+  track_stack_depth(is, opcode, 0);
   check_buffer(is);
   is->stream[is->length].opcode = opcode;
   is->length++;
 }
 
-static void write_op_number(struct atto_instruction_stream *is, uint8_t opcode, double number)
+void write_op_number(struct atto_instruction_stream *is, uint8_t opcode, double number)
 {
+  track_stack_depth(is, opcode, 0);
   check_buffer(is);
   is->stream[is->length].opcode = opcode;
   is->stream[is->length].container.number = number;
   is->length++;
 }
 
-static void write_op_symbol(struct atto_instruction_stream *is, uint8_t opcode, uint64_t symbol)
+void write_op_symbol(struct atto_instruction_stream *is, uint8_t opcode, uint64_t symbol)
 {
+  track_stack_depth(is, opcode, 0);
   check_buffer(is);
   is->stream[is->length].opcode = opcode;
   is->stream[is->length].container.symbol = symbol;
+  is->length++;
 }
 
-static void write_op_offset(struct atto_instruction_stream *is, uint8_t opcode, size_t offset)
+void write_op_offset(struct atto_instruction_stream *is, uint8_t opcode, size_t offset)
 {
+  track_stack_depth(is, opcode, offset);
   check_buffer(is);
   is->stream[is->length].opcode = opcode;
   is->stream[is->length].container.offset = offset;
@@ -114,21 +210,40 @@ size_t compile_expression(struct atto_state *a, struct atto_environment *env,
     return compile_application_expression(a, env, is, e->container.application_expression);
   }
 
+  if (e->kind == ATTO_EXPRESSION_KIND_LET) {
+    return compile_let_expression(a, env, is, e->container.let_expression);
+  }
+
   printf("fatal: unknown expression type `%i'.\n", e->kind);
   return 0;
 }
 
+/*
+ *  compiles an expression whose value is about to be used, forcing it first
+ *  if it might be a thunk
+ */
+size_t compile_demanded_expression(struct atto_state *a, struct atto_environment *env,
+  struct atto_instruction_stream *is, struct atto_expression *e)
+{
+  size_t r = compile_expression(a, env, is, e);
+
+  if (atto_may_be_thunk(env, e)) {
+    write_op_noarg(is, ATTO_VM_OP_EVAL);
+  }
+
+  return r;
+}
+
 size_t compile_reference(struct atto_state *a, struct atto_environment *env,
   struct atto_instruction_stream *is, char *name)
 {
-  (void) a;
-
   struct atto_environment_object *eo = NULL;
-  
+
   eo = atto_find_in_environment(env, name);
 
   if (eo == NULL) {
     printf("syntax error: unable to find object `%s'.\n", name);
+    a->number_of_errors++;
     return 0;
   }
 
@@ -148,6 +263,10 @@ size_t compile_reference(struct atto_state *a, struct atto_environment *env,
     break;
   }
 
+  case ATTO_ENVIRONMENT_OBJECT_KIND_CAPTURE:
+    write_op_offset(is, ATTO_VM_OP_GETCAP, eo->offset);
+    break;
+
   default:
     printf("fatal: unrecognised environment object kind: %i\n", eo->kind);
   }
@@ -161,8 +280,12 @@ size_t compile_if_expression(struct atto_state *a, struct atto_environment *env,
   struct atto_instruction_stream *tis = allocate_instruction_stream(),
                                  *fis = allocate_instruction_stream();
 
-  compile_expression(a, env, is, ie->condition_expression);
-  
+  compile_demanded_expression(a, env, is, ie->condition_expression);
+
+  /*  both branches start out once the condition has been consumed */
+  tis->stack_depth = is->stack_depth - 1;
+  fis->stack_depth = is->stack_depth - 1;
+
   compile_expression(a, env, tis, ie->true_evaluation_expression);
   compile_expression(a, env, fis, ie->false_evaluation_expression);
 
@@ -171,9 +294,16 @@ size_t compile_if_expression(struct atto_state *a, struct atto_environment *env,
   concat_buffers(is, tis);
 
   printf("false branch length=%lu\n", fis->length);
-  write_op_offset(is, ATTO_VM_OP_B, is->length + fis->length);
+  write_op_offset(is, ATTO_VM_OP_B, is->length + fis->length + 1);
   concat_buffers(is, fis);
 
+  is->stack_depth = fis->stack_depth;
+
+  free(tis->stream);
+  free(tis);
+  free(fis->stream);
+  free(fis);
+
   return 0;
 }
 
@@ -181,79 +311,124 @@ size_t compile_application_expression(struct atto_state *a, struct atto_environm
   struct atto_instruction_stream *is, struct atto_application_expression *ae)
 {
   char *name = ae->identifier;
-  int i = ae->number_of_parameters;
+  uint32_t i = ae->number_of_parameters;
+  const struct atto_builtin *b = atto_find_builtin(name);
+  struct atto_environment_object *eo = NULL;
 
-  do {
-    compile_expression(a, env, is, ae->parameters[i-1]);
-    i--;
-  } while (i > 0);
+  if (b != NULL) {
+    if (ae->number_of_parameters != b->arity) {
+      printf("syntax error: `%s' expects %u operand(s), but was given %u.\n",
+        name, b->arity, ae->number_of_parameters);
+      a->number_of_errors++;
+      return 1;
+    }
 
-  /*  we first see if it's a built-in function */
-  if (strcmp(name, "add") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_ADD);
-    return 0;
-  } else if (strcmp(name, "sub") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_SUB);
-    return 0;
-  } else if (strcmp(name, "mul") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_MUL);
-    return 0;
-  } else if (strcmp(name, "div") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_DIV);
-    return 0;
-  } else if (strcmp(name, "gt") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_ISGT);
-    return 0;
-  } else if (strcmp(name, "get") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_ISGET);
-    return 0;
-  } else if (strcmp(name, "lt") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_ISLT);
-    return 0;
-  } else if (strcmp(name, "let") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_ISLET);
-    return 0;
-  } else if (strcmp(name, "eq") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_ISEQ);
+    /*  operands of builtins are always used right away; those of native
+     *  functions are pushed in the order in which they were written, so
+     *  that the functions may read them straight off the stack */
+    if (b->flags & ATTO_BUILTIN_FLAG_NATIVE) {
+      for (i = 0; i < ae->number_of_parameters; i++) {
+        compile_demanded_expression(a, env, is, ae->parameters[i]);
+      }
+
+      write_op_offset(is, ATTO_VM_OP_CALLNATIVE, b->native_index);
+      return 0;
+    }
+
+    while (i > 0) {
+      compile_demanded_expression(a, env, is, ae->parameters[i-1]);
+      i--;
+    }
+
+    write_op_noarg(is, b->opcode);
     return 0;
-  } else if (strcmp(name, "is") == 0) {
-    printf("isseq\n");
-    return 1;
-  } else if (strcmp(name, "and") == 0) {
-    printf("and\n");
-    return 1;
-  } else if (strcmp(name, "or") == 0) {
-    printf("or\n");
-    return 1;
-  } else if (strcmp(name, "not") == 0) {
-    printf("not\n");
-    return 1;
-  } else if (strcmp(name, "car") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_CAR);
-    return 1;
-  } else if (strcmp(name, "cdr") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_CDR);
-    return 1;
-  } else if (strcmp(name, "cons") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_CONS);
-    return 1;
-  } else if (strcmp(name, "null") == 0) {
-    write_op_noarg(is, ATTO_VM_OP_ISNULL);
-    return 1;
+  }
+
+  /*  arguments of lambdas are forced by the lambdas themselves, if needed */
+  while (i > 0) {
+    compile_expression(a, env, is, ae->parameters[i-1]);
+    i--;
   }
 
   compile_reference(a, env, is, ae->identifier);
+
+  eo = atto_find_in_environment(env, ae->identifier);
+  if ((eo == NULL) || !(eo->flags & ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED)) {
+    write_op_noarg(is, ATTO_VM_OP_EVAL);
+  }
+
   write_op_noarg(is, ATTO_VM_OP_CALL);
   write_op_offset(is, ATTO_VM_OP_CLOSE, ae->number_of_parameters);
 
   return 0;
 }
 
+/*
+ *  returns whether a list literal is made up only of constants, and thus
+ *  evaluates to the same list every time
+ */
+static int is_constant_list_literal(struct atto_list_literal_expression *lle)
+{
+  uint32_t i;
+
+  for (i = 0; i < lle->number_of_elements; i++) {
+    struct atto_expression *e = lle->elements[i];
+
+    if ((e->kind != ATTO_EXPRESSION_KIND_NUMBER_LITERAL) &&
+        (e->kind != ATTO_EXPRESSION_KIND_SYMBOL_LITERAL) &&
+        ((e->kind != ATTO_EXPRESSION_KIND_LIST_LITERAL) ||
+         !is_constant_list_literal(e->container.list_literal_expression))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ *  builds the object a constant expression evaluates to on the heap, in the
+ *  same shape the instructions for it would have built, and returns its
+ *  index; nothing ever writes to it afterwards, since it holds no thunks
+ */
+static size_t materialize_constant(struct atto_vm_state *vm, struct atto_expression *e)
+{
+  if (e->kind == ATTO_EXPRESSION_KIND_LIST_LITERAL) {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    uint32_t i = lle->number_of_elements;
+    size_t index = atto_allocate_null(vm);
+
+    while (i > 0) {
+      index = atto_allocate_list(vm, materialize_constant(vm, lle->elements[i - 1]), index);
+      i--;
+    }
+
+    return index;
+  }
+
+  if (e->kind == ATTO_EXPRESSION_KIND_NUMBER_LITERAL) {
+    return atto_allocate_number(vm, e->container.number_literal);
+  }
+
+  return atto_allocate_symbol(vm, e->container.symbol_literal);
+}
+
 size_t compile_list_literal_expression(struct atto_state *a, struct atto_environment *env,
   struct atto_instruction_stream *is, struct atto_list_literal_expression *lle)
 {
   int i = lle->number_of_elements;
 
+  /*  lists of constants are built once, right now, instead of every time
+   *  they are evaluated */
+  if ((lle->number_of_elements > 0) && is_constant_list_literal(lle)) {
+    struct atto_expression wrapper;
+
+    wrapper.kind = ATTO_EXPRESSION_KIND_LIST_LITERAL;
+    wrapper.container.list_literal_expression = lle;
+
+    write_op_offset(is, ATTO_VM_OP_PUSHK, materialize_constant(a->vm_state, &wrapper));
+    return 1;
+  }
+
   write_op_noarg(is, ATTO_VM_OP_PUSHZ);
 
   if (lle->number_of_elements == 0) {
@@ -270,80 +445,348 @@ size_t compile_list_literal_expression(struct atto_state *a, struct atto_environ
   return 0;
 }
 
-size_t compile_lambda_expression(struct atto_state *a, struct atto_environment *env,
-  struct atto_instruction_stream *is, struct atto_lambda_expression *le)
+/*
+ *  compiles a let expression; every bound value is left in the slot of the
+ *  current frame it was pushed into, where the body reads it from, and the
+ *  slots are discarded once the body has been evaluated
+ */
+size_t compile_let_expression(struct atto_state *a, struct atto_environment *env,
+  struct atto_instruction_stream *is, struct atto_let_expression *le)
 {
-  uint32_t i = le->number_of_parameters;
+  uint32_t i;
 
-  struct atto_environment *local_env = (struct atto_environment *)malloc(sizeof(struct atto_environment));
-  assert(local_env != NULL);
+  struct atto_environment *local_env = atto_allocate_environment(env);
 
-  local_env->parent = env;
-  local_env->head = NULL;
+  for (i = 0; i < le->number_of_bindings; i++) {
+    struct atto_environment *binding_env = le->sequential ? local_env : env;
+    struct atto_environment_object *eo = NULL;
+    size_t slot = is->stack_depth;
 
-  do {
-    atto_add_to_environment(local_env, le->parameter_names[le->number_of_parameters - i], ATTO_ENVIRONMENT_OBJECT_KIND_ARGUMENT, le->number_of_parameters - i);
-    i--;
-  } while (i > 0);
+    compile_expression(a, binding_env, is, le->binding_expressions[i]);
 
-  struct atto_instruction_stream *lis = allocate_instruction_stream();
+    eo = atto_add_to_environment(local_env, le->binding_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_LOCAL, slot);
+    if (!atto_may_be_thunk(binding_env, le->binding_expressions[i])) {
+      eo->flags |= ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED;
+    }
+  }
+
+  compile_expression(a, local_env, is, le->body);
+
+  if (le->number_of_bindings > 0) {
+    write_op_offset(is, ATTO_VM_OP_CLOSE, le->number_of_bindings);
+  }
+
+  atto_destroy_environment(local_env);
+
+  return 0;
+}
+
+/*
+ *  compiles the body of a lambda into its own instruction stream
+ */
+static void compile_lambda_body(struct atto_state *a, struct atto_environment *env,
+  struct atto_instruction_stream *lis, struct atto_lambda_expression *le)
+{
+  uint32_t i;
+  uint32_t strict_parameters = atto_analyze_strictness(env, le);
+
+  struct atto_environment *local_env = atto_allocate_environment(env);
+
+  /*  parameters which the body is certain to force are forced on entry, so
+   *  that their uses need not check for thunks */
+  for (i = 0; i < le->number_of_parameters; i++) {
+    struct atto_environment_object *eo = atto_add_to_environment(local_env, le->parameter_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_ARGUMENT, i);
+
+    if ((i < ATTO_ANALYSIS_MAX_STRICT_PARAMETERS) && (strict_parameters & ((uint32_t)1 << i))) {
+      eo->flags |= ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED;
+
+      write_op_offset(lis, ATTO_VM_OP_GETAG, i);
+      write_op_noarg(lis, ATTO_VM_OP_EVAL);
+      write_op_noarg(lis, ATTO_VM_OP_DROP);
+    }
+  }
 
   compile_expression(a, local_env, lis, le->body);
   write_op_noarg(lis, ATTO_VM_OP_RET);
 
-  /*  add to instruction stream table */
-  a->vm_state->instruction_streams[a->vm_state->number_of_instruction_streams] = lis;
-  a->vm_state->number_of_instruction_streams++;
+  atto_destroy_environment(local_env);
+}
+
+/*
+ *  finds the variables an expression found in a lambda body refers to which
+ *  live in the frames the lambda is created in; `scope' holds the names
+ *  bound inside the lambda itself, and every variable found is added to
+ *  `captured', numbered in the order in which it was first seen
+ */
+static void find_captures(struct atto_environment *env, struct atto_environment *scope,
+  struct atto_expression *e, struct atto_environment *captured);
+
+static void capture_name(struct atto_environment *env, struct atto_environment *scope,
+  char *name, struct atto_environment *captured)
+{
+  struct atto_environment_object *eo = NULL, *capture = NULL;
+
+  if ((atto_find_in_environment(scope, name) != NULL) ||
+      (atto_find_in_environment(captured, name) != NULL)) {
+    return;
+  }
+
+  eo = atto_find_in_environment(env, name);
+  if ((eo == NULL) || (eo->kind == ATTO_ENVIRONMENT_OBJECT_KIND_GLOBAL)) {
+    return;
+  }
+
+  capture = atto_add_to_environment(captured, name, ATTO_ENVIRONMENT_OBJECT_KIND_CAPTURE, captured->number_of_objects);
+  capture->flags = eo->flags;
+  capture->strict_parameters = eo->strict_parameters;
+}
+
+static void find_captures(struct atto_environment *env, struct atto_environment *scope,
+  struct atto_expression *e, struct atto_environment *captured)
+{
+  struct atto_environment *inner = NULL;
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    capture_name(env, scope, e->container.reference_identifier, captured);
+    break;
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      find_captures(env, scope, lle->elements[i], captured);
+    }
+    break;
+  }
 
-  write_op_offset(is, ATTO_VM_OP_PUSHL, a->vm_state->number_of_instruction_streams - 1);
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    find_captures(env, scope, ie->condition_expression, captured);
+    find_captures(env, scope, ie->true_evaluation_expression, captured);
+    find_captures(env, scope, ie->false_evaluation_expression, captured);
+    break;
+  }
+
+  /*  builtins take precedence over variables of the same name */
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    if (atto_find_builtin(ae->identifier) == NULL) {
+      capture_name(env, scope, ae->identifier, captured);
+    }
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      find_captures(env, scope, ae->parameters[i], captured);
+    }
+    break;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    inner = atto_allocate_environment(scope);
+    for (i = 0; i < le->number_of_bindings; i++) {
+      find_captures(env, le->sequential ? inner : scope, le->binding_expressions[i], captured);
+      atto_add_to_environment(inner, le->binding_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_LOCAL, i);
+    }
+    find_captures(env, inner, le->body, captured);
+    atto_destroy_environment(inner);
+    break;
+  }
+
+  /*  variables captured by nested lambdas have to be captured by this one
+   *  as well, since it is the one they are copied from */
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+    inner = atto_allocate_environment(scope);
+    for (i = 0; i < le->number_of_parameters; i++) {
+      atto_add_to_environment(inner, le->parameter_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_ARGUMENT, i);
+    }
+    find_captures(env, inner, le->body, captured);
+    atto_destroy_environment(inner);
+    break;
+  }
+
+  default:
+    break;
+  }
+}
+
+/*
+ *  lambdas are only registered here, along with what is needed to compile
+ *  them later on; their bodies are compiled by the virtual machine calling
+ *  `compile_lambda_stub' right before they are first run, so that bodies
+ *  which never run are never compiled. lambdas are flat closures: the
+ *  values of the local variables they refer to are pushed right before
+ *  the lambda, and copied into it once it is created
+ */
+size_t compile_lambda_expression(struct atto_state *a, struct atto_environment *env,
+  struct atto_instruction_stream *is, struct atto_lambda_expression *le)
+{
+  struct atto_instruction_stream *lis = allocate_instruction_stream();
+  struct atto_lambda_stub *stub = (struct atto_lambda_stub *)malloc(sizeof(struct atto_lambda_stub));
+  struct atto_environment *captured = atto_allocate_environment(NULL), *globals = env;
+  struct atto_expression wrapper;
+  char **names = NULL;
+  size_t i;
+  assert(stub != NULL);
+
+  wrapper.kind = ATTO_EXPRESSION_KIND_LAMBDA;
+  wrapper.container.lambda_expression = le;
+
+  find_captures(env, NULL, &wrapper, captured);
+
+  /*  captured values are pushed in the order of their numbers */
+  if (captured->number_of_objects > 0) {
+    struct atto_environment_object *current = NULL;
+
+    names = (char **)malloc(sizeof(char *) * captured->number_of_objects);
+    assert(names != NULL);
+
+    for (current = captured->head; current != NULL; current = current->next) {
+      names[current->offset] = current->name;
+    }
+
+    for (i = 0; i < captured->number_of_objects; i++) {
+      compile_reference(a, env, is, names[i]);
+    }
+
+    free(names);
+  }
+
+  /*  the global environment, which ends the chain, is only remembered by
+   *  its head, since its objects are never removed */
+  while (globals->parent != NULL) {
+    globals = globals->parent;
+  }
+
+  stub->state = a;
+  stub->expression = copy_expression(&wrapper);
+  stub->locals = captured;
+  stub->globals = globals->head;
+
+  lis->stub = stub;
+  lis->number_of_captures = captured->number_of_objects;
+  lis->number_of_arguments = le->number_of_parameters;
+
+  write_op_offset(is, ATTO_VM_OP_PUSHL, atto_add_instruction_stream(a->vm_state, lis));
+  is->stack_depth -= lis->number_of_captures;
 
   return 0;
 }
 
+/*
+ *  compiles the body of a lambda in place of its stub; bodies which fail
+ *  to compile are replaced by one which stops the virtual machine, so that
+ *  every call fails, and not only the first one, which reports the errors
+ */
+void compile_lambda_stub(struct atto_instruction_stream *is)
+{
+  struct atto_lambda_stub *stub = is->stub;
+  struct atto_environment *globals = atto_allocate_environment_view(stub->state->global_environment, stub->globals);
+  size_t errors = stub->state->number_of_errors;
+
+  stub->locals->parent = globals;
+
+  /*  the stub is removed first, since the body may well call itself */
+  is->stub = NULL;
+
+  compile_lambda_body(stub->state, stub->locals, is, stub->expression->container.lambda_expression);
+
+  if (stub->state->number_of_errors != errors) {
+    is->length = 0;
+    is->stack_depth = 0;
+    write_op_noarg(is, ATTO_VM_OP_FAIL);
+  }
+
+  atto_destroy_environment(stub->locals);
+  atto_destroy_environment(globals);
+  destroy_expression(stub->expression);
+  free(stub);
+}
+
 void compile_definition(struct atto_state *a, struct atto_definition *d)
 {
-  struct atto_instruction_stream *is = allocate_instruction_stream();
-  
-  size_t definition_instruction_stream_index = a->vm_state->number_of_instruction_streams;
-  a->vm_state->instruction_streams[definition_instruction_stream_index] = is;
-  a->vm_state->number_of_instruction_streams++;
+  struct atto_instruction_stream *is = NULL;
+  struct atto_environment_object *eo = NULL;
+  size_t definition_instruction_stream_index;
 
-  atto_add_to_environment(a->global_environment, d->identifier, ATTO_ENVIRONMENT_OBJECT_KIND_GLOBAL, a->vm_state->data_stack_size);
+  if (d->memoize && (d->body->kind != ATTO_EXPRESSION_KIND_LAMBDA)) {
+    printf("syntax error: only lambdas may be memoized; `%s' will not be\n", d->identifier);
+    a->number_of_errors++;
+    d->memoize = 0;
+  }
+
+  /*  fusing traversals and specializing calls may define lambdas of their
+   *  own, so it has to be done before this definition claims its place on
+   *  the stack */
+  d->body = atto_fuse_traversals(a, a->global_environment, d->body, d->identifier);
+  d->body = atto_specialize_applications(a, a->global_environment, atto_fold_constants(d->body), d->identifier);
+
+  is = allocate_instruction_stream();
+  definition_instruction_stream_index = atto_add_instruction_stream(a->vm_state, is);
+
+  atto_claim_global_slot(a->vm_state);
+  eo = atto_add_to_environment(a->global_environment, d->identifier, ATTO_ENVIRONMENT_OBJECT_KIND_GLOBAL, a->vm_state->data_stack_size);
+
+  /*  the body is optimized only once the definition is in place, so that
+   *  the body refers to the same objects it will be compiled against */
+  d->body = atto_optimize_expression(a, a->global_environment, d->body);
+
+  /*  a lambda is known to be evaluated even before it is compiled, which lets
+   *  recursive calls skip forcing it; its strictness is found by starting
+   *  from the assumption that all parameters are strict, and weakening it
+   *  until recursive calls agree with the body */
+  if (d->body->kind == ATTO_EXPRESSION_KIND_LAMBDA) {
+    uint32_t strict_parameters;
+
+    eo->flags |= ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED;
+    eo->expression = copy_expression(d->body);
+    eo->strict_parameters = ~(uint32_t)0;
+
+    do {
+      strict_parameters = eo->strict_parameters;
+      eo->strict_parameters = atto_analyze_strictness(a->global_environment, d->body->container.lambda_expression);
+    } while (eo->strict_parameters != strict_parameters);
+
+    /*  memoized lambdas force all of their arguments when called; their
+     *  bodies are kept away from the optimizer, since calls which are
+     *  inlined or specialized would no longer be remembered */
+    if (d->memoize) {
+      uint32_t n = d->body->container.lambda_expression->number_of_parameters;
+
+      eo->strict_parameters = (n < ATTO_ANALYSIS_MAX_STRICT_PARAMETERS) ? (((uint32_t)1 << n) - 1) : ~(uint32_t)0;
+      destroy_expression(eo->expression);
+      eo->expression = NULL;
+    }
+  }
 
   compile_expression(a, a->global_environment, is, d->body);
   write_op_noarg(is, ATTO_VM_OP_STOP);
 
-  switch (d->body->kind) {
-  
-  /*  immediate values are compiled and then executed, in order to be saved
-   *  on the stack */
-  case ATTO_EXPRESSION_KIND_LAMBDA:
-  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
-  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
-  case ATTO_EXPRESSION_KIND_REFERENCE: {
+  /*  bodies which are cheap and cannot fail are evaluated right away, in
+   *  order for their values to be saved on the stack; everything else is
+   *  the subject of lazy evaluation, since evaluating it might be wasted
+   *  work, or might even fail or never finish */
+  if (atto_is_expression_eager(a, a->global_environment, d->body)) {
     printf("running instruction stream %lu\n", definition_instruction_stream_index);
     atto_run_instruction_stream(a->vm_state, definition_instruction_stream_index);
-    break;
-  }
 
-  /*  list literals, if expressions and function applications are the subjects
-   *  of lazy evaluation */
-  case ATTO_EXPRESSION_KIND_LIST_LITERAL:
-  case ATTO_EXPRESSION_KIND_IF:
-  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    if (a->vm_state->heap[a->vm_state->data_stack[a->vm_state->data_stack_size - 1]].kind != ATTO_OBJECT_KIND_THUNK) {
+      eo->flags |= ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED;
+    }
+
+    if (d->memoize) {
+      struct atto_object *lambda = &a->vm_state->heap[a->vm_state->data_stack[a->vm_state->data_stack_size - 1]];
+      a->vm_state->instruction_streams[lambda->container.lambda.instruction_stream_index]->memoize = 1;
+    }
+  } else {
     a->vm_state->heap[a->vm_state->heap_size].kind = ATTO_OBJECT_KIND_THUNK;
-    a->vm_state->heap[a->vm_state->heap_size].container.instruction_stream_index = a->vm_state->number_of_instruction_streams - 1;
+    a->vm_state->heap[a->vm_state->heap_size].container.instruction_stream_index = definition_instruction_stream_index;
     a->vm_state->heap_size++;
 
     a->vm_state->data_stack[a->vm_state->data_stack_size] = a->vm_state->heap_size - 1;
     a->vm_state->data_stack_size++;
-    break;
   }
-
-  default:
-    break;
-  }
-
 }
 
 void pretty_print_instruction_stream(struct atto_instruction_stream *is)
@@ -10,9 +10,27 @@
 
 #pragma once
 
+/*
+ *  what is needed to compile a lambda body at a later time: the lambda
+ *  itself, the variables it captures, and the global environment as it was
+ *  back then, so that the body refers to the same objects it would have
+ *  referred to if compiled right away
+ */
+struct atto_lambda_stub {
+  struct atto_state *state;
+  struct atto_expression *expression;
+  struct atto_environment *locals;
+  struct atto_environment_object *globals;
+};
+
+int is_builtin_function(const char *name);
+
 size_t compile_expression(struct atto_state *a, struct atto_environment *env,
   struct atto_instruction_stream *is, struct atto_expression *e);
 
+size_t compile_demanded_expression(struct atto_state *a, struct atto_environment *env,
+  struct atto_instruction_stream *is, struct atto_expression *e);
+
 size_t compile_reference(struct atto_state *a, struct atto_environment *env,
   struct atto_instruction_stream *is, char *name);
 
@@ -25,9 +43,22 @@ size_t compile_application_expression(struct atto_state *a, struct atto_environm
 size_t compile_list_literal_expression(struct atto_state *a, struct atto_environment *env,
   struct atto_instruction_stream *is, struct atto_list_literal_expression *lle);
 
+size_t compile_let_expression(struct atto_state *a, struct atto_environment *env,
+  struct atto_instruction_stream *is, struct atto_let_expression *le);
+
 size_t compile_lambda_expression(struct atto_state *a, struct atto_environment *env,
   struct atto_instruction_stream *is, struct atto_lambda_expression *le);
 
+struct atto_instruction_stream *allocate_instruction_stream(void);
+void destroy_instruction_stream(struct atto_instruction_stream *is);
+
+void write_op_noarg(struct atto_instruction_stream *is, uint8_t opcode);
+void write_op_number(struct atto_instruction_stream *is, uint8_t opcode, double number);
+void write_op_symbol(struct atto_instruction_stream *is, uint8_t opcode, uint64_t symbol);
+void write_op_offset(struct atto_instruction_stream *is, uint8_t opcode, size_t offset);
+
+void compile_lambda_stub(struct atto_instruction_stream *is);
+
 void compile_definition(struct atto_state *a, struct atto_definition *d);
 
 void pretty_print_instruction_stream(struct atto_instruction_stream *is);
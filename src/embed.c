@@ -0,0 +1,49 @@
+/*
+ *  embed.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ *  prints a C source file which defines the contents of a file as an array
+ *  of bytes called `name', along with its length in `name_length'; this is
+ *  how the prelude image is linked into atto. a zero is added at the end,
+ *  since arrays may not be empty, but is not counted in the length
+ */
+int main(int argc, char **argv)
+{
+  FILE *f = NULL;
+  unsigned long length = 0;
+  int c;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <file> <name>\n", argv[0]);
+    return 1;
+  }
+
+  f = fopen(argv[1], "rb");
+
+  if (f == NULL) {
+    fprintf(stderr, "error: unable to open `%s'\n", argv[1]);
+    return 1;
+  }
+
+  printf("/*  generated from `%s'; do not edit */\n\n", argv[1]);
+  printf("#include <stdlib.h>\n\n");
+  printf("const unsigned char %s[] = {", argv[2]);
+
+  while ((c = fgetc(f)) != EOF) {
+    printf("%s0x%02x,", ((length % 12) == 0) ? "\n  " : " ", c);
+    length++;
+  }
+
+  printf("%s0x00\n};\n\n", ((length % 12) == 0) ? "\n  " : " ");
+  printf("const size_t %s_length = %lu;\n", argv[2], length);
+
+  fclose(f);
+
+  return 0;
+}
+
@@ -0,0 +1,385 @@
+/*
+ *  frontend.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "state.h"
+#include "builtins.h"
+#include "compiler.h"
+#include "frontend.h"
+
+/*  longer names are left to the full pipeline */
+#define MAX_NAME_LENGTH 256
+
+/*
+ *  the single pass frontend compiles top-level expressions straight from
+ *  their source text, without building tokens, syntax trees or expression
+ *  trees; it only knows literals, references to globals, `if', `list' and
+ *  applications of named functions, and gives up on anything else, which
+ *  is then left to the full pipeline
+ */
+struct frontend {
+  struct atto_state *a;
+  struct atto_instruction_stream *is;
+  const char *cursor;
+};
+
+static int compile_form(struct frontend *f, int *may_be_thunk);
+
+static int is_digit(char c)
+{
+  return ((c >= '0') && (c <= '9'));
+}
+
+static int is_letter(char c)
+{
+  return (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')));
+}
+
+static int is_whitespace(char c)
+{
+  return ((c == ' ') || (c == '\n') || (c == '\t'));
+}
+
+static void skip_whitespace(struct frontend *f)
+{
+  while (is_whitespace(*f->cursor)) {
+    f->cursor++;
+  }
+}
+
+/*
+ *  reads an identifier, or, if `symbol' is set, the name of a symbol; the
+ *  same characters as in the lexer are accepted
+ */
+static int read_name(struct frontend *f, char *name, int symbol)
+{
+  size_t length = 0;
+
+  while (is_letter(*f->cursor) || is_digit(*f->cursor) || (*f->cursor == '-') ||
+         (!symbol && (*f->cursor == '*'))) {
+    if (length == MAX_NAME_LENGTH - 1) {
+      return 0;
+    }
+
+    name[length++] = *f->cursor++;
+  }
+
+  name[length] = 0;
+
+  return 1;
+}
+
+static int is_branch(uint8_t opcode)
+{
+  return ((opcode == ATTO_VM_OP_B) || (opcode == ATTO_VM_OP_BT) || (opcode == ATTO_VM_OP_BF));
+}
+
+static void reverse_instructions(struct atto_instruction *stream, size_t from, size_t to)
+{
+  while ((from + 1) < to) {
+    struct atto_instruction temp = stream[from];
+    stream[from] = stream[to - 1];
+    stream[to - 1] = temp;
+    from++;
+    to--;
+  }
+}
+
+/*
+ *  moves the instructions written since `segment' in front of those
+ *  written since `region'; this is how operands, which are read first to
+ *  last but evaluated last to first, end up in the right order without
+ *  being compiled anywhere else. branch targets are absolute, so they are
+ *  moved along with their instructions
+ */
+static void move_to_front(struct atto_instruction_stream *is, size_t region, size_t segment)
+{
+  size_t i;
+
+  for (i = region; i < is->length; i++) {
+    if (!is_branch(is->stream[i].opcode)) {
+      continue;
+    }
+
+    if (i < segment) {
+      is->stream[i].container.offset += is->length - segment;
+    } else {
+      is->stream[i].container.offset -= segment - region;
+    }
+  }
+
+  reverse_instructions(is->stream, region, segment);
+  reverse_instructions(is->stream, segment, is->length);
+  reverse_instructions(is->stream, region, is->length);
+}
+
+/*
+ *  compiles the operands of an application up to its closing parenthesis,
+ *  the last one ending up first; operands of builtins are forced as soon as
+ *  they are evaluated. list elements are each followed by `cons'
+ */
+static int compile_operands(struct frontend *f, int demanded, int cons, uint32_t *count)
+{
+  size_t region = f->is->length;
+  int may_be_thunk = 0;
+
+  *count = 0;
+  skip_whitespace(f);
+
+  while (*f->cursor != ')') {
+    size_t segment = f->is->length;
+
+    if (!compile_form(f, &may_be_thunk)) {
+      return 0;
+    }
+
+    if (demanded && may_be_thunk) {
+      write_op_noarg(f->is, ATTO_VM_OP_EVAL);
+    }
+
+    if (cons) {
+      write_op_noarg(f->is, ATTO_VM_OP_CONS);
+    }
+
+    move_to_front(f->is, region, segment);
+    (*count)++;
+    skip_whitespace(f);
+  }
+
+  f->cursor++;
+
+  return 1;
+}
+
+/*
+ *  the branches are written right after the condition, and the targets of
+ *  the branch instructions are filled in once they are known
+ */
+static int compile_if(struct frontend *f, int *may_be_thunk)
+{
+  struct atto_instruction_stream *is = f->is;
+  size_t branch_if_false, branch_to_end, stack_depth;
+  int condition_may_be_thunk = 0, true_may_be_thunk = 0, false_may_be_thunk = 0;
+
+  if (!compile_form(f, &condition_may_be_thunk)) {
+    return 0;
+  }
+
+  if (condition_may_be_thunk) {
+    write_op_noarg(is, ATTO_VM_OP_EVAL);
+  }
+
+  branch_if_false = is->length;
+  write_op_offset(is, ATTO_VM_OP_BF, 0);
+  stack_depth = is->stack_depth;
+
+  if (!compile_form(f, &true_may_be_thunk)) {
+    return 0;
+  }
+
+  branch_to_end = is->length;
+  write_op_offset(is, ATTO_VM_OP_B, 0);
+  is->stream[branch_if_false].container.offset = is->length;
+  is->stack_depth = stack_depth;
+
+  if (!compile_form(f, &false_may_be_thunk)) {
+    return 0;
+  }
+
+  is->stream[branch_to_end].container.offset = is->length;
+
+  skip_whitespace(f);
+  if (*f->cursor != ')') {
+    return 0;
+  }
+  f->cursor++;
+
+  *may_be_thunk = true_may_be_thunk || false_may_be_thunk;
+
+  return 1;
+}
+
+static int compile_application(struct frontend *f, char *name, int *may_be_thunk)
+{
+  const struct atto_builtin *b = atto_find_builtin(name);
+  struct atto_environment_object *eo = NULL;
+  int operand_may_be_thunk = 0;
+  uint32_t count = 0;
+
+  /*  native functions take their operands in the order in which they were
+   *  written, so those need not be moved */
+  if ((b != NULL) && (b->flags & ATTO_BUILTIN_FLAG_NATIVE)) {
+    skip_whitespace(f);
+
+    while (*f->cursor != ')') {
+      if (!compile_form(f, &operand_may_be_thunk)) {
+        return 0;
+      }
+
+      if (operand_may_be_thunk) {
+        write_op_noarg(f->is, ATTO_VM_OP_EVAL);
+      }
+
+      count++;
+      skip_whitespace(f);
+    }
+
+    f->cursor++;
+
+    if (count != b->arity) {
+      return 0;
+    }
+
+    write_op_offset(f->is, ATTO_VM_OP_CALLNATIVE, b->native_index);
+    *may_be_thunk = (b->result_kind == ATTO_BUILTIN_KIND_UNKNOWN);
+    return 1;
+  }
+
+  if (b != NULL) {
+    if (!compile_operands(f, 1, 0, &count) || (count != b->arity)) {
+      return 0;
+    }
+
+    write_op_noarg(f->is, b->opcode);
+    *may_be_thunk = (b->result_kind == ATTO_BUILTIN_KIND_UNKNOWN);
+    return 1;
+  }
+
+  eo = atto_find_in_environment(f->a->global_environment, name);
+  if ((eo == NULL) || !compile_operands(f, 0, 0, &count)) {
+    return 0;
+  }
+
+  compile_reference(f->a, f->a->global_environment, f->is, name);
+
+  if (!(eo->flags & ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED)) {
+    write_op_noarg(f->is, ATTO_VM_OP_EVAL);
+  }
+
+  write_op_noarg(f->is, ATTO_VM_OP_CALL);
+  write_op_offset(f->is, ATTO_VM_OP_CLOSE, count);
+
+  *may_be_thunk = 1;
+  return 1;
+}
+
+/*
+ *  compiles the form starting at the cursor, returning zero if it is not
+ *  one the frontend knows; `may_be_thunk' is set if the value it leaves on
+ *  the stack might need forcing
+ */
+static int compile_form(struct frontend *f, int *may_be_thunk)
+{
+  char name[MAX_NAME_LENGTH];
+  uint32_t count = 0;
+
+  skip_whitespace(f);
+  *may_be_thunk = 0;
+
+  if (is_digit(*f->cursor) || (*f->cursor == '-')) {
+    char *end = NULL;
+    double number = strtod(f->cursor, &end);
+
+    if ((end == f->cursor) || ((*end != 0) && (*end != ')') && !is_whitespace(*end))) {
+      return 0;
+    }
+
+    f->cursor = end;
+    write_op_number(f->is, ATTO_VM_OP_PUSHN, number);
+    return 1;
+  }
+
+  if (*f->cursor == ':') {
+    f->cursor++;
+
+    if (!read_name(f, name, 1)) {
+      return 0;
+    }
+
+    write_op_symbol(f->is, ATTO_VM_OP_PUSHS, atto_intern_symbol(f->a, name, strlen(name)));
+    return 1;
+  }
+
+  if (is_letter(*f->cursor)) {
+    struct atto_environment_object *eo = NULL;
+
+    if (!read_name(f, name, 0)) {
+      return 0;
+    }
+
+    eo = atto_find_in_environment(f->a->global_environment, name);
+    if (eo == NULL) {
+      return 0;
+    }
+
+    compile_reference(f->a, f->a->global_environment, f->is, name);
+    *may_be_thunk = !(eo->flags & ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED);
+    return 1;
+  }
+
+  if (*f->cursor != '(') {
+    return 0;
+  }
+
+  f->cursor++;
+  skip_whitespace(f);
+
+  if (!is_letter(*f->cursor) || !read_name(f, name, 0)) {
+    return 0;
+  }
+
+  if ((strcmp(name, "lambda") == 0) || (strcmp(name, "define") == 0) ||
+      (strcmp(name, "define-memo") == 0) || (strcmp(name, "let*") == 0)) {
+    return 0;
+  }
+
+  /*  `let' followed by a list is the let form, and not the builtin */
+  if (strcmp(name, "let") == 0) {
+    skip_whitespace(f);
+    if (*f->cursor == '(') {
+      return 0;
+    }
+  }
+
+  if (strcmp(name, "if") == 0) {
+    return compile_if(f, may_be_thunk);
+  }
+
+  if (strcmp(name, "list") == 0) {
+    write_op_noarg(f->is, ATTO_VM_OP_PUSHZ);
+    return compile_operands(f, 0, 1, &count);
+  }
+
+  return compile_application(f, name, may_be_thunk);
+}
+
+/*
+ *  compiles a top-level expression, given as source text, into an
+ *  instruction stream; returns zero if the expression is not one the single
+ *  pass frontend knows, or is not well formed, in which case the stream is
+ *  left in an unspecified state, and should be discarded
+ */
+int atto_compile_source(struct atto_state *a, const char *source, struct atto_instruction_stream *is)
+{
+  struct frontend f;
+  int may_be_thunk = 0;
+
+  f.a = a;
+  f.is = is;
+  f.cursor = source;
+
+  skip_whitespace(&f);
+  if ((*f.cursor != '(') || !compile_form(&f, &may_be_thunk)) {
+    return 0;
+  }
+
+  skip_whitespace(&f);
+
+  return (*f.cursor == 0);
+}
+
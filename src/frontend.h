@@ -0,0 +1,12 @@
+/*
+ *  frontend.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include "state.h"
+#include "vm.h"
+
+#pragma once
+
+int atto_compile_source(struct atto_state *a, const char *source, struct atto_instruction_stream *is);
+
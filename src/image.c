@@ -0,0 +1,965 @@
+/*
+ *  image.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "state.h"
+#include "vm.h"
+#include "compiler.h"
+#include "builtins.h"
+#include "image.h"
+
+/*
+ *  the changes are written in the byte order and layout of the machine
+ *  they were made on, and are meant to be read back by the same build;
+ *  numbers are written as 64-bit values, and indices as they are, since
+ *  the changes are only ever applied to a state which looks exactly like
+ *  the one they were made to
+ */
+static int write_u8(FILE *f, uint8_t value)
+{
+  return (fwrite(&value, sizeof(uint8_t), 1, f) == 1);
+}
+
+static int write_u64(FILE *f, uint64_t value)
+{
+  return (fwrite(&value, sizeof(uint64_t), 1, f) == 1);
+}
+
+static int write_string(FILE *f, const char *string)
+{
+  uint64_t length = strlen(string);
+
+  return write_u64(f, length) && (fwrite(string, sizeof(char), length, f) == length);
+}
+
+static int read_u8(FILE *f, uint8_t *value)
+{
+  return (fread(value, sizeof(uint8_t), 1, f) == 1);
+}
+
+static int read_u64(FILE *f, uint64_t *value)
+{
+  return (fread(value, sizeof(uint64_t), 1, f) == 1);
+}
+
+/*
+ *  reads a string into a newly allocated buffer; strings are never longer
+ *  than `limit' characters, so that a damaged file cannot ask for more
+ */
+static char *read_string(FILE *f, uint64_t limit)
+{
+  uint64_t length;
+  char *string = NULL;
+
+  if (!read_u64(f, &length) || (length > limit)) {
+    return NULL;
+  }
+
+  string = (char *)malloc(sizeof(char) * (length + 1));
+  assert(string != NULL);
+
+  if (fread(string, sizeof(char), length, f) != length) {
+    free(string);
+    return NULL;
+  }
+
+  string[length] = 0;
+
+  return string;
+}
+
+#define MAX_STRING_LENGTH ((uint64_t)1 << 20)
+
+/*  nor do expressions have more operands, or nest deeper, than these */
+#define MAX_EXPRESSION_OPERANDS ((uint64_t)1 << 20)
+#define MAX_EXPRESSION_DEPTH 4096
+
+void atto_mark_state(struct atto_state *a, struct atto_state_mark *m)
+{
+  struct atto_vm_state *vm = a->vm_state;
+
+  m->number_of_instruction_streams = vm->number_of_instruction_streams;
+  m->number_of_symbols = a->number_of_symbols;
+  m->number_of_globals = a->global_environment->number_of_objects;
+
+  m->heap_size = vm->heap_size;
+  m->heap = (struct atto_object *)malloc(sizeof(struct atto_object) * ATTO_VM_MAX_HEAP_OBJECTS);
+  assert(m->heap != NULL);
+  memcpy(m->heap, vm->heap, sizeof(struct atto_object) * vm->heap_size);
+
+  m->data_stack_size = vm->data_stack_size;
+  m->data_stack = (size_t *)malloc(sizeof(size_t) * ATTO_VM_MAX_DATA_STACK_SIZE);
+  assert(m->data_stack != NULL);
+  memcpy(m->data_stack, vm->data_stack, sizeof(size_t) * vm->data_stack_size);
+}
+
+void atto_release_state_mark(struct atto_state_mark *m)
+{
+  free(m->heap);
+  free(m->data_stack);
+}
+
+/*
+ *  lambda bodies are normally compiled the first time they are called; the
+ *  bodies of lambdas created since `first_instruction_stream' are compiled
+ *  right away instead, so that no syntax trees are left to be written out.
+ *  compiling a body may create more lambdas, which are compiled as well
+ */
+void atto_compile_pending_lambdas(struct atto_state *a, size_t first_instruction_stream)
+{
+  size_t i;
+
+  for (i = first_instruction_stream; i < a->vm_state->number_of_instruction_streams; i++) {
+    if (a->vm_state->instruction_streams[i]->stub != NULL) {
+      compile_lambda_stub(a->vm_state->instruction_streams[i]);
+    }
+  }
+}
+
+static int write_instruction_stream(FILE *f, struct atto_instruction_stream *is)
+{
+  size_t i;
+
+  if (!write_u64(f, is->length) || !write_u64(f, is->number_of_captures) ||
+      !write_u64(f, is->number_of_arguments) || !write_u8(f, is->memoize)) {
+    return 0;
+  }
+
+  for (i = 0; i < is->length; i++) {
+    if (!write_u8(f, is->stream[i].opcode) ||
+        (fwrite(&is->stream[i].container, sizeof(is->stream[i].container), 1, f) != 1)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ *  native functions are registered by the host, and are referred to by the
+ *  order they were registered in; their names are written along with the
+ *  code, so that code is not run against a different set of them
+ */
+static int write_natives(FILE *f, struct atto_instruction_stream *is)
+{
+  size_t i;
+
+  for (i = 0; i < is->length; i++) {
+    if (is->stream[i].opcode == ATTO_VM_OP_CALLNATIVE) {
+      if (!write_u8(f, 1) || !write_u64(f, is->stream[i].container.offset) ||
+          !write_string(f, atto_get_native(is->stream[i].container.offset)->name)) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+static int write_object(FILE *f, struct atto_vm_state *vm, size_t index)
+{
+  struct atto_object *o = &vm->heap[index];
+
+  if (!write_u64(f, index) || !write_u8(f, o->kind)) {
+    return 0;
+  }
+
+  switch (o->kind) {
+  case ATTO_OBJECT_KIND_NULL:
+    return 1;
+  case ATTO_OBJECT_KIND_NUMBER:
+    return (fwrite(&o->container.number, sizeof(double), 1, f) == 1);
+  case ATTO_OBJECT_KIND_SYMBOL:
+    return write_u64(f, o->container.symbol);
+  case ATTO_OBJECT_KIND_LIST:
+    return write_u64(f, o->container.list.car) && write_u64(f, o->container.list.cdr);
+  case ATTO_OBJECT_KIND_THUNK:
+    return write_u64(f, o->container.instruction_stream_index);
+  case ATTO_OBJECT_KIND_LAMBDA: {
+    size_t i, number_of_captures = vm->instruction_streams[o->container.lambda.instruction_stream_index]->number_of_captures;
+
+    if (!write_u64(f, o->container.lambda.instruction_stream_index)) {
+      return 0;
+    }
+
+    for (i = 0; i < number_of_captures; i++) {
+      if (!write_u64(f, vm->captures[o->container.lambda.captures + i])) {
+        return 0;
+      }
+    }
+
+    return 1;
+  }
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  writes out the expression a lambda was defined by; these are kept along
+ *  with globals, so that the optimizer can inline, fuse and specialize calls
+ *  to lambdas which were loaded rather than compiled
+ */
+int atto_write_expression(FILE *f, struct atto_expression *e)
+{
+  uint32_t i;
+
+  if (!write_u8(f, (uint8_t)e->kind)) {
+    return 0;
+  }
+
+  switch (e->kind) {
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+    return (fwrite(&e->container.number_literal, sizeof(double), 1, f) == 1);
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    return write_u64(f, e->container.symbol_literal);
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    return write_string(f, e->container.reference_identifier);
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+
+    if (!write_u64(f, lle->number_of_elements)) {
+      return 0;
+    }
+
+    for (i = 0; i < lle->number_of_elements; i++) {
+      if (!atto_write_expression(f, lle->elements[i])) {
+        return 0;
+      }
+    }
+
+    return 1;
+  }
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+
+    if (!write_u64(f, le->number_of_parameters)) {
+      return 0;
+    }
+
+    for (i = 0; i < le->number_of_parameters; i++) {
+      if (!write_string(f, le->parameter_names[i])) {
+        return 0;
+      }
+    }
+
+    return atto_write_expression(f, le->body);
+  }
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+
+    return atto_write_expression(f, ie->condition_expression) &&
+           atto_write_expression(f, ie->true_evaluation_expression) &&
+           atto_write_expression(f, ie->false_evaluation_expression);
+  }
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+
+    if (!write_string(f, ae->identifier) || !write_u64(f, ae->number_of_parameters)) {
+      return 0;
+    }
+
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      if (!atto_write_expression(f, ae->parameters[i])) {
+        return 0;
+      }
+    }
+
+    return 1;
+  }
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+
+    if (!write_u64(f, le->number_of_bindings) || !write_u8(f, le->sequential)) {
+      return 0;
+    }
+
+    for (i = 0; i < le->number_of_bindings; i++) {
+      if (!write_string(f, le->binding_names[i]) || !atto_write_expression(f, le->binding_expressions[i])) {
+        return 0;
+      }
+    }
+
+    return atto_write_expression(f, le->body);
+  }
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  writes out everything which changed in the state since it was marked:
+ *  the instruction streams, symbols and globals added since, along with
+ *  the expressions kept for their lambdas, and the heap objects and stack
+ *  slots which are new or were written to. the counts the mark was taken
+ *  at are written first, so that the changes are only applied to a state
+ *  which looks the same. lambda bodies which were not compiled yet must
+ *  have been compiled beforehand
+ */
+int atto_write_state_changes(FILE *f, struct atto_state *a, struct atto_state_mark *m)
+{
+  struct atto_vm_state *vm = a->vm_state;
+  struct atto_environment_object **globals = NULL, *eo = NULL;
+  size_t i, number_of_globals = a->global_environment->number_of_objects - m->number_of_globals;
+
+  if (!write_u64(f, m->number_of_instruction_streams) || !write_u64(f, m->number_of_symbols) ||
+      !write_u64(f, m->number_of_globals) || !write_u64(f, m->heap_size) || !write_u64(f, m->data_stack_size)) {
+    return 0;
+  }
+
+  /*  natives are listed ahead of the code which calls them */
+  for (i = m->number_of_instruction_streams; i < vm->number_of_instruction_streams; i++) {
+    assert(vm->instruction_streams[i]->stub == NULL);
+
+    if (!write_natives(f, vm->instruction_streams[i])) {
+      return 0;
+    }
+  }
+
+  if (!write_u8(f, 0) || !write_u64(f, vm->number_of_instruction_streams - m->number_of_instruction_streams)) {
+    return 0;
+  }
+
+  for (i = m->number_of_instruction_streams; i < vm->number_of_instruction_streams; i++) {
+    if (!write_instruction_stream(f, vm->instruction_streams[i])) {
+      return 0;
+    }
+  }
+
+  if (!write_u64(f, a->number_of_symbols - m->number_of_symbols)) {
+    return 0;
+  }
+
+  for (i = m->number_of_symbols; i < a->number_of_symbols; i++) {
+    if (!write_string(f, a->symbol_names[i])) {
+      return 0;
+    }
+  }
+
+  /*  globals are listed from the most recently added one, and are written
+   *  the other way around */
+  globals = (struct atto_environment_object **)malloc(sizeof(struct atto_environment_object *) * (number_of_globals + 1));
+  assert(globals != NULL);
+
+  for (i = number_of_globals, eo = a->global_environment->head; i > 0; i--, eo = eo->next) {
+    globals[i - 1] = eo;
+  }
+
+  if (!write_u64(f, number_of_globals)) {
+    free(globals);
+    return 0;
+  }
+
+  for (i = 0; i < number_of_globals; i++) {
+    if (!write_string(f, globals[i]->name) || !write_u8(f, globals[i]->kind) || !write_u8(f, globals[i]->flags) ||
+        !write_u64(f, globals[i]->strict_parameters) || !write_u64(f, globals[i]->offset) ||
+        !write_u8(f, globals[i]->expression != NULL) ||
+        ((globals[i]->expression != NULL) && !atto_write_expression(f, globals[i]->expression))) {
+      free(globals);
+      return 0;
+    }
+  }
+
+  free(globals);
+
+  if (!write_u64(f, vm->heap_size)) {
+    return 0;
+  }
+
+  for (i = 0; i < vm->heap_size; i++) {
+    if ((i < m->heap_size) && (memcmp(&m->heap[i], &vm->heap[i], sizeof(struct atto_object)) == 0)) {
+      continue;
+    }
+
+    if (!write_u8(f, 1) || !write_object(f, vm, i)) {
+      return 0;
+    }
+  }
+
+  if (!write_u8(f, 0) || !write_u64(f, vm->data_stack_size)) {
+    return 0;
+  }
+
+  for (i = 0; i < vm->data_stack_size; i++) {
+    if ((i < m->data_stack_size) && (m->data_stack[i] == vm->data_stack[i])) {
+      continue;
+    }
+
+    if (!write_u8(f, 1) || !write_u64(f, i) || !write_u64(f, vm->data_stack[i])) {
+      return 0;
+    }
+  }
+
+  return write_u8(f, 0);
+}
+
+static struct atto_instruction_stream *read_instruction_stream(FILE *f)
+{
+  struct atto_instruction_stream *is = NULL;
+  uint64_t length, number_of_captures, number_of_arguments;
+  uint8_t memoize;
+  size_t i;
+
+  if (!read_u64(f, &length) || !read_u64(f, &number_of_captures) ||
+      !read_u64(f, &number_of_arguments) || !read_u8(f, &memoize)) {
+    return NULL;
+  }
+
+  is = allocate_instruction_stream();
+  is->number_of_captures = number_of_captures;
+  is->number_of_arguments = number_of_arguments;
+  is->memoize = memoize;
+
+  for (i = 0; i < length; i++) {
+    uint8_t opcode;
+
+    if (!read_u8(f, &opcode)) {
+      free(is->stream);
+      free(is);
+      return NULL;
+    }
+
+    write_op_noarg(is, opcode);
+
+    if (fread(&is->stream[i].container, sizeof(is->stream[i].container), 1, f) != 1) {
+      free(is->stream);
+      free(is);
+      return NULL;
+    }
+  }
+
+  return is;
+}
+
+static int read_object(FILE *f, struct atto_vm_state *vm)
+{
+  uint64_t index, value, car, cdr;
+  struct atto_object *o = NULL;
+  uint8_t kind;
+
+  if (!read_u64(f, &index) || (index >= ATTO_VM_MAX_HEAP_OBJECTS) || !read_u8(f, &kind)) {
+    return 0;
+  }
+
+  o = &vm->heap[index];
+  o->kind = kind;
+
+  switch (kind) {
+  case ATTO_OBJECT_KIND_NULL:
+    return 1;
+  case ATTO_OBJECT_KIND_NUMBER:
+    return (fread(&o->container.number, sizeof(double), 1, f) == 1);
+  case ATTO_OBJECT_KIND_SYMBOL:
+    return read_u64(f, &o->container.symbol);
+  case ATTO_OBJECT_KIND_LIST:
+    if (!read_u64(f, &car) || !read_u64(f, &cdr)) {
+      return 0;
+    }
+    o->container.list.car = car;
+    o->container.list.cdr = cdr;
+    return 1;
+  case ATTO_OBJECT_KIND_THUNK:
+    if (!read_u64(f, &value) || (value >= vm->number_of_instruction_streams)) {
+      return 0;
+    }
+    o->container.instruction_stream_index = value;
+    return 1;
+  case ATTO_OBJECT_KIND_LAMBDA: {
+    size_t i, number_of_captures;
+
+    if (!read_u64(f, &value) || (value >= vm->number_of_instruction_streams)) {
+      return 0;
+    }
+
+    o->container.lambda.instruction_stream_index = value;
+    number_of_captures = vm->instruction_streams[value]->number_of_captures;
+    o->container.lambda.captures = atto_allocate_captures(vm, number_of_captures);
+
+    for (i = 0; i < number_of_captures; i++) {
+      if (!read_u64(f, &value)) {
+        return 0;
+      }
+      vm->captures[o->container.lambda.captures + i] = value;
+    }
+
+    return 1;
+  }
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  reads an expression into a tree of the same shape `copy_expression'
+ *  makes; every node is filled in before those below it are read, so that
+ *  a tree cut short by a damaged file can still be destroyed as a whole
+ */
+static struct atto_expression *read_expression(FILE *f, uint32_t depth)
+{
+  struct atto_expression *e = NULL;
+  uint64_t count;
+  uint32_t i;
+  uint8_t kind, sequential;
+
+  if ((depth > MAX_EXPRESSION_DEPTH) || !read_u8(f, &kind)) {
+    return NULL;
+  }
+
+  e = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  assert(e != NULL);
+  e->kind = kind;
+
+  switch (kind) {
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+    if (fread(&e->container.number_literal, sizeof(double), 1, f) == 1) {
+      return e;
+    }
+    break;
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    if (read_u64(f, &e->container.symbol_literal)) {
+      return e;
+    }
+    break;
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    if ((e->container.reference_identifier = read_string(f, MAX_STRING_LENGTH)) != NULL) {
+      return e;
+    }
+    break;
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = NULL;
+
+    if (!read_u64(f, &count) || (count > MAX_EXPRESSION_OPERANDS)) {
+      break;
+    }
+
+    lle = (struct atto_list_literal_expression *)malloc(sizeof(struct atto_list_literal_expression));
+    assert(lle != NULL);
+    lle->number_of_elements = count;
+    lle->elements = (struct atto_expression **)calloc(count + 1, sizeof(struct atto_expression *));
+    assert(lle->elements != NULL);
+    e->container.list_literal_expression = lle;
+
+    for (i = 0; i < count; i++) {
+      if ((lle->elements[i] = read_expression(f, depth + 1)) == NULL) {
+        destroy_expression(e);
+        return NULL;
+      }
+    }
+
+    return e;
+  }
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = NULL;
+
+    if (!read_u64(f, &count) || (count > MAX_EXPRESSION_OPERANDS)) {
+      break;
+    }
+
+    le = (struct atto_lambda_expression *)malloc(sizeof(struct atto_lambda_expression));
+    assert(le != NULL);
+    le->number_of_parameters = count;
+    le->parameter_names = (char **)calloc(count + 1, sizeof(char *));
+    assert(le->parameter_names != NULL);
+    le->body = NULL;
+    e->container.lambda_expression = le;
+
+    for (i = 0; i < count; i++) {
+      if ((le->parameter_names[i] = read_string(f, MAX_STRING_LENGTH)) == NULL) {
+        destroy_expression(e);
+        return NULL;
+      }
+    }
+
+    if ((le->body = read_expression(f, depth + 1)) == NULL) {
+      destroy_expression(e);
+      return NULL;
+    }
+
+    return e;
+  }
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = (struct atto_if_expression *)malloc(sizeof(struct atto_if_expression));
+    assert(ie != NULL);
+    ie->true_evaluation_expression = NULL;
+    ie->false_evaluation_expression = NULL;
+    e->container.if_expression = ie;
+
+    if (((ie->condition_expression = read_expression(f, depth + 1)) == NULL) ||
+        ((ie->true_evaluation_expression = read_expression(f, depth + 1)) == NULL) ||
+        ((ie->false_evaluation_expression = read_expression(f, depth + 1)) == NULL)) {
+      destroy_expression(e);
+      return NULL;
+    }
+
+    return e;
+  }
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = NULL;
+    char *identifier = read_string(f, MAX_STRING_LENGTH);
+
+    if ((identifier == NULL) || !read_u64(f, &count) || (count > MAX_EXPRESSION_OPERANDS)) {
+      free(identifier);
+      break;
+    }
+
+    ae = (struct atto_application_expression *)malloc(sizeof(struct atto_application_expression));
+    assert(ae != NULL);
+    ae->identifier = identifier;
+    ae->number_of_parameters = count;
+    ae->parameters = (struct atto_expression **)calloc(count + 1, sizeof(struct atto_expression *));
+    assert(ae->parameters != NULL);
+    e->container.application_expression = ae;
+
+    for (i = 0; i < count; i++) {
+      if ((ae->parameters[i] = read_expression(f, depth + 1)) == NULL) {
+        destroy_expression(e);
+        return NULL;
+      }
+    }
+
+    return e;
+  }
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = NULL;
+
+    if (!read_u64(f, &count) || (count > MAX_EXPRESSION_OPERANDS) || !read_u8(f, &sequential)) {
+      break;
+    }
+
+    le = (struct atto_let_expression *)malloc(sizeof(struct atto_let_expression));
+    assert(le != NULL);
+    le->number_of_bindings = count;
+    le->binding_names = (char **)calloc(count + 1, sizeof(char *));
+    le->binding_expressions = (struct atto_expression **)calloc(count + 1, sizeof(struct atto_expression *));
+    assert((le->binding_names != NULL) && (le->binding_expressions != NULL));
+    le->body = NULL;
+    le->sequential = sequential;
+    e->container.let_expression = le;
+
+    for (i = 0; i < count; i++) {
+      if (((le->binding_names[i] = read_string(f, MAX_STRING_LENGTH)) == NULL) ||
+          ((le->binding_expressions[i] = read_expression(f, depth + 1)) == NULL)) {
+        destroy_expression(e);
+        return NULL;
+      }
+    }
+
+    if ((le->body = read_expression(f, depth + 1)) == NULL) {
+      destroy_expression(e);
+      return NULL;
+    }
+
+    return e;
+  }
+  default:
+    break;
+  }
+
+  /*  nothing below the node was read, so there is nothing else to free */
+  free(e);
+  return NULL;
+}
+
+/*
+ *  reads an expression written by `atto_write_expression'; returns NULL if
+ *  it was damaged
+ */
+struct atto_expression *atto_read_expression(FILE *f)
+{
+  return read_expression(f, 0);
+}
+
+/*
+ *  applies changes written by `atto_write_state_changes'; returns zero,
+ *  leaving the state untouched, if the state does not look the way it did
+ *  when the changes were made, or if the natives they call are missing.
+ *  a file which turns out to be damaged past that point leaves the state
+ *  partly changed, which is reported by returning -1
+ */
+int atto_read_state_changes(FILE *f, struct atto_state *a)
+{
+  struct atto_vm_state *vm = a->vm_state;
+  uint64_t number_of_instruction_streams, number_of_symbols, number_of_globals, heap_size, data_stack_size, count, i;
+  uint8_t more;
+
+  if (!read_u64(f, &number_of_instruction_streams) || !read_u64(f, &number_of_symbols) ||
+      !read_u64(f, &number_of_globals) || !read_u64(f, &heap_size) || !read_u64(f, &data_stack_size)) {
+    return 0;
+  }
+
+  if ((number_of_instruction_streams != vm->number_of_instruction_streams) ||
+      (number_of_symbols != a->number_of_symbols) ||
+      (number_of_globals != a->global_environment->number_of_objects) ||
+      (heap_size != vm->heap_size) || (data_stack_size != vm->data_stack_size)) {
+    return 0;
+  }
+
+  while (read_u8(f, &more) && more) {
+    const struct atto_builtin *b = NULL;
+    uint64_t index;
+    char *name = NULL;
+
+    if (!read_u64(f, &index) || ((name = read_string(f, MAX_STRING_LENGTH)) == NULL)) {
+      return 0;
+    }
+
+    b = atto_find_builtin(name);
+    free(name);
+
+    if ((b == NULL) || !(b->flags & ATTO_BUILTIN_FLAG_NATIVE) || (b->native_index != index)) {
+      return 0;
+    }
+  }
+
+  /*  from here on, the state is changed */
+  if (!read_u64(f, &count)) {
+    return -1;
+  }
+
+  for (i = 0; i < count; i++) {
+    struct atto_instruction_stream *is = read_instruction_stream(f);
+
+    if (is == NULL) {
+      return -1;
+    }
+
+    atto_add_instruction_stream(vm, is);
+  }
+
+  if (!read_u64(f, &count)) {
+    return -1;
+  }
+
+  for (i = 0; i < count; i++) {
+    char *name = read_string(f, MAX_STRING_LENGTH);
+
+    if (name == NULL) {
+      return -1;
+    }
+
+    atto_save_symbol(a, name);
+    free(name);
+  }
+
+  if (!read_u64(f, &count)) {
+    return -1;
+  }
+
+  for (i = 0; i < count; i++) {
+    struct atto_environment_object *eo = NULL;
+    struct atto_expression *expression = NULL;
+    char *name = read_string(f, MAX_STRING_LENGTH);
+    uint64_t strict_parameters, offset;
+    uint8_t kind, flags, has_expression;
+
+    if ((name == NULL) || !read_u8(f, &kind) || !read_u8(f, &flags) ||
+        !read_u64(f, &strict_parameters) || !read_u64(f, &offset) || !read_u8(f, &has_expression) ||
+        (has_expression && ((expression = atto_read_expression(f)) == NULL))) {
+      free(name);
+      return -1;
+    }
+
+    eo = atto_add_to_environment(a->global_environment, name, kind, offset);
+    eo->flags = flags;
+    eo->strict_parameters = strict_parameters;
+    eo->expression = expression;
+    free(name);
+  }
+
+  if (!read_u64(f, &heap_size) || (heap_size > ATTO_VM_MAX_HEAP_OBJECTS)) {
+    return -1;
+  }
+
+  vm->heap_size = heap_size;
+
+  while (read_u8(f, &more) && more) {
+    if (!read_object(f, vm)) {
+      return -1;
+    }
+  }
+
+  if (!read_u64(f, &data_stack_size) || (data_stack_size > ATTO_VM_MAX_DATA_STACK_SIZE)) {
+    return -1;
+  }
+
+  vm->data_stack_size = data_stack_size;
+
+  while (read_u8(f, &more) && more) {
+    uint64_t index, value;
+
+    if (!read_u64(f, &index) || (index >= ATTO_VM_MAX_DATA_STACK_SIZE) || !read_u64(f, &value)) {
+      return -1;
+    }
+
+    vm->data_stack[index] = value;
+  }
+
+  return 1;
+}
+
+struct image_header {
+  uint32_t magic;
+  uint32_t format_version;
+  uint32_t compiler_version;
+  uint32_t byte_order;
+};
+
+/*
+ *  images hold everything a state was given since it was allocated, which
+ *  is found by comparing it with a state which was just allocated, and so
+ *  already holds the prelude
+ */
+static void mark_fresh_state(struct atto_state_mark *m)
+{
+  struct atto_state *fresh = atto_allocate_state();
+
+  atto_mark_state(fresh, m);
+  atto_destroy_state(fresh);
+}
+
+/*
+ *  returns whether a state was given nothing since it was allocated
+ */
+int atto_is_new_state(struct atto_state *a)
+{
+  struct atto_state_mark m;
+  int is_new;
+
+  mark_fresh_state(&m);
+
+  is_new = (a->vm_state->number_of_instruction_streams == m.number_of_instruction_streams) &&
+           (a->number_of_symbols == m.number_of_symbols) &&
+           (a->global_environment->number_of_objects == m.number_of_globals) &&
+           (a->vm_state->heap_size == m.heap_size) &&
+           (a->vm_state->data_stack_size == m.data_stack_size);
+
+  atto_release_state_mark(&m);
+
+  return is_new;
+}
+
+/*
+ *  saves the compiled code, the symbols, the globals and the values of a
+ *  state to an image, which can be loaded into a new state without any
+ *  source being compiled; the bodies of lambdas which were not called yet
+ *  are compiled first. returns whether the image was saved
+ */
+int atto_save_image(struct atto_state *a, const char *path)
+{
+  struct image_header header;
+  struct atto_state_mark m;
+  FILE *f = fopen(path, "wb");
+  int written;
+
+  if (f == NULL) {
+    printf("error: unable to open `%s'\n", path);
+    return 0;
+  }
+
+  atto_compile_pending_lambdas(a, 0);
+  mark_fresh_state(&m);
+
+  header.magic = ATTO_IMAGE_MAGIC;
+  header.format_version = ATTO_IMAGE_FORMAT_VERSION;
+  header.compiler_version = ATTO_COMPILER_VERSION;
+  header.byte_order = ATTO_IMAGE_BYTE_ORDER;
+
+  written = (fwrite(&header, sizeof(struct image_header), 1, f) == 1) && atto_write_state_changes(f, a, &m);
+  atto_release_state_mark(&m);
+
+  if ((fclose(f) != 0) || !written) {
+    printf("error: unable to write `%s'\n", path);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ *  loads an image, which `name' refers to in errors, from a stream
+ */
+static int load_image(FILE *f, struct atto_state *a, const char *name)
+{
+  struct image_header header;
+  int loaded;
+
+  if ((fread(&header, sizeof(struct image_header), 1, f) != 1) ||
+      (header.magic != ATTO_IMAGE_MAGIC) || (header.byte_order != ATTO_IMAGE_BYTE_ORDER)) {
+    printf("error: `%s' is not an image\n", name);
+    return 0;
+  }
+
+  if ((header.format_version != ATTO_IMAGE_FORMAT_VERSION) || (header.compiler_version != ATTO_COMPILER_VERSION)) {
+    printf("error: `%s' was made by another version of atto\n", name);
+    return 0;
+  }
+
+  loaded = atto_read_state_changes(f, a);
+
+  /*  images which end before the state they were made for was checked
+   *  were cut short, rather than made for another state */
+  if ((loaded == 0) && feof(f)) {
+    loaded = -1;
+  }
+
+  if (loaded == 0) {
+    printf("error: `%s' can only be loaded into a new state, with the same prelude and native functions\n", name);
+    return 0;
+  }
+
+  if (loaded < 0) {
+    printf("error: `%s' is damaged\n", name);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ *  loads an image into a state which was just allocated, and was given
+ *  nothing since; returns whether the image was loaded
+ */
+int atto_load_image(struct atto_state *a, const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  int loaded;
+
+  if (f == NULL) {
+    printf("error: unable to open `%s'\n", path);
+    return 0;
+  }
+
+  loaded = load_image(f, a, path);
+  fclose(f);
+
+  return loaded;
+}
+
+/*
+ *  loads an image which was linked into the executable, like the prelude
+ */
+int atto_load_image_from_memory(struct atto_state *a, const unsigned char *image, size_t length, const char *name)
+{
+  FILE *f = fmemopen((void *)image, length, "rb");
+  int loaded;
+
+  if (f == NULL) {
+    printf("error: unable to read `%s'\n", name);
+    return 0;
+  }
+
+  loaded = load_image(f, a, name);
+  fclose(f);
+
+  return loaded;
+}
+
@@ -0,0 +1,59 @@
+/*
+ *  image.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "state.h"
+#include "vm.h"
+#include "parser.h"
+
+#pragma once
+
+/*  bumped whenever the compiler starts emitting different code for the
+ *  same source, so that code saved by older versions is not used */
+#define ATTO_COMPILER_VERSION 1
+
+#define ATTO_IMAGE_FORMAT_VERSION 2
+
+#define ATTO_IMAGE_MAGIC 0x62747461u  /*  "attb" */
+
+/*  written as is, so that images made on machines with another byte order
+ *  are told apart */
+#define ATTO_IMAGE_BYTE_ORDER 0x01020304u
+
+/*
+ *  what the state looked like at some point, so that what changed since
+ *  then can be written out; the heap and the stack are small enough to be
+ *  copied whole, while everything else only ever grows
+ */
+struct atto_state_mark {
+  size_t number_of_instruction_streams;
+  uint32_t number_of_symbols;
+  size_t number_of_globals;
+
+  struct atto_object *heap;
+  size_t heap_size;
+  size_t *data_stack;
+  size_t data_stack_size;
+};
+
+void atto_mark_state(struct atto_state *a, struct atto_state_mark *m);
+void atto_release_state_mark(struct atto_state_mark *m);
+
+void atto_compile_pending_lambdas(struct atto_state *a, size_t first_instruction_stream);
+
+int atto_write_expression(FILE *f, struct atto_expression *e);
+struct atto_expression *atto_read_expression(FILE *f);
+
+int atto_write_state_changes(FILE *f, struct atto_state *a, struct atto_state_mark *m);
+int atto_read_state_changes(FILE *f, struct atto_state *a);
+
+int atto_save_image(struct atto_state *a, const char *path);
+int atto_load_image(struct atto_state *a, const char *path);
+int atto_load_image_from_memory(struct atto_state *a, const unsigned char *image, size_t length, const char *name);
+int atto_is_new_state(struct atto_state *a);
+
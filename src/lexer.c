@@ -1,4 +1,3 @@
-
 /*
  *  lexer.c
  *  part of Atto :: https://github.com/deveah/atto
@@ -8,195 +7,337 @@
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdio.h>
 
 #include "lexer.h"
 
 /*
- *  returns whether a character is a digit
+ *  runs of characters of the same class are measured 16 bytes at a time
+ *  with SSE2, or 32 bytes at a time with AVX2 where the processor supports
+ *  it, and one byte at a time, by looking the class up in a table, for
+ *  whatever is left at the end of the source
  */
-static int is_digit(char c)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define ATTO_LEXER_SIMD
+#include <immintrin.h>
+#endif
+
+#define CLASS_WHITESPACE    (1<<0)
+#define CLASS_DIGIT         (1<<1)
+#define CLASS_LETTER        (1<<2)
+#define CLASS_DASH          (1<<3)
+#define CLASS_STAR          (1<<4)
+#define CLASS_CLOSED_PAREN  (1<<5)
+#define CLASS_END           (1<<6)
+
+#define CLASS_IDENTIFIER    (CLASS_DIGIT | CLASS_LETTER | CLASS_DASH | CLASS_STAR)
+#define CLASS_SYMBOL        (CLASS_DIGIT | CLASS_LETTER | CLASS_DASH)
+
+/*  number literals run up to the first whitespace or closed paranthesis */
+#define CLASS_NUMBER_END    (CLASS_WHITESPACE | CLASS_CLOSED_PAREN | CLASS_END)
+
+#define W CLASS_WHITESPACE
+#define D CLASS_DIGIT
+#define L CLASS_LETTER
+
+static const uint8_t character_classes[256] = {
+  CLASS_END, 0, 0, 0, 0, 0, 0, 0, 0, W, W, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  W, 0, 0, 0, 0, 0, 0, 0, 0, CLASS_CLOSED_PAREN, CLASS_STAR, 0, 0, CLASS_DASH, 0, 0,
+  D, D, D, D, D, D, D, D, D, D, 0, 0, 0, 0, 0, 0,
+  0, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L,
+  L, L, L, L, L, L, L, L, L, L, L, 0, 0, 0, 0, 0,
+  0, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L,
+  L, L, L, L, L, L, L, L, L, L, L, 0, 0, 0, 0, 0
+};
+
+#undef W
+#undef D
+#undef L
+
+static uint8_t class_of(char c)
 {
-  return ((c >= '0') && (c <= '9'));
+  return character_classes[(unsigned char)c];
 }
 
 /*
- *  returns whether a character is a letter
+ *  returns the number of characters, starting at `current', whose class is
+ *  one of `classes', or, if `invert' is set, is none of them; `end' points
+ *  to the terminating null character of the source
  */
-static int is_letter(char c)
+static size_t span_scalar(const char *current, const char *end, uint8_t classes, int invert)
 {
-  return (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')));
+  const char *start = current;
+
+  (void) end;
+
+  while (((class_of(*current) & classes) != 0) != invert) {
+    current++;
+  }
+
+  return current - start;
 }
 
-/*
- *  returns whether a character is alphanumeric
- */
-static int is_alnum(char c)
+#ifdef ATTO_LEXER_SIMD
+
+/*  the vector versions of the class table; bytes above 0x7f compare as
+ *  negative, and so fall in none of the ranges */
+#define IN_RANGE_128(v, low, high) \
+  _mm_and_si128(_mm_cmpgt_epi8((v), _mm_set1_epi8((low) - 1)), _mm_cmplt_epi8((v), _mm_set1_epi8((high) + 1)))
+
+static unsigned int class_mask_sse2(__m128i v, uint8_t classes)
+{
+  __m128i m = _mm_setzero_si128();
+
+  if (classes & CLASS_WHITESPACE) {
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+  }
+
+  if (classes & CLASS_DIGIT) {
+    m = _mm_or_si128(m, IN_RANGE_128(v, '0', '9'));
+  }
+
+  if (classes & CLASS_LETTER) {
+    m = _mm_or_si128(m, IN_RANGE_128(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'));
+  }
+
+  if (classes & CLASS_DASH) {
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+  }
+
+  if (classes & CLASS_STAR) {
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+  }
+
+  if (classes & CLASS_CLOSED_PAREN) {
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+  }
+
+  if (classes & CLASS_END) {
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+  }
+
+  return (unsigned int)_mm_movemask_epi8(m);
+}
+
+/*  the source is never read past its terminating null character, so that
+ *  no load crosses into a page which may not be mapped */
+static size_t span_sse2(const char *current, const char *end, uint8_t classes, int invert)
+{
+  const char *start = current;
+
+  while (end - current >= 16) {
+    unsigned int mask = class_mask_sse2(_mm_loadu_si128((const __m128i *)current), classes);
+
+    if (!invert) {
+      mask = ~mask & 0xffff;
+    }
+
+    if (mask != 0) {
+      return (current - start) + __builtin_ctz(mask);
+    }
+
+    current += 16;
+  }
+
+  return (current - start) + span_scalar(current, end, classes, invert);
+}
+
+#define IN_RANGE_256(v, low, high) \
+  _mm256_and_si256(_mm256_cmpgt_epi8((v), _mm256_set1_epi8((low) - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8((high) + 1), (v)))
+
+__attribute__((target("avx2")))
+static unsigned int class_mask_avx2(__m256i v, uint8_t classes)
+{
+  __m256i m = _mm256_setzero_si256();
+
+  if (classes & CLASS_WHITESPACE) {
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+  }
+
+  if (classes & CLASS_DIGIT) {
+    m = _mm256_or_si256(m, IN_RANGE_256(v, '0', '9'));
+  }
+
+  if (classes & CLASS_LETTER) {
+    m = _mm256_or_si256(m, IN_RANGE_256(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'));
+  }
+
+  if (classes & CLASS_DASH) {
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+  }
+
+  if (classes & CLASS_STAR) {
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')));
+  }
+
+  if (classes & CLASS_CLOSED_PAREN) {
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')));
+  }
+
+  if (classes & CLASS_END) {
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+  }
+
+  return (unsigned int)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static size_t span_avx2(const char *current, const char *end, uint8_t classes, int invert)
 {
-  return (is_letter(c) || is_digit(c));
+  const char *start = current;
+
+  while (end - current >= 32) {
+    unsigned int mask = class_mask_avx2(_mm256_loadu_si256((const __m256i *)current), classes);
+
+    if (!invert) {
+      mask = ~mask;
+    }
+
+    if (mask != 0) {
+      return (current - start) + __builtin_ctz(mask);
+    }
+
+    current += 32;
+  }
+
+  return (current - start) + span_sse2(current, end, classes, invert);
 }
 
+#endif
+
+static size_t (*span)(const char *current, const char *end, uint8_t classes, int invert) = NULL;
+
 /*
- *  returns whether a character is whitespace
+ *  picks the widest implementation the processor supports; this is done
+ *  the first time a string is lexed, unless it was done before, which it
+ *  must be before strings are lexed on several threads at once
  */
-static int is_whitespace(char c)
+void atto_initialize_lexer(void)
 {
-  return ((c == ' ') || (c == '\n') || (c == '\t'));
+#ifdef ATTO_LEXER_SIMD
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    span = span_avx2;
+  } else {
+    span = span_sse2;
+  }
+#else
+  span = span_scalar;
+#endif
 }
 
 /*
- *  allocates an atto_token struct, also allocating space for the token's
- *  string storage
+ *  appends a token to the array, which grows by doubling, so that tokens
+ *  are not allocated one by one
  */
-static struct atto_token *allocate_token(char *token, uint32_t kind)
+static void push_token(struct atto_token_array *ta, uint32_t kind, size_t offset, size_t length)
 {
-  struct atto_token *t = (struct atto_token *)malloc(sizeof(struct atto_token));
-
-  assert(t != NULL);
+  struct atto_token *t = NULL;
 
-  if (token == NULL) {
-    t->token = NULL;
-  } else {
-    t->token = (char *)malloc(sizeof(char) * (strlen(token) + 1));
-    assert(t->token != NULL);
-    strcpy(t->token, token);
+  if (ta->number_of_tokens == ta->allocated_tokens) {
+    ta->allocated_tokens *= 2;
+    ta->tokens = (struct atto_token *)realloc(ta->tokens, sizeof(struct atto_token) * ta->allocated_tokens);
+    assert(ta->tokens != NULL);
   }
 
+  t = &ta->tokens[ta->number_of_tokens++];
   t->kind = kind;
-  t->next = NULL;
-
-  return t;
+  t->offset = offset;
+  t->length = length;
 }
 
 /*
- *  performs lexical analysis on a given string, and returns a list of tokens
+ *  performs lexical analysis on a given string, and returns an array of
+ *  tokens referring to it; the string must outlive the array. returns NULL
+ *  if a character which cannot start a token is met
  */
-struct atto_token *atto_lex_string(const char *string)
+struct atto_token_array *atto_lex_string(const char *string)
 {
-  struct atto_token *token_list = NULL;
-  struct atto_token *last_token = NULL;
+  struct atto_token_array *ta = (struct atto_token_array *)malloc(sizeof(struct atto_token_array));
+  const char *current = string,
+             *end = string + strlen(string);
+
+  assert(ta != NULL);
+
+  if (span == NULL) {
+    atto_initialize_lexer();
+  }
 
-  char temp_token[ATTO_MAX_TOKEN_LENGTH];
-  size_t temp_token_index = 0;
+  ta->source = string;
+  ta->number_of_tokens = 0;
+  ta->allocated_tokens = ATTO_MIN_NUMBER_OF_TOKENS;
+  ta->tokens = (struct atto_token *)malloc(sizeof(struct atto_token) * ATTO_MIN_NUMBER_OF_TOKENS);
+  assert(ta->tokens != NULL);
 
-  while (*string) {
+  while (1) {
+    const char *start = NULL;
+    uint8_t class;
 
     /*  whitespace is ignored */
-    while ((*string != '\0') && is_whitespace(*string)) {
-      string++;
+    current += span(current, end, CLASS_WHITESPACE, 0);
+    start = current;
+    class = class_of(*current);
+
+    if (class & CLASS_END) {
+      break;
     }
-    
+
     /*  number literals start with either a digit, or a minus sign */
-    if (is_digit(*string) || (*string == '-')) {
-      struct atto_token *number_literal = NULL;
-
-      while (!is_whitespace(*string) && (*string != ')')) {
-        temp_token[temp_token_index++] = *string++;
-      }
-      temp_token[temp_token_index] = 0;
-      temp_token_index = 0;
-
-      number_literal = allocate_token(temp_token, ATTO_TOKEN_NUMBER);
-      if (token_list == NULL) {
-        token_list = number_literal;
-        last_token = number_literal;
-      } else {
-        last_token->next = number_literal;
-        last_token       = number_literal;
-      }
+    if (class & (CLASS_DIGIT | CLASS_DASH)) {
+      current += span(current, end, CLASS_NUMBER_END, 1);
+      push_token(ta, ATTO_TOKEN_NUMBER, start - string, current - start);
+      continue;
     }
 
     /*  symbol literals start with a colon sign, and may contain any
-     *  combination of letters, digits, and dashes */
-    if (*string == ':') {
-      struct atto_token *symbol_literal = NULL;
-
-      string++;
-      while (is_alnum(*string) || (*string == '-')) {
-        temp_token[temp_token_index++] = *string++;
-      }
-      temp_token[temp_token_index] = 0;
-      temp_token_index = 0;
-      
-      symbol_literal = allocate_token(temp_token, ATTO_TOKEN_SYMBOL);
-      if (token_list == NULL) {
-        token_list = symbol_literal;
-        last_token = symbol_literal;
-      } else {
-        last_token->next = symbol_literal;
-        last_token       = symbol_literal;
-      }
+     *  combination of letters, digits, and dashes; the colon is not part of
+     *  the token */
+    if (*current == ':') {
+      current++;
+      current += span(current, end, CLASS_SYMBOL, 0);
+      push_token(ta, ATTO_TOKEN_SYMBOL, start - string + 1, current - start - 1);
+      continue;
     }
 
     /*  identifiers start with a letter, and may contain any combination of
-     *  letters, digits, and dashes */
-    if (is_letter(*string)) {
-      struct atto_token *identifier = NULL;
-
-      while (is_alnum(*string) || (*string == '-')) {
-        temp_token[temp_token_index++] = *string++;
-      }
-      temp_token[temp_token_index] = 0;
-      temp_token_index = 0;
-      
-      identifier = allocate_token(temp_token, ATTO_TOKEN_IDENTIFIER);
-      if (token_list == NULL) {
-        token_list = identifier;
-        last_token = identifier;
-      } else {
-        last_token->next = identifier;
-        last_token       = identifier;
-      }
+     *  letters, digits, dashes, and asterisks */
+    if (class & CLASS_LETTER) {
+      current += span(current, end, CLASS_IDENTIFIER, 0);
+      push_token(ta, ATTO_TOKEN_IDENTIFIER, start - string, current - start);
+      continue;
     }
 
     /*  an open paranthesis marks the beginning of a list */
-    if (*string == '(') {
-      struct atto_token *open_paren = allocate_token(NULL, ATTO_TOKEN_OPEN_PAREN);
-      if (token_list == NULL) {
-        token_list = open_paren;
-        last_token = open_paren;
-      } else {
-        last_token->next = open_paren;
-        last_token       = open_paren;
-      }
-
-      string++;
+    if (*current == '(') {
+      push_token(ta, ATTO_TOKEN_OPEN_PAREN, start - string, 1);
+      current++;
+      continue;
     }
 
     /*  a closed paranthesis marks the end of a list */
-    if (*string == ')') {
-      struct atto_token *closed_paren = allocate_token(NULL, ATTO_TOKEN_CLOSED_PAREN);
-      if (token_list == NULL) {
-        token_list = closed_paren;
-        last_token = closed_paren;
-      } else {
-        last_token->next = closed_paren;
-        last_token       = closed_paren;
-      }
-
-      string++;
+    if (*current == ')') {
+      push_token(ta, ATTO_TOKEN_CLOSED_PAREN, start - string, 1);
+      current++;
+      continue;
     }
+
+    printf("syntax error: unexpected character `%c'\n", *current);
+    destroy_token_array(ta);
+    return NULL;
   }
 
-  return token_list;
+  return ta;
 }
 
-/*
- *  recursively deallocates a token list
- */
-void destroy_token_list(struct atto_token *head)
+void destroy_token_array(struct atto_token_array *ta)
 {
-  struct atto_token *current = head;
-
-  while (current) {
-    struct atto_token *temp = current->next;
-
-    /*  if the token also contains an allocated string, free that as well */
-    if (current->token != NULL) {
-      free(current->token);
-    }
-    free(current);
-
-    current = temp;
-  }
+  free(ta->tokens);
+  free(ta);
 }
 
@@ -1,18 +1,18 @@
-
 /*
  *  lexer.h
  *  part of Atto :: https://github.com/deveah/atto
  */
 
+#include <stdlib.h>
 #include <stdint.h>
 
 #pragma once
 
-#define ATTO_MAX_TOKEN_LENGTH 256
-
+/*
+ *  tokens do not hold their text, but refer to it by its position in the
+ *  source they were read from
+ */
 struct atto_token {
-  char *token;
-
   #define ATTO_TOKEN_OPEN_PAREN   0
   #define ATTO_TOKEN_CLOSED_PAREN 1
   #define ATTO_TOKEN_IDENTIFIER   2
@@ -20,10 +20,20 @@ struct atto_token {
   #define ATTO_TOKEN_SYMBOL       4
   uint32_t kind;
 
-  struct atto_token *next;
+  size_t offset;
+  size_t length;
 };
 
+struct atto_token_array {
+  const char *source;
+
+  #define ATTO_MIN_NUMBER_OF_TOKENS (size_t)64
+  struct atto_token *tokens;
+  size_t number_of_tokens;
+  size_t allocated_tokens;
+};
 
-struct atto_token *atto_lex_string(const char *string);
-void destroy_token_list(struct atto_token *head);
+void atto_initialize_lexer(void);
+struct atto_token_array *atto_lex_string(const char *string);
+void destroy_token_array(struct atto_token_array *ta);
 
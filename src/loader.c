@@ -0,0 +1,233 @@
+/*
+ *  loader.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "state.h"
+#include "lexer.h"
+#include "parser.h"
+#include "arena.h"
+#include "loader.h"
+
+static int is_whitespace(char c)
+{
+  return ((c == ' ') || (c == '\n') || (c == '\t'));
+}
+
+/*
+ *  finds where the top-level forms of a source start and end, by keeping
+ *  a running count of the depth of parantheses; forms end where the depth
+ *  drops back to zero, or, for forms which are not lists, at the first
+ *  whitespace or paranthesis. returns the number of forms, whose spans are
+ *  put in a newly allocated array
+ */
+size_t atto_split_forms(const char *source, size_t length, struct atto_form_span **spans)
+{
+  size_t number_of_spans = 0, allocated_spans = 64, i = 0;
+
+  *spans = (struct atto_form_span *)malloc(sizeof(struct atto_form_span) * allocated_spans);
+  assert(*spans != NULL);
+
+  while (i < length) {
+    size_t start, depth = 0;
+
+    if (is_whitespace(source[i])) {
+      i++;
+      continue;
+    }
+
+    start = i;
+
+    if (source[i] == '(') {
+      while (i < length) {
+        if (source[i] == '(') {
+          depth++;
+        } else if ((source[i] == ')') && (--depth == 0)) {
+          i++;
+          break;
+        }
+
+        i++;
+      }
+    } else if (source[i] == ')') {
+      i++;
+    } else {
+      while ((i < length) && !is_whitespace(source[i]) && (source[i] != '(') && (source[i] != ')')) {
+        i++;
+      }
+    }
+
+    if (number_of_spans == allocated_spans) {
+      allocated_spans *= 2;
+      *spans = (struct atto_form_span *)realloc(*spans, sizeof(struct atto_form_span) * allocated_spans);
+      assert(*spans != NULL);
+    }
+
+    (*spans)[number_of_spans].offset = start;
+    (*spans)[number_of_spans].length = i - start;
+    number_of_spans++;
+  }
+
+  return number_of_spans;
+}
+
+size_t atto_number_of_cores(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return (n > 0) ? (size_t)n : 1;
+}
+
+/*
+ *  a form, as it moves from the worker threads, which lex and parse it, to
+ *  the loading thread, which compiles and runs it
+ */
+struct loaded_form {
+  struct atto_form_span span;
+  struct atto_arena *arena;
+  struct atto_ast_node *root;
+  uint8_t done;
+};
+
+struct loader {
+  const char *source;
+  struct loaded_form *forms;
+  size_t number_of_forms;
+
+  /*  the next form a worker should take */
+  size_t next_form;
+
+  pthread_mutex_t lock;
+  pthread_cond_t form_done;
+};
+
+/*
+ *  workers take forms in source order, each parsing its form into an arena
+ *  of its own; symbols are interned later, on the loading thread, so that
+ *  they are numbered the same way they would have been if the forms had
+ *  been loaded one by one
+ */
+static void *parse_forms(void *argument)
+{
+  struct loader *l = (struct loader *)argument;
+
+  while (1) {
+    struct loaded_form *f = NULL;
+    struct atto_token_array *tokens = NULL;
+    size_t left = 0;
+
+    pthread_mutex_lock(&l->lock);
+    if (l->next_form == l->number_of_forms) {
+      pthread_mutex_unlock(&l->lock);
+      break;
+    }
+    f = &l->forms[l->next_form++];
+    pthread_mutex_unlock(&l->lock);
+
+    f->arena = atto_allocate_arena(ATTO_ARENA_DEFAULT_BLOCK_SIZE);
+    tokens = atto_lex_string(atto_arena_copy_string(f->arena, l->source + f->span.offset, f->span.length));
+
+    if (tokens != NULL) {
+      f->root = atto_parse_token_array(NULL, tokens, f->arena, &left);
+      destroy_token_array(tokens);
+    }
+
+    pthread_mutex_lock(&l->lock);
+    f->done = 1;
+    pthread_cond_broadcast(&l->form_done);
+    pthread_mutex_unlock(&l->lock);
+  }
+
+  return NULL;
+}
+
+/*
+ *  loads a source which holds any number of top-level forms, lexing and
+ *  parsing them on a pool of threads, while the calling thread compiles
+ *  and runs them, in source order, as soon as each is ready; compiling a
+ *  form depends on the definitions before it, so that is never done out of
+ *  order. syntax errors found by the lexer and the parser may be reported
+ *  ahead of the results of the forms before them
+ */
+void atto_load_source_parallel(struct atto_state *a, const char *source, size_t length,
+  size_t number_of_threads, atto_form_evaluator evaluate)
+{
+  struct atto_form_span *spans = NULL;
+  pthread_t *threads = NULL;
+  struct loader l;
+  size_t i;
+
+  l.source = source;
+  l.number_of_forms = atto_split_forms(source, length, &spans);
+  l.next_form = 0;
+
+  if (l.number_of_forms == 0) {
+    free(spans);
+    return;
+  }
+
+  if (number_of_threads > l.number_of_forms) {
+    number_of_threads = l.number_of_forms;
+  }
+
+  l.forms = (struct loaded_form *)malloc(sizeof(struct loaded_form) * l.number_of_forms);
+  assert(l.forms != NULL);
+
+  for (i = 0; i < l.number_of_forms; i++) {
+    l.forms[i].span = spans[i];
+    l.forms[i].arena = NULL;
+    l.forms[i].root = NULL;
+    l.forms[i].done = 0;
+  }
+
+  free(spans);
+
+  pthread_mutex_init(&l.lock, NULL);
+  pthread_cond_init(&l.form_done, NULL);
+
+  atto_initialize_lexer();
+
+  threads = (pthread_t *)malloc(sizeof(pthread_t) * number_of_threads);
+  assert(threads != NULL);
+
+  for (i = 0; i < number_of_threads; i++) {
+    pthread_create(&threads[i], NULL, parse_forms, &l);
+  }
+
+  for (i = 0; i < l.number_of_forms; i++) {
+    struct loaded_form *f = &l.forms[i];
+
+    pthread_mutex_lock(&l.lock);
+    while (!f->done) {
+      pthread_cond_wait(&l.form_done, &l.lock);
+    }
+    pthread_mutex_unlock(&l.lock);
+
+    if (f->root != NULL) {
+      atto_intern_ast_symbols(a, f->root);
+      evaluate(a, f->root);
+    }
+
+    atto_destroy_arena(f->arena);
+  }
+
+  for (i = 0; i < number_of_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&l.form_done);
+  pthread_mutex_destroy(&l.lock);
+
+  free(threads);
+  free(l.forms);
+}
+
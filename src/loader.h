@@ -0,0 +1,25 @@
+/*
+ *  loader.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+
+#include "state.h"
+#include "parser.h"
+
+#pragma once
+
+typedef void (*atto_form_evaluator)(struct atto_state *a, struct atto_ast_node *root);
+
+struct atto_form_span {
+  size_t offset;
+  size_t length;
+};
+
+size_t atto_split_forms(const char *source, size_t length, struct atto_form_span **spans);
+size_t atto_number_of_cores(void);
+
+void atto_load_source_parallel(struct atto_state *a, const char *source, size_t length,
+  size_t number_of_threads, atto_form_evaluator evaluate);
+
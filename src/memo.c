@@ -0,0 +1,255 @@
+/*
+ *  memo.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "state.h"
+#include "vm.h"
+#include "memo.h"
+
+/*
+ *  the results of calls to memoized lambdas are kept in a cache of fixed
+ *  capacity, indexed by the hash of the called lambda and the values of the
+ *  arguments it was called with
+ */
+struct atto_memo_cache *atto_allocate_memo_cache(size_t capacity)
+{
+  struct atto_memo_cache *c = (struct atto_memo_cache *)malloc(sizeof(struct atto_memo_cache));
+  assert(c != NULL);
+
+  c->entries = (struct atto_memo_entry *)malloc(sizeof(struct atto_memo_entry) * capacity);
+  assert(c->entries != NULL);
+  c->number_of_entries = 0;
+  c->capacity = capacity;
+
+  /*  buckets are kept at least twice as many as entries */
+  c->number_of_buckets = 1;
+  while (c->number_of_buckets < 2 * capacity) {
+    c->number_of_buckets *= 2;
+  }
+
+  c->buckets = (struct atto_memo_entry **)calloc(c->number_of_buckets, sizeof(struct atto_memo_entry *));
+  assert(c->buckets != NULL);
+
+  c->newest = NULL;
+  c->oldest = NULL;
+
+  c->hits = 0;
+  c->misses = 0;
+  c->evictions = 0;
+
+  return c;
+}
+
+void atto_destroy_memo_cache(struct atto_memo_cache *c)
+{
+  free(c->entries);
+  free(c->buckets);
+  free(c);
+}
+
+/*
+ *  only calls whose arguments are plain values can be remembered, since
+ *  those are the only ones which can be told apart by value
+ */
+int atto_memo_is_cacheable(struct atto_object *heap, size_t *arguments, size_t number_of_arguments)
+{
+  size_t i;
+
+  if (number_of_arguments > ATTO_MEMO_MAX_ARGUMENTS) {
+    return 0;
+  }
+
+  for (i = 0; i < number_of_arguments; i++) {
+    uint8_t kind = heap[arguments[i]].kind;
+
+    if ((kind != ATTO_OBJECT_KIND_NULL) &&
+        (kind != ATTO_OBJECT_KIND_NUMBER) &&
+        (kind != ATTO_OBJECT_KIND_SYMBOL)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static uint32_t hash_call(struct atto_object *heap, size_t instruction_stream_index,
+  size_t *arguments, size_t number_of_arguments)
+{
+  uint32_t hash = atto_hash_bytes(ATTO_HASH_SEED, &instruction_stream_index, sizeof(size_t));
+  size_t i;
+
+  for (i = 0; i < number_of_arguments; i++) {
+    struct atto_object *o = &heap[arguments[i]];
+
+    hash = atto_hash_bytes(hash, &o->kind, sizeof(uint8_t));
+
+    if (o->kind == ATTO_OBJECT_KIND_NUMBER) {
+      hash = atto_hash_bytes(hash, &o->container.number, sizeof(double));
+    } else if (o->kind == ATTO_OBJECT_KIND_SYMBOL) {
+      hash = atto_hash_bytes(hash, &o->container.symbol, sizeof(uint64_t));
+    }
+  }
+
+  return hash;
+}
+
+static int is_same_object(struct atto_object *a, struct atto_object *b)
+{
+  if (a->kind != b->kind) {
+    return 0;
+  }
+
+  if (a->kind == ATTO_OBJECT_KIND_NUMBER) {
+    return (a->container.number == b->container.number);
+  }
+
+  if (a->kind == ATTO_OBJECT_KIND_SYMBOL) {
+    return (a->container.symbol == b->container.symbol);
+  }
+
+  return 1;
+}
+
+static struct atto_memo_entry *find_entry(struct atto_memo_cache *c, struct atto_object *heap,
+  uint32_t hash, size_t instruction_stream_index, size_t *arguments, size_t number_of_arguments)
+{
+  struct atto_memo_entry *e = c->buckets[hash & (c->number_of_buckets - 1)];
+  size_t i;
+
+  for (; e != NULL; e = e->bucket_next) {
+    if ((e->hash != hash) ||
+        (e->instruction_stream_index != instruction_stream_index) ||
+        (e->number_of_arguments != number_of_arguments)) {
+      continue;
+    }
+
+    for (i = 0; i < number_of_arguments; i++) {
+      if (!is_same_object(&e->arguments[i], &heap[arguments[i]])) {
+        break;
+      }
+    }
+
+    if (i == number_of_arguments) {
+      return e;
+    }
+  }
+
+  return NULL;
+}
+
+static void unlink_entry(struct atto_memo_cache *c, struct atto_memo_entry *e)
+{
+  if (e->newer != NULL) {
+    e->newer->older = e->older;
+  } else {
+    c->newest = e->older;
+  }
+
+  if (e->older != NULL) {
+    e->older->newer = e->newer;
+  } else {
+    c->oldest = e->newer;
+  }
+}
+
+static void make_newest(struct atto_memo_cache *c, struct atto_memo_entry *e)
+{
+  e->newer = NULL;
+  e->older = c->newest;
+
+  if (c->newest != NULL) {
+    c->newest->newer = e;
+  } else {
+    c->oldest = e;
+  }
+
+  c->newest = e;
+}
+
+/*
+ *  looks up the result of a call, counting the lookup as either a hit or a
+ *  miss; returns whether the result was found
+ */
+int atto_memo_lookup(struct atto_memo_cache *c, struct atto_object *heap, size_t instruction_stream_index,
+  size_t *arguments, size_t number_of_arguments, size_t *result)
+{
+  uint32_t hash = hash_call(heap, instruction_stream_index, arguments, number_of_arguments);
+  struct atto_memo_entry *e = find_entry(c, heap, hash, instruction_stream_index, arguments, number_of_arguments);
+
+  if (e == NULL) {
+    c->misses++;
+    return 0;
+  }
+
+  unlink_entry(c, e);
+  make_newest(c, e);
+
+  c->hits++;
+  *result = e->result;
+
+  return 1;
+}
+
+/*
+ *  remembers the result of a call; once the cache is full, the entry which
+ *  was used the longest time ago makes room for it
+ */
+void atto_memo_store(struct atto_memo_cache *c, struct atto_object *heap, size_t instruction_stream_index,
+  size_t *arguments, size_t number_of_arguments, size_t result)
+{
+  uint32_t hash = hash_call(heap, instruction_stream_index, arguments, number_of_arguments);
+  struct atto_memo_entry *e = find_entry(c, heap, hash, instruction_stream_index, arguments, number_of_arguments);
+  size_t i;
+
+  if (e != NULL) {
+    unlink_entry(c, e);
+    e->result = result;
+    make_newest(c, e);
+    return;
+  }
+
+  if (c->number_of_entries < c->capacity) {
+    e = &c->entries[c->number_of_entries++];
+  } else {
+    struct atto_memo_entry **current = NULL;
+
+    e = c->oldest;
+    unlink_entry(c, e);
+
+    current = &c->buckets[e->hash & (c->number_of_buckets - 1)];
+    while (*current != e) {
+      current = &(*current)->bucket_next;
+    }
+    *current = e->bucket_next;
+
+    c->evictions++;
+  }
+
+  e->hash = hash;
+  e->instruction_stream_index = instruction_stream_index;
+  e->number_of_arguments = number_of_arguments;
+
+  for (i = 0; i < number_of_arguments; i++) {
+    e->arguments[i] = heap[arguments[i]];
+  }
+
+  e->bucket_next = c->buckets[hash & (c->number_of_buckets - 1)];
+  c->buckets[hash & (c->number_of_buckets - 1)] = e;
+
+  e->result = result;
+  make_newest(c, e);
+}
+
+void pretty_print_memo_cache_usage(struct atto_memo_cache *c)
+{
+  printf("memo: %lu/%lu entries, %lu hits, %lu misses, %lu evictions\n",
+    c->number_of_entries, c->capacity, c->hits, c->misses, c->evictions);
+}
+
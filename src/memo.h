@@ -0,0 +1,59 @@
+/*
+ *  memo.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vm.h"
+
+#pragma once
+
+#define ATTO_MEMO_DEFAULT_CAPACITY (size_t)256
+
+/*  calls are only remembered if they have at most this many arguments */
+#define ATTO_MEMO_MAX_ARGUMENTS 4
+
+struct atto_memo_entry {
+  size_t instruction_stream_index;
+  size_t number_of_arguments;
+  struct atto_object arguments[ATTO_MEMO_MAX_ARGUMENTS];
+  size_t result;
+
+  uint32_t hash;
+  struct atto_memo_entry *bucket_next;
+
+  /*  entries are listed from the most recently used one, so that the least
+   *  recently used one is the first to go once the cache is full */
+  struct atto_memo_entry *newer;
+  struct atto_memo_entry *older;
+};
+
+struct atto_memo_cache {
+  struct atto_memo_entry *entries;
+  size_t number_of_entries;
+  size_t capacity;
+
+  struct atto_memo_entry **buckets;
+  size_t number_of_buckets;
+
+  struct atto_memo_entry *newest;
+  struct atto_memo_entry *oldest;
+
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+};
+
+struct atto_memo_cache *atto_allocate_memo_cache(size_t capacity);
+void atto_destroy_memo_cache(struct atto_memo_cache *c);
+
+int atto_memo_is_cacheable(struct atto_object *heap, size_t *arguments, size_t number_of_arguments);
+int atto_memo_lookup(struct atto_memo_cache *c, struct atto_object *heap, size_t instruction_stream_index,
+  size_t *arguments, size_t number_of_arguments, size_t *result);
+void atto_memo_store(struct atto_memo_cache *c, struct atto_object *heap, size_t instruction_stream_index,
+  size_t *arguments, size_t number_of_arguments, size_t result);
+
+void pretty_print_memo_cache_usage(struct atto_memo_cache *c);
+
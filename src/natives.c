@@ -0,0 +1,74 @@
+/*
+ *  natives.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "vm.h"
+#include "builtins.h"
+#include "natives.h"
+
+/*
+ *  (floor x) rounds a number down to the integer below it
+ */
+static int native_floor(struct atto_vm_state *vm, size_t *arguments, struct atto_object *result)
+{
+  struct atto_object *x = &vm->heap[arguments[0]];
+
+  if (x->kind != ATTO_OBJECT_KIND_NUMBER) {
+    return 0;
+  }
+
+  result->kind = ATTO_OBJECT_KIND_NUMBER;
+  result->container.number = floor(x->container.number);
+
+  return 1;
+}
+
+/*
+ *  (mod x y) is what is left of `x' after taking out `y' as many whole
+ *  times as it fits, and has the sign of `x'; the remainder is exact, even
+ *  when the quotient is too large to be. it fails if `y' is zero, or if `x'
+ *  is not finite
+ */
+static int native_mod(struct atto_vm_state *vm, size_t *arguments, struct atto_object *result)
+{
+  struct atto_object *x = &vm->heap[arguments[0]], *y = &vm->heap[arguments[1]];
+  double remainder;
+
+  if ((x->kind != ATTO_OBJECT_KIND_NUMBER) || (y->kind != ATTO_OBJECT_KIND_NUMBER) ||
+      (y->container.number == 0.0)) {
+    return 0;
+  }
+
+  remainder = fmod(x->container.number, y->container.number);
+
+  if (remainder != remainder) {
+    return 0;
+  }
+
+  result->kind = ATTO_OBJECT_KIND_NUMBER;
+  result->container.number = remainder;
+
+  return 1;
+}
+
+/*
+ *  registers the native functions every atto executable provides; this is
+ *  done before any state is allocated, since images, the prelude among
+ *  them, refer to natives by the order in which they were registered
+ */
+void atto_register_standard_natives(void)
+{
+  struct atto_builtin *b = NULL;
+
+  b = atto_register_native("floor", 1, ATTO_BUILTIN_FLAG_PURE, native_floor);
+  b->result_kind = ATTO_OBJECT_KIND_NUMBER;
+
+  b = atto_register_native("mod", 2, ATTO_BUILTIN_FLAG_PURE, native_mod);
+  b->result_kind = ATTO_OBJECT_KIND_NUMBER;
+}
+
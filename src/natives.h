@@ -0,0 +1,9 @@
+/*
+ *  natives.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#pragma once
+
+void atto_register_standard_natives(void);
+
@@ -15,6 +15,9 @@
 #define ATTO_VM_OP_BF     0x05
 #define ATTO_VM_OP_CLOSE  0x06
 #define ATTO_VM_OP_STOP   0x07
+#define ATTO_VM_OP_EVAL   0x08
+#define ATTO_VM_OP_CALLNATIVE 0x09
+#define ATTO_VM_OP_FAIL   0x0a
 
 /*  arithmetic operations */
 #define ATTO_VM_OP_ADD    0x10
@@ -44,6 +47,7 @@
 #define ATTO_VM_OP_PUSHS  0x41
 #define ATTO_VM_OP_PUSHL  0x42
 #define ATTO_VM_OP_PUSHZ  0x43
+#define ATTO_VM_OP_PUSHK  0x44
 
 #define ATTO_VM_OP_DUP    0x48
 #define ATTO_VM_OP_DROP   0x49
@@ -52,4 +56,5 @@
 #define ATTO_VM_OP_GETGL  0x50
 #define ATTO_VM_OP_GETLC  0x51
 #define ATTO_VM_OP_GETAG  0x52
+#define ATTO_VM_OP_GETCAP 0x53
 
@@ -0,0 +1,2259 @@
+/*
+ *  optimizer.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "state.h"
+#include "parser.h"
+#include "compiler.h"
+#include "builtins.h"
+#include "analysis.h"
+#include "optimizer.h"
+
+static struct atto_expression *make_number_literal(double number)
+{
+  struct atto_expression *e = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  assert(e != NULL);
+
+  e->kind = ATTO_EXPRESSION_KIND_NUMBER_LITERAL;
+  e->container.number_literal = number;
+
+  return e;
+}
+
+static struct atto_expression *make_symbol_literal(uint64_t symbol)
+{
+  struct atto_expression *e = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  assert(e != NULL);
+
+  e->kind = ATTO_EXPRESSION_KIND_SYMBOL_LITERAL;
+  e->container.symbol_literal = symbol;
+
+  return e;
+}
+
+static struct atto_expression *make_reference(const char *name)
+{
+  struct atto_expression *e = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  assert(e != NULL);
+
+  e->kind = ATTO_EXPRESSION_KIND_REFERENCE;
+  e->container.reference_identifier = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+  assert(e->container.reference_identifier != NULL);
+  strcpy(e->container.reference_identifier, name);
+
+  return e;
+}
+
+static struct atto_expression *make_application(const char *name, uint32_t number_of_parameters)
+{
+  struct atto_expression *e = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  struct atto_application_expression *ae = (struct atto_application_expression *)malloc(sizeof(struct atto_application_expression));
+  assert(e != NULL);
+  assert(ae != NULL);
+
+  ae->identifier = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+  assert(ae->identifier != NULL);
+  strcpy(ae->identifier, name);
+
+  ae->number_of_parameters = number_of_parameters;
+  ae->parameters = (struct atto_expression **)malloc(sizeof(struct atto_expression *) * (number_of_parameters + 1));
+  assert(ae->parameters != NULL);
+
+  e->kind = ATTO_EXPRESSION_KIND_APPLICATION;
+  e->container.application_expression = ae;
+
+  return e;
+}
+
+static struct atto_expression *make_if(struct atto_expression *condition,
+  struct atto_expression *true_evaluation, struct atto_expression *false_evaluation)
+{
+  struct atto_expression *e = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  struct atto_if_expression *ie = (struct atto_if_expression *)malloc(sizeof(struct atto_if_expression));
+  assert(e != NULL);
+  assert(ie != NULL);
+
+  ie->condition_expression        = condition;
+  ie->true_evaluation_expression  = true_evaluation;
+  ie->false_evaluation_expression = false_evaluation;
+
+  e->kind = ATTO_EXPRESSION_KIND_IF;
+  e->container.if_expression = ie;
+
+  return e;
+}
+
+/*
+ *  takes an expression out of its parent, leaving a placeholder behind, so
+ *  that the parent may be destroyed without it
+ */
+static struct atto_expression *detach(struct atto_expression **slot)
+{
+  struct atto_expression *e = *slot;
+  *slot = make_number_literal(0);
+
+  return e;
+}
+
+static int is_trivial(struct atto_expression *e)
+{
+  return ((e->kind == ATTO_EXPRESSION_KIND_NUMBER_LITERAL) ||
+          (e->kind == ATTO_EXPRESSION_KIND_SYMBOL_LITERAL) ||
+          (e->kind == ATTO_EXPRESSION_KIND_REFERENCE));
+}
+
+static int parameter_index(struct atto_lambda_expression *le, const char *name)
+{
+  uint32_t i;
+
+  for (i = 0; i < le->number_of_parameters; i++) {
+    if (strcmp(le->parameter_names[i], name) == 0) {
+      return (int)i;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ *  names which are bound by let expressions between the root of the
+ *  expression being searched and the current subexpression
+ */
+struct bound_name {
+  const char *name;
+  struct bound_name *next;
+};
+
+static int is_bound(struct bound_name *bound, const char *name)
+{
+  while (bound) {
+    if (strcmp(bound->name, name) == 0) {
+      return 1;
+    }
+
+    bound = bound->next;
+  }
+
+  return 0;
+}
+
+/*
+ *  counts the uses of a name in an expression; `as_callee' receives the
+ *  number of uses in which it is being called
+ */
+static size_t count_uses(struct atto_expression *e, const char *name, size_t *as_callee)
+{
+  size_t uses = 0;
+  int shadowed = 0;
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    return (strcmp(e->container.reference_identifier, name) == 0);
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      uses += count_uses(lle->elements[i], name, as_callee);
+    }
+    return uses;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    uses += count_uses(ie->condition_expression, name, as_callee);
+    uses += count_uses(ie->true_evaluation_expression, name, as_callee);
+    uses += count_uses(ie->false_evaluation_expression, name, as_callee);
+    return uses;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    if (strcmp(ae->identifier, name) == 0) {
+      (*as_callee)++;
+      uses++;
+    }
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      uses += count_uses(ae->parameters[i], name, as_callee);
+    }
+    return uses;
+  }
+
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+    if (parameter_index(le, name) >= 0) {
+      return 0;
+    }
+    return count_uses(le->body, name, as_callee);
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    for (i = 0; i < le->number_of_bindings; i++) {
+      uses += count_uses(le->binding_expressions[i], name, as_callee);
+      if (strcmp(le->binding_names[i], name) == 0) {
+        if (le->sequential) {
+          return uses;
+        }
+        shadowed = 1;
+      }
+    }
+    if (shadowed) {
+      return uses;
+    }
+    return uses + count_uses(le->body, name, as_callee);
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  returns whether a lambda body can be moved into another scope: it must
+ *  not define lambdas of its own, and every global it refers to must still
+ *  be the same object where it is being moved
+ */
+static int is_movable(struct atto_environment *env, struct atto_environment_object *scope,
+  struct atto_lambda_expression *le, struct bound_name *bound, struct atto_expression *e)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    return 1;
+
+  case ATTO_EXPRESSION_KIND_REFERENCE: {
+    char *name = e->container.reference_identifier;
+    struct atto_environment_object *eo;
+
+    if ((parameter_index(le, name) >= 0) || is_bound(bound, name)) {
+      return 1;
+    }
+
+    eo = atto_find_in_scope(env, scope, name);
+    return ((eo != NULL) && (atto_find_in_environment(env, name) == eo));
+  }
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      if (!is_movable(env, scope, le, bound, lle->elements[i])) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (is_movable(env, scope, le, bound, ie->condition_expression) &&
+            is_movable(env, scope, le, bound, ie->true_evaluation_expression) &&
+            is_movable(env, scope, le, bound, ie->false_evaluation_expression));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    char *name = ae->identifier;
+
+    if (!is_builtin_function(name) && (parameter_index(le, name) < 0) && !is_bound(bound, name)) {
+      struct atto_environment_object *eo = atto_find_in_scope(env, scope, name);
+      if ((eo == NULL) || (atto_find_in_environment(env, name) != eo)) {
+        return 0;
+      }
+    }
+
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      if (!is_movable(env, scope, le, bound, ae->parameters[i])) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  /*  let expressions which shadow a parameter are not moved, which lets
+   *  parameters be substituted without regard to scoping */
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *lete = e->container.let_expression;
+    struct bound_name *names = (struct bound_name *)malloc(sizeof(struct bound_name) * (lete->number_of_bindings + 1));
+    struct bound_name *inner = bound;
+    int movable = 1;
+    assert(names != NULL);
+
+    for (i = 0; (i < lete->number_of_bindings) && movable; i++) {
+      movable = ((parameter_index(le, lete->binding_names[i]) < 0) &&
+                 is_movable(env, scope, le, lete->sequential ? inner : bound, lete->binding_expressions[i]));
+      names[i].name = lete->binding_names[i];
+      names[i].next = inner;
+      inner = &names[i];
+    }
+
+    movable = movable && is_movable(env, scope, le, inner, lete->body);
+
+    free(names);
+    return movable;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  returns whether an expression contains a let expression binding a name
+ *  which one of the given expressions refers to; substituting those in it
+ *  would make them refer to the binding instead
+ */
+static int captures(struct atto_expression *e, struct atto_expression **expressions, uint32_t n)
+{
+  size_t as_callee = 0;
+  uint32_t i, j;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      if (captures(lle->elements[i], expressions, n)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (captures(ie->condition_expression, expressions, n) ||
+            captures(ie->true_evaluation_expression, expressions, n) ||
+            captures(ie->false_evaluation_expression, expressions, n));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      if (captures(ae->parameters[i], expressions, n)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    for (i = 0; i < le->number_of_bindings; i++) {
+      for (j = 0; j < n; j++) {
+        if (count_uses(expressions[j], le->binding_names[i], &as_callee) > 0) {
+          return 1;
+        }
+      }
+      if (captures(le->binding_expressions[i], expressions, n)) {
+        return 1;
+      }
+    }
+    return captures(le->body, expressions, n);
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  copies a lambda body, replacing its parameters with the given arguments
+ */
+static struct atto_expression *substitute(struct atto_expression *e,
+  struct atto_lambda_expression *le, struct atto_expression **arguments)
+{
+  struct atto_expression *copy = NULL;
+  uint32_t i;
+  int index;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    index = parameter_index(le, e->container.reference_identifier);
+    if (index >= 0) {
+      return copy_expression(arguments[index]);
+    }
+    return copy_expression(e);
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle;
+    copy = copy_expression(e);
+    lle = copy->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      destroy_expression(lle->elements[i]);
+      lle->elements[i] = substitute(e->container.list_literal_expression->elements[i], le, arguments);
+    }
+    return copy;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    struct atto_if_expression *ie_copy = (struct atto_if_expression *)malloc(sizeof(struct atto_if_expression));
+    assert(ie_copy != NULL);
+
+    ie_copy->condition_expression        = substitute(ie->condition_expression, le, arguments);
+    ie_copy->true_evaluation_expression  = substitute(ie->true_evaluation_expression, le, arguments);
+    ie_copy->false_evaluation_expression = substitute(ie->false_evaluation_expression, le, arguments);
+
+    copy = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+    assert(copy != NULL);
+    copy->kind = ATTO_EXPRESSION_KIND_IF;
+    copy->container.if_expression = ie_copy;
+    return copy;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae;
+    copy = copy_expression(e);
+    ae = copy->container.application_expression;
+
+    /*  a parameter being called is replaced by the name of the function
+     *  passed in its place */
+    index = parameter_index(le, ae->identifier);
+    if (index >= 0) {
+      char *name = arguments[index]->container.reference_identifier;
+      free(ae->identifier);
+      ae->identifier = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+      assert(ae->identifier != NULL);
+      strcpy(ae->identifier, name);
+    }
+
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      destroy_expression(ae->parameters[i]);
+      ae->parameters[i] = substitute(e->container.application_expression->parameters[i], le, arguments);
+    }
+    return copy;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *lete;
+    copy = copy_expression(e);
+    lete = copy->container.let_expression;
+    for (i = 0; i < lete->number_of_bindings; i++) {
+      destroy_expression(lete->binding_expressions[i]);
+      lete->binding_expressions[i] = substitute(e->container.let_expression->binding_expressions[i], le, arguments);
+    }
+    destroy_expression(lete->body);
+    lete->body = substitute(e->container.let_expression->body, le, arguments);
+    return copy;
+  }
+
+  default:
+    return copy_expression(e);
+  }
+}
+
+/*
+ *  replaces a call of a small global lambda with a copy of its body; the
+ *  call is left untouched if inlining it could change its meaning, or would
+ *  duplicate work
+ */
+static struct atto_expression *inline_application(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, size_t depth)
+{
+  struct atto_application_expression *ae = e->container.application_expression;
+  struct atto_environment_object *eo = NULL;
+  struct atto_lambda_expression *le = NULL;
+  struct atto_expression *result = NULL;
+  uint32_t i;
+
+  if ((depth >= a->inline_depth_limit) || is_builtin_function(ae->identifier)) {
+    return e;
+  }
+
+  eo = atto_find_in_environment(env, ae->identifier);
+  if ((eo == NULL) ||
+      (eo->kind != ATTO_ENVIRONMENT_OBJECT_KIND_GLOBAL) ||
+      (eo->expression == NULL)) {
+    return e;
+  }
+
+  le = eo->expression->container.lambda_expression;
+  if ((le->number_of_parameters != ae->number_of_parameters) ||
+      (atto_expression_cost(le->body) > a->inline_size_limit)) {
+    return e;
+  }
+
+  /*  recursive lambdas are never inlined into themselves; the scope in
+   *  which the lambda was defined starts right after its own definition */
+  if (!is_movable(env, eo->next, le, NULL, le->body) ||
+      captures(le->body, ae->parameters, ae->number_of_parameters)) {
+    return e;
+  }
+
+  /*  arguments used more than once are only substituted if they are cheap
+   *  to evaluate again, and called parameters need the name of a function */
+  for (i = 0; i < le->number_of_parameters; i++) {
+    size_t as_callee = 0;
+    size_t uses = count_uses(le->body, le->parameter_names[i], &as_callee);
+
+    if ((uses > 1) && !is_trivial(ae->parameters[i])) {
+      return e;
+    }
+
+    if ((as_callee > 0) && (ae->parameters[i]->kind != ATTO_EXPRESSION_KIND_REFERENCE)) {
+      return e;
+    }
+  }
+
+  result = substitute(le->body, le, ae->parameters);
+  destroy_expression(e);
+
+  return atto_inline_applications(a, env, result, depth + 1);
+}
+
+/*
+ *  inlines calls of small global lambdas throughout an expression
+ */
+struct atto_expression *atto_inline_applications(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, size_t depth)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      lle->elements[i] = atto_inline_applications(a, env, lle->elements[i], depth);
+    }
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    ie->condition_expression        = atto_inline_applications(a, env, ie->condition_expression, depth);
+    ie->true_evaluation_expression  = atto_inline_applications(a, env, ie->true_evaluation_expression, depth);
+    ie->false_evaluation_expression = atto_inline_applications(a, env, ie->false_evaluation_expression, depth);
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      ae->parameters[i] = atto_inline_applications(a, env, ae->parameters[i], depth);
+    }
+    return inline_application(a, env, e, depth);
+  }
+
+  /*  the parameters of a lambda shadow globals of the same name, so they are
+   *  put in a scope of their own while its body is being searched */
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+    struct atto_environment *local_env = atto_allocate_environment(env);
+
+    for (i = 0; i < le->number_of_parameters; i++) {
+      atto_add_to_environment(local_env, le->parameter_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_ARGUMENT, i);
+    }
+
+    le->body = atto_inline_applications(a, local_env, le->body, depth);
+
+    atto_destroy_environment(local_env);
+    return e;
+  }
+
+  /*  likewise for the names bound by a let expression; the slots given to
+   *  them here do not matter, only the shadowing does */
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    struct atto_environment *local_env = atto_allocate_environment(env);
+
+    for (i = 0; i < le->number_of_bindings; i++) {
+      le->binding_expressions[i] = atto_inline_applications(a, le->sequential ? local_env : env, le->binding_expressions[i], depth);
+      atto_add_to_environment(local_env, le->binding_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_LOCAL, i);
+    }
+
+    le->body = atto_inline_applications(a, local_env, le->body, depth);
+
+    atto_destroy_environment(local_env);
+    return e;
+  }
+
+  default:
+    return e;
+  }
+}
+
+/*
+ *  evaluates a builtin applied to literal operands, if possible
+ */
+static struct atto_expression *fold_application(struct atto_expression *e)
+{
+  struct atto_application_expression *ae = e->container.application_expression;
+  const struct atto_builtin *b = atto_find_builtin(ae->identifier);
+  struct atto_expression *result = NULL;
+
+  if ((b == NULL) || (b->arity != ae->number_of_parameters)) {
+    return e;
+  }
+
+  if ((b->arity == 2) &&
+      (ae->parameters[0]->kind == ATTO_EXPRESSION_KIND_NUMBER_LITERAL) &&
+      (ae->parameters[1]->kind == ATTO_EXPRESSION_KIND_NUMBER_LITERAL)) {
+    double x = ae->parameters[0]->container.number_literal,
+           y = ae->parameters[1]->container.number_literal;
+
+    switch (b->opcode) {
+    case ATTO_VM_OP_ADD:   result = make_number_literal(x + y);  break;
+    case ATTO_VM_OP_SUB:   result = make_number_literal(x - y);  break;
+    case ATTO_VM_OP_MUL:   result = make_number_literal(x * y);  break;
+    case ATTO_VM_OP_DIV:   result = make_number_literal(x / y);  break;
+    case ATTO_VM_OP_ISGT:  result = make_symbol_literal(x > y);  break;
+    case ATTO_VM_OP_ISGET: result = make_symbol_literal(x >= y); break;
+    case ATTO_VM_OP_ISLT:  result = make_symbol_literal(x < y);  break;
+    case ATTO_VM_OP_ISLET: result = make_symbol_literal(x <= y); break;
+    case ATTO_VM_OP_ISEQ:
+    case ATTO_VM_OP_ISSEQ: result = make_symbol_literal(x == y); break;
+    default: break;
+    }
+  }
+
+  if ((b->arity == 2) &&
+      (ae->parameters[0]->kind == ATTO_EXPRESSION_KIND_SYMBOL_LITERAL) &&
+      (ae->parameters[1]->kind == ATTO_EXPRESSION_KIND_SYMBOL_LITERAL)) {
+    uint64_t x = ae->parameters[0]->container.symbol_literal,
+             y = ae->parameters[1]->container.symbol_literal;
+
+    switch (b->opcode) {
+    case ATTO_VM_OP_ISSEQ: result = make_symbol_literal(x == y);                 break;
+    case ATTO_VM_OP_AND:   result = make_symbol_literal((x != 0) && (y != 0)); break;
+    case ATTO_VM_OP_OR:    result = make_symbol_literal((x != 0) || (y != 0)); break;
+    default: break;
+    }
+  }
+
+  if ((b->opcode == ATTO_VM_OP_NOT) &&
+      (ae->parameters[0]->kind == ATTO_EXPRESSION_KIND_SYMBOL_LITERAL)) {
+    result = make_symbol_literal(ae->parameters[0]->container.symbol_literal == 0);
+  }
+
+  if ((b->arity == 1) &&
+      (ae->parameters[0]->kind == ATTO_EXPRESSION_KIND_LIST_LITERAL)) {
+    struct atto_list_literal_expression *lle = ae->parameters[0]->container.list_literal_expression;
+
+    if (b->opcode == ATTO_VM_OP_ISNULL) {
+      result = make_symbol_literal(lle->number_of_elements == 0);
+    } else if ((b->opcode == ATTO_VM_OP_CAR) && (lle->number_of_elements > 0)) {
+      result = detach(&lle->elements[0]);
+    } else if ((b->opcode == ATTO_VM_OP_CDR) && (lle->number_of_elements > 0)) {
+      /*  the list literal loses its first element, and takes the place of
+       *  the application */
+      destroy_expression(lle->elements[0]);
+      memmove(lle->elements, lle->elements + 1, sizeof(struct atto_expression *) * (lle->number_of_elements - 1));
+      lle->number_of_elements--;
+      result = detach(&ae->parameters[0]);
+    }
+  }
+
+  if (result == NULL) {
+    return e;
+  }
+
+  destroy_expression(e);
+  return result;
+}
+
+/*
+ *  evaluates, at compile time, the parts of an expression which only depend
+ *  on literals, and removes the branches which can never be taken
+ */
+struct atto_expression *atto_fold_constants(struct atto_expression *e)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      lle->elements[i] = atto_fold_constants(lle->elements[i]);
+    }
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+    le->body = atto_fold_constants(le->body);
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    for (i = 0; i < le->number_of_bindings; i++) {
+      le->binding_expressions[i] = atto_fold_constants(le->binding_expressions[i]);
+    }
+    le->body = atto_fold_constants(le->body);
+    return e;
+  }
+
+  /*  any symbol other than `false' counts as true */
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    struct atto_expression *result = NULL;
+
+    ie->condition_expression        = atto_fold_constants(ie->condition_expression);
+    ie->true_evaluation_expression  = atto_fold_constants(ie->true_evaluation_expression);
+    ie->false_evaluation_expression = atto_fold_constants(ie->false_evaluation_expression);
+
+    if (ie->condition_expression->kind != ATTO_EXPRESSION_KIND_SYMBOL_LITERAL) {
+      return e;
+    }
+
+    if (ie->condition_expression->container.symbol_literal != 0) {
+      result = detach(&ie->true_evaluation_expression);
+    } else {
+      result = detach(&ie->false_evaluation_expression);
+    }
+
+    destroy_expression(e);
+    return result;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      ae->parameters[i] = atto_fold_constants(ae->parameters[i]);
+    }
+    return fold_application(e);
+  }
+
+  default:
+    return e;
+  }
+}
+
+/*
+ *  compiles a lambda made up by one of the passes as a global definition;
+ *  the lambda is consumed
+ */
+static void define_generated_lambda(struct atto_state *a, const char *name, struct atto_lambda_expression *le)
+{
+  struct atto_definition *d = (struct atto_definition *)malloc(sizeof(struct atto_definition));
+  assert(d != NULL);
+
+  d->identifier = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+  assert(d->identifier != NULL);
+  strcpy(d->identifier, name);
+  d->memoize = 0;
+
+  d->body = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  assert(d->body != NULL);
+  d->body->kind = ATTO_EXPRESSION_KIND_LAMBDA;
+  d->body->container.lambda_expression = le;
+
+  compile_definition(a, d);
+
+  destroy_expression(d->body);
+  free(d->identifier);
+  free(d);
+}
+
+/*
+ *  a global lambda which walks a list, recognized by its shape:
+ *
+ *    (lambda (... xs ...) (if (null xs) <null case> <step>))
+ *
+ *  where the step only looks at the list through `(car xs)', and only walks
+ *  it by calling itself with `(cdr xs)' in place of `xs' and every other
+ *  parameter passed along unchanged
+ */
+struct traversal {
+  struct atto_environment_object *eo;
+  struct atto_lambda_expression *le;
+  uint32_t list_index;
+  struct atto_expression *null_case;
+  struct atto_expression *step;
+};
+
+static int refers_to_list(struct traversal *t, struct atto_expression *e)
+{
+  return ((e->kind == ATTO_EXPRESSION_KIND_REFERENCE) &&
+          (strcmp(e->container.reference_identifier, t->le->parameter_names[t->list_index]) == 0));
+}
+
+static int is_list_head(struct traversal *t, struct atto_expression *e)
+{
+  struct atto_application_expression *ae = NULL;
+
+  if (e->kind != ATTO_EXPRESSION_KIND_APPLICATION) {
+    return 0;
+  }
+
+  ae = e->container.application_expression;
+  return ((strcmp(ae->identifier, "car") == 0) &&
+          (ae->number_of_parameters == 1) &&
+          refers_to_list(t, ae->parameters[0]));
+}
+
+static int is_recursive_call(struct traversal *t, struct atto_expression *e)
+{
+  struct atto_application_expression *ae = NULL;
+  struct atto_application_expression *tail = NULL;
+  uint32_t i;
+
+  if (e->kind != ATTO_EXPRESSION_KIND_APPLICATION) {
+    return 0;
+  }
+
+  ae = e->container.application_expression;
+  if ((strcmp(ae->identifier, t->eo->name) != 0) ||
+      (ae->number_of_parameters != t->le->number_of_parameters)) {
+    return 0;
+  }
+
+  for (i = 0; i < ae->number_of_parameters; i++) {
+    if (i == t->list_index) {
+      continue;
+    }
+
+    if ((ae->parameters[i]->kind != ATTO_EXPRESSION_KIND_REFERENCE) ||
+        (strcmp(ae->parameters[i]->container.reference_identifier, t->le->parameter_names[i]) != 0)) {
+      return 0;
+    }
+  }
+
+  if (ae->parameters[t->list_index]->kind != ATTO_EXPRESSION_KIND_APPLICATION) {
+    return 0;
+  }
+
+  tail = ae->parameters[t->list_index]->container.application_expression;
+  return ((strcmp(tail->identifier, "cdr") == 0) &&
+          (tail->number_of_parameters == 1) &&
+          refers_to_list(t, tail->parameters[0]));
+}
+
+/*
+ *  returns whether an expression only uses the list through its head, and,
+ *  if `recursion' is set, through recursive calls on its tail
+ */
+static int uses_list_head_only(struct traversal *t, struct atto_expression *e, int recursion)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    return 1;
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    return !refers_to_list(t, e);
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      if (!uses_list_head_only(t, lle->elements[i], recursion)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (uses_list_head_only(t, ie->condition_expression, recursion) &&
+            uses_list_head_only(t, ie->true_evaluation_expression, recursion) &&
+            uses_list_head_only(t, ie->false_evaluation_expression, recursion));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+
+    if (is_list_head(t, e)) {
+      return 1;
+    }
+
+    if (strcmp(ae->identifier, t->eo->name) == 0) {
+      return (recursion && is_recursive_call(t, e));
+    }
+
+    if (strcmp(ae->identifier, t->le->parameter_names[t->list_index]) == 0) {
+      return 0;
+    }
+
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      if (!uses_list_head_only(t, ae->parameters[i], recursion)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  finds out whether a call refers to a global lambda which walks a list;
+ *  the lambda must not refer to any global which has since been redefined,
+ *  since its body is going to be compiled again in the current environment
+ */
+static int recognize_traversal(struct atto_environment *env, const char *name, struct traversal *t)
+{
+  struct atto_environment_object *eo = atto_find_in_environment(env, (char *)name);
+  struct atto_if_expression *ie = NULL;
+  struct atto_application_expression *test = NULL;
+  int index;
+
+  if ((eo == NULL) ||
+      (eo->kind != ATTO_ENVIRONMENT_OBJECT_KIND_GLOBAL) ||
+      (eo->expression == NULL)) {
+    return 0;
+  }
+
+  t->eo = eo;
+  t->le = eo->expression->container.lambda_expression;
+
+  if (t->le->body->kind != ATTO_EXPRESSION_KIND_IF) {
+    return 0;
+  }
+
+  ie = t->le->body->container.if_expression;
+  if (ie->condition_expression->kind != ATTO_EXPRESSION_KIND_APPLICATION) {
+    return 0;
+  }
+
+  test = ie->condition_expression->container.application_expression;
+  if ((strcmp(test->identifier, "null") != 0) ||
+      (test->number_of_parameters != 1) ||
+      (test->parameters[0]->kind != ATTO_EXPRESSION_KIND_REFERENCE)) {
+    return 0;
+  }
+
+  index = parameter_index(t->le, test->parameters[0]->container.reference_identifier);
+  if (index < 0) {
+    return 0;
+  }
+
+  t->list_index = (uint32_t)index;
+  t->null_case = ie->true_evaluation_expression;
+  t->step = ie->false_evaluation_expression;
+
+  return (uses_list_head_only(t, t->null_case, 0) &&
+          uses_list_head_only(t, t->step, 1) &&
+          is_movable(env, eo, t->le, NULL, t->le->body));
+}
+
+/*
+ *  returns whether a traversal step builds a list: every path through it
+ *  must either cons an element onto the rest of the walk, or skip the
+ *  element and continue with the rest of the walk
+ */
+static int is_producing_step(struct traversal *t, struct atto_expression *e)
+{
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (uses_list_head_only(t, ie->condition_expression, 0) &&
+            is_producing_step(t, ie->true_evaluation_expression) &&
+            is_producing_step(t, ie->false_evaluation_expression));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+
+    if ((strcmp(ae->identifier, "cons") == 0) && (ae->number_of_parameters == 2)) {
+      return (uses_list_head_only(t, ae->parameters[0], 0) &&
+              is_recursive_call(t, ae->parameters[1]));
+    }
+
+    return is_recursive_call(t, e);
+  }
+
+  default:
+    return 0;
+  }
+}
+
+static int is_producer(struct traversal *t)
+{
+  return ((t->null_case->kind == ATTO_EXPRESSION_KIND_LIST_LITERAL) &&
+          (t->null_case->container.list_literal_expression->number_of_elements == 0) &&
+          is_producing_step(t, t->step));
+}
+
+/*
+ *  a consumer walking the list built by a producer is replaced by a single
+ *  walk over the list the producer was given, whose parameters are those of
+ *  the consumer followed by those of the producer, and then the list
+ */
+struct fusion {
+  struct traversal *consumer;
+  struct traversal *producer;
+  char *name;
+
+  /*  what the head of the list seen by the consumer stands for */
+  struct atto_expression *element;
+};
+
+#define ATTO_FUSION_LIST_NAME "%ys"
+
+static void fused_parameter_name(struct fusion *f, struct traversal *t, uint32_t i, char *name)
+{
+  if (i == t->list_index) {
+    strcpy(name, ATTO_FUSION_LIST_NAME);
+  } else {
+    sprintf(name, "%%%c%lu", (t == f->consumer) ? 'c' : 'p', (unsigned long)i);
+  }
+}
+
+/*
+ *  builds the call which continues the fused walk with the rest of the list
+ */
+static struct atto_expression *make_fused_call(struct fusion *f, struct atto_expression *list)
+{
+  struct traversal *sides[2];
+  struct atto_expression *e = make_application(f->name,
+    f->consumer->le->number_of_parameters + f->producer->le->number_of_parameters - 1);
+  struct atto_application_expression *ae = e->container.application_expression;
+  char name[32];
+  uint32_t i, j, k = 0;
+
+  sides[0] = f->consumer;
+  sides[1] = f->producer;
+
+  for (j = 0; j < 2; j++) {
+    for (i = 0; i < sides[j]->le->number_of_parameters; i++) {
+      if (i != sides[j]->list_index) {
+        fused_parameter_name(f, sides[j], i, name);
+        ae->parameters[k++] = make_reference(name);
+      }
+    }
+  }
+
+  ae->parameters[k] = list;
+
+  return e;
+}
+
+static struct atto_expression *make_fused_tail(void)
+{
+  struct atto_expression *e = make_application("cdr", 1);
+  e->container.application_expression->parameters[0] = make_reference(ATTO_FUSION_LIST_NAME);
+
+  return e;
+}
+
+/*
+ *  copies a part of a traversal into the fused lambda, renaming parameters,
+ *  continuing the walk through the fused lambda, and, in the consumer,
+ *  replacing the head of the list with the element it stands for
+ */
+static struct atto_expression *rewrite_traversal(struct fusion *f, struct traversal *t,
+  struct atto_expression *e)
+{
+  struct atto_expression *copy = NULL;
+  char name[32];
+  uint32_t i;
+  int index;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    index = parameter_index(t->le, e->container.reference_identifier);
+    if (index < 0) {
+      return copy_expression(e);
+    }
+    fused_parameter_name(f, t, (uint32_t)index, name);
+    return make_reference(name);
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle;
+    copy = copy_expression(e);
+    lle = copy->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      destroy_expression(lle->elements[i]);
+      lle->elements[i] = rewrite_traversal(f, t, e->container.list_literal_expression->elements[i]);
+    }
+    return copy;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return make_if(rewrite_traversal(f, t, ie->condition_expression),
+                   rewrite_traversal(f, t, ie->true_evaluation_expression),
+                   rewrite_traversal(f, t, ie->false_evaluation_expression));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae;
+
+    if ((t == f->consumer) && is_list_head(t, e)) {
+      return copy_expression(f->element);
+    }
+
+    if (is_recursive_call(t, e)) {
+      return make_fused_call(f, make_fused_tail());
+    }
+
+    copy = copy_expression(e);
+    ae = copy->container.application_expression;
+
+    index = parameter_index(t->le, ae->identifier);
+    if (index >= 0) {
+      fused_parameter_name(f, t, (uint32_t)index, name);
+      free(ae->identifier);
+      ae->identifier = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+      assert(ae->identifier != NULL);
+      strcpy(ae->identifier, name);
+    }
+
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      destroy_expression(ae->parameters[i]);
+      ae->parameters[i] = rewrite_traversal(f, t, e->container.application_expression->parameters[i]);
+    }
+    return copy;
+  }
+
+  default:
+    return copy_expression(e);
+  }
+}
+
+/*
+ *  rewrites the step of the producer: wherever it would cons an element,
+ *  the consumer's step takes over with that element as the head of its
+ *  list, and wherever it would skip one, the fused walk simply goes on
+ */
+static struct atto_expression *rewrite_producing_step(struct fusion *f, struct atto_expression *e)
+{
+  struct atto_expression *result = NULL;
+
+  if (e->kind == ATTO_EXPRESSION_KIND_IF) {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return make_if(rewrite_traversal(f, f->producer, ie->condition_expression),
+                   rewrite_producing_step(f, ie->true_evaluation_expression),
+                   rewrite_producing_step(f, ie->false_evaluation_expression));
+  }
+
+  if (is_recursive_call(f->producer, e)) {
+    return make_fused_call(f, make_fused_tail());
+  }
+
+  f->element = rewrite_traversal(f, f->producer, e->container.application_expression->parameters[0]);
+  result = rewrite_traversal(f, f->consumer, f->consumer->step);
+  destroy_expression(f->element);
+  f->element = NULL;
+
+  return result;
+}
+
+/*
+ *  defines the lambda which walks the list once in place of a consumer and
+ *  a producer, unless an identical one has been defined before
+ */
+static void define_fused_traversal(struct atto_state *a, struct fusion *f)
+{
+  struct atto_lambda_expression *le = NULL;
+  struct atto_expression *test = NULL;
+  char name[32];
+  uint32_t i, j, k = 0;
+
+  if (atto_find_in_environment(a->global_environment, f->name) != NULL) {
+    return;
+  }
+
+  le = (struct atto_lambda_expression *)malloc(sizeof(struct atto_lambda_expression));
+  assert(le != NULL);
+
+  le->number_of_parameters = f->consumer->le->number_of_parameters + f->producer->le->number_of_parameters - 1;
+  le->parameter_names = (char **)malloc(sizeof(char *) * le->number_of_parameters);
+  assert(le->parameter_names != NULL);
+
+  for (j = 0; j < 2; j++) {
+    struct traversal *t = (j == 0) ? f->consumer : f->producer;
+    for (i = 0; i < t->le->number_of_parameters; i++) {
+      if (i != t->list_index) {
+        fused_parameter_name(f, t, i, name);
+        le->parameter_names[k] = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+        assert(le->parameter_names[k] != NULL);
+        strcpy(le->parameter_names[k], name);
+        k++;
+      }
+    }
+  }
+
+  le->parameter_names[k] = (char *)malloc(sizeof(char) * (strlen(ATTO_FUSION_LIST_NAME) + 1));
+  assert(le->parameter_names[k] != NULL);
+  strcpy(le->parameter_names[k], ATTO_FUSION_LIST_NAME);
+
+  test = make_application("null", 1);
+  test->container.application_expression->parameters[0] = make_reference(ATTO_FUSION_LIST_NAME);
+
+  le->body = make_if(test,
+    rewrite_traversal(f, f->consumer, f->consumer->null_case),
+    rewrite_producing_step(f, f->producer->step));
+
+  define_generated_lambda(a, f->name, le);
+}
+
+/*
+ *  replaces a consumer applied to the result of a producer with a call of
+ *  a lambda which does the work of both in a single walk, without building
+ *  the intermediate list
+ */
+static struct atto_expression *fuse_application(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, const char *defined_name)
+{
+  struct atto_application_expression *ae = e->container.application_expression;
+  struct atto_application_expression *inner = NULL;
+  struct atto_expression *result = NULL;
+  struct traversal consumer, producer;
+  struct fusion f;
+  char name[64];
+  uint32_t i, k = 0;
+
+  if (is_builtin_function(ae->identifier) ||
+      !recognize_traversal(env, ae->identifier, &consumer) ||
+      (ae->number_of_parameters != consumer.le->number_of_parameters) ||
+      (ae->parameters[consumer.list_index]->kind != ATTO_EXPRESSION_KIND_APPLICATION)) {
+    return e;
+  }
+
+  inner = ae->parameters[consumer.list_index]->container.application_expression;
+  if (is_builtin_function(inner->identifier) ||
+      !recognize_traversal(env, inner->identifier, &producer) ||
+      (inner->number_of_parameters != producer.le->number_of_parameters) ||
+      !is_producer(&producer)) {
+    return e;
+  }
+
+  /*  a definition may refer to the name it is defining, which does not yet
+   *  mean what the environment says it does */
+  if ((defined_name != NULL) &&
+      ((strcmp(ae->identifier, defined_name) == 0) || (strcmp(inner->identifier, defined_name) == 0))) {
+    return e;
+  }
+
+  /*  globals are never moved on the stack, so their offsets tell apart
+   *  every pair of traversals ever fused */
+  sprintf(name, "%%fuse%lu-%lu", (unsigned long)consumer.eo->offset, (unsigned long)producer.eo->offset);
+
+  f.consumer = &consumer;
+  f.producer = &producer;
+  f.name = name;
+  f.element = NULL;
+
+  define_fused_traversal(a, &f);
+
+  result = make_application(name, ae->number_of_parameters + inner->number_of_parameters - 1);
+
+  for (i = 0; i < ae->number_of_parameters; i++) {
+    if (i != consumer.list_index) {
+      result->container.application_expression->parameters[k++] = detach(&ae->parameters[i]);
+    }
+  }
+
+  for (i = 0; i < inner->number_of_parameters; i++) {
+    if (i != producer.list_index) {
+      result->container.application_expression->parameters[k++] = detach(&inner->parameters[i]);
+    }
+  }
+
+  result->container.application_expression->parameters[k] = detach(&inner->parameters[producer.list_index]);
+
+  destroy_expression(e);
+
+  return result;
+}
+
+/*
+ *  fuses chains of list traversals throughout an expression, innermost
+ *  first, so that every link of a longer chain is fused into the next one;
+ *  `defined_name' is the name of the definition being compiled, if any
+ */
+struct atto_expression *atto_fuse_traversals(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, const char *defined_name)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      lle->elements[i] = atto_fuse_traversals(a, env, lle->elements[i], defined_name);
+    }
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    ie->condition_expression        = atto_fuse_traversals(a, env, ie->condition_expression, defined_name);
+    ie->true_evaluation_expression  = atto_fuse_traversals(a, env, ie->true_evaluation_expression, defined_name);
+    ie->false_evaluation_expression = atto_fuse_traversals(a, env, ie->false_evaluation_expression, defined_name);
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      ae->parameters[i] = atto_fuse_traversals(a, env, ae->parameters[i], defined_name);
+    }
+    return fuse_application(a, env, e, defined_name);
+  }
+
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+    struct atto_environment *local_env = atto_allocate_environment(env);
+
+    for (i = 0; i < le->number_of_parameters; i++) {
+      atto_add_to_environment(local_env, le->parameter_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_ARGUMENT, i);
+    }
+
+    le->body = atto_fuse_traversals(a, local_env, le->body, defined_name);
+
+    atto_destroy_environment(local_env);
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    struct atto_environment *local_env = atto_allocate_environment(env);
+
+    for (i = 0; i < le->number_of_bindings; i++) {
+      le->binding_expressions[i] = atto_fuse_traversals(a, le->sequential ? local_env : env, le->binding_expressions[i], defined_name);
+      atto_add_to_environment(local_env, le->binding_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_LOCAL, i);
+    }
+
+    le->body = atto_fuse_traversals(a, local_env, le->body, defined_name);
+
+    atto_destroy_environment(local_env);
+    return e;
+  }
+
+  default:
+    return e;
+  }
+}
+
+static int is_constant(struct atto_expression *e)
+{
+  return ((e->kind == ATTO_EXPRESSION_KIND_NUMBER_LITERAL) ||
+          (e->kind == ATTO_EXPRESSION_KIND_SYMBOL_LITERAL));
+}
+
+/*
+ *  returns whether every recursive call of a lambda passes one of its
+ *  parameters along unchanged; only such parameters are specialized, so
+ *  that recursion does not specialize the lambda once for every value the
+ *  parameter takes
+ */
+static int is_invariant_parameter(struct atto_expression *e, const char *self, struct atto_lambda_expression *le, uint32_t index)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      if (!is_invariant_parameter(lle->elements[i], self, le, index)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (is_invariant_parameter(ie->condition_expression, self, le, index) &&
+            is_invariant_parameter(ie->true_evaluation_expression, self, le, index) &&
+            is_invariant_parameter(ie->false_evaluation_expression, self, le, index));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+
+    if (strcmp(ae->identifier, self) == 0) {
+      struct atto_expression *p = NULL;
+
+      if (ae->number_of_parameters != le->number_of_parameters) {
+        return 0;
+      }
+
+      p = ae->parameters[index];
+      if ((p->kind != ATTO_EXPRESSION_KIND_REFERENCE) ||
+          (strcmp(p->container.reference_identifier, le->parameter_names[index]) != 0)) {
+        return 0;
+      }
+    }
+
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      if (!is_invariant_parameter(ae->parameters[i], self, le, index)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *lete = e->container.let_expression;
+    for (i = 0; i < lete->number_of_bindings; i++) {
+      if (!is_invariant_parameter(lete->binding_expressions[i], self, le, index)) {
+        return 0;
+      }
+    }
+    return is_invariant_parameter(lete->body, self, le, index);
+  }
+
+  default:
+    return 1;
+  }
+}
+
+/*
+ *  names a specialization after the lambda and the constants it has been
+ *  specialized for; since lambdas are told apart by their place on the
+ *  stack, equal names mean equal specializations, and the global of that
+ *  name serves as the cache of the compiled specialization
+ */
+static char *specialization_name(struct atto_environment_object *eo, struct atto_expression **arguments,
+  uint8_t *constant, uint32_t number_of_parameters)
+{
+  char *name = (char *)malloc(sizeof(char) * (32 + 32 * number_of_parameters));
+  char *current = name;
+  uint32_t i;
+  assert(name != NULL);
+
+  current += sprintf(current, "%%spec%lu", (unsigned long)eo->offset);
+
+  for (i = 0; i < number_of_parameters; i++) {
+    if (!constant[i]) {
+      current += sprintf(current, "-_");
+    } else if (arguments[i]->kind == ATTO_EXPRESSION_KIND_NUMBER_LITERAL) {
+      current += sprintf(current, "-n%.17g", arguments[i]->container.number_literal);
+    } else {
+      current += sprintf(current, "-s%lu", (unsigned long)arguments[i]->container.symbol_literal);
+    }
+  }
+
+  return name;
+}
+
+/*
+ *  clones a lambda with its constant parameters replaced by the constants,
+ *  leaving it to the optimizer to simplify the clone once it is compiled
+ */
+static void define_specialization(struct atto_state *a, const char *name, struct atto_lambda_expression *le,
+  struct atto_expression **arguments, uint8_t *constant)
+{
+  struct atto_lambda_expression *sle = (struct atto_lambda_expression *)malloc(sizeof(struct atto_lambda_expression));
+  struct atto_expression **replacements = (struct atto_expression **)malloc(sizeof(struct atto_expression *) * le->number_of_parameters);
+  uint32_t i, k = 0;
+  assert(sle != NULL);
+  assert(replacements != NULL);
+
+  sle->number_of_parameters = 0;
+  for (i = 0; i < le->number_of_parameters; i++) {
+    if (!constant[i]) {
+      sle->number_of_parameters++;
+    }
+  }
+
+  sle->parameter_names = (char **)malloc(sizeof(char *) * (sle->number_of_parameters + 1));
+  assert(sle->parameter_names != NULL);
+
+  for (i = 0; i < le->number_of_parameters; i++) {
+    if (constant[i]) {
+      replacements[i] = copy_expression(arguments[i]);
+    } else {
+      replacements[i] = make_reference(le->parameter_names[i]);
+
+      sle->parameter_names[k] = (char *)malloc(sizeof(char) * (strlen(le->parameter_names[i]) + 1));
+      assert(sle->parameter_names[k] != NULL);
+      strcpy(sle->parameter_names[k], le->parameter_names[i]);
+      k++;
+    }
+  }
+
+  sle->body = substitute(le->body, le, replacements);
+
+  for (i = 0; i < le->number_of_parameters; i++) {
+    destroy_expression(replacements[i]);
+  }
+  free(replacements);
+
+  a->specialization_depth++;
+  define_generated_lambda(a, name, sle);
+  a->specialization_depth--;
+}
+
+/*
+ *  redirects a call of a global lambda with some constant arguments to a
+ *  version of the lambda specialized for those constants
+ */
+static struct atto_expression *specialize_application(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, const char *defined_name)
+{
+  struct atto_application_expression *ae = e->container.application_expression;
+  struct atto_environment_object *eo = NULL;
+  struct atto_lambda_expression *le = NULL;
+  struct atto_expression *result = NULL;
+  uint8_t *constant = NULL;
+  char *name = NULL;
+  uint32_t i, k = 0, number_of_constants = 0;
+
+  if (is_builtin_function(ae->identifier)) {
+    return e;
+  }
+
+  eo = atto_find_in_environment(env, ae->identifier);
+  if ((eo == NULL) ||
+      (eo->kind != ATTO_ENVIRONMENT_OBJECT_KIND_GLOBAL) ||
+      (eo->expression == NULL)) {
+    return e;
+  }
+
+  le = eo->expression->container.lambda_expression;
+  if ((le->number_of_parameters != ae->number_of_parameters) ||
+      (atto_expression_cost(le->body) > a->specialization_size_limit)) {
+    return e;
+  }
+
+  /*  parameters which are called need the name of a function, not a
+   *  constant */
+  constant = (uint8_t *)malloc(sizeof(uint8_t) * (le->number_of_parameters + 1));
+  assert(constant != NULL);
+
+  for (i = 0; i < le->number_of_parameters; i++) {
+    size_t as_callee = 0;
+
+    constant[i] = (is_constant(ae->parameters[i]) &&
+                   (count_uses(le->body, le->parameter_names[i], &as_callee) > 0) &&
+                   (as_callee == 0) &&
+                   is_invariant_parameter(le->body, eo->name, le, i));
+
+    if (constant[i]) {
+      number_of_constants++;
+    }
+  }
+
+  /*  calls made only of constants would get a lambda of their own which
+   *  does the same work every time it is called, so they are left alone */
+  if ((number_of_constants == 0) || (number_of_constants == le->number_of_parameters)) {
+    free(constant);
+    return e;
+  }
+
+  name = specialization_name(eo, ae->parameters, constant, le->number_of_parameters);
+
+  /*  a specialization calling itself with the same constants is redirected
+   *  to itself, even though it is not yet defined; a lambda calling itself
+   *  is only specialized once it is */
+  if ((defined_name == NULL) || (strcmp(name, defined_name) != 0)) {
+    if (((defined_name != NULL) && (strcmp(ae->identifier, defined_name) == 0)) ||
+        ((atto_find_in_environment(a->global_environment, name) == NULL) &&
+         ((a->specialization_depth >= a->specialization_depth_limit) ||
+          !is_movable(env, eo, le, NULL, le->body)))) {
+      free(constant);
+      free(name);
+      return e;
+    }
+
+    if (atto_find_in_environment(a->global_environment, name) == NULL) {
+      define_specialization(a, name, le, ae->parameters, constant);
+    }
+  }
+
+  result = make_application(name, ae->number_of_parameters - number_of_constants);
+  for (i = 0; i < ae->number_of_parameters; i++) {
+    if (!constant[i]) {
+      result->container.application_expression->parameters[k++] = detach(&ae->parameters[i]);
+    }
+  }
+
+  destroy_expression(e);
+  free(constant);
+  free(name);
+
+  return result;
+}
+
+/*
+ *  specializes calls with constant arguments throughout an expression;
+ *  `defined_name' is the name of the definition being compiled, if any
+ */
+struct atto_expression *atto_specialize_applications(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, const char *defined_name)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      lle->elements[i] = atto_specialize_applications(a, env, lle->elements[i], defined_name);
+    }
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    ie->condition_expression        = atto_specialize_applications(a, env, ie->condition_expression, defined_name);
+    ie->true_evaluation_expression  = atto_specialize_applications(a, env, ie->true_evaluation_expression, defined_name);
+    ie->false_evaluation_expression = atto_specialize_applications(a, env, ie->false_evaluation_expression, defined_name);
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      ae->parameters[i] = atto_specialize_applications(a, env, ae->parameters[i], defined_name);
+    }
+    return specialize_application(a, env, e, defined_name);
+  }
+
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+    struct atto_environment *local_env = atto_allocate_environment(env);
+
+    for (i = 0; i < le->number_of_parameters; i++) {
+      atto_add_to_environment(local_env, le->parameter_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_ARGUMENT, i);
+    }
+
+    le->body = atto_specialize_applications(a, local_env, le->body, defined_name);
+
+    atto_destroy_environment(local_env);
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    struct atto_environment *local_env = atto_allocate_environment(env);
+
+    for (i = 0; i < le->number_of_bindings; i++) {
+      le->binding_expressions[i] = atto_specialize_applications(a, le->sequential ? local_env : env, le->binding_expressions[i], defined_name);
+      atto_add_to_environment(local_env, le->binding_names[i], ATTO_ENVIRONMENT_OBJECT_KIND_LOCAL, i);
+    }
+
+    le->body = atto_specialize_applications(a, local_env, le->body, defined_name);
+
+    atto_destroy_environment(local_env);
+    return e;
+  }
+
+  default:
+    return e;
+  }
+}
+
+/*
+ *  a subexpression which might be computed more than once, along with the
+ *  number of times it is certain to be computed whenever its region is
+ */
+struct cse_candidate {
+  uint32_t hash;
+  struct atto_expression *e;
+  size_t count;
+};
+
+struct cse_table {
+  size_t length;
+  size_t allocated_length;
+  struct cse_candidate *candidates;
+};
+
+static uint32_t hash_string(uint32_t hash, const char *string)
+{
+  return atto_hash_bytes(hash, string, strlen(string) + 1);
+}
+
+/*
+ *  hashes the structure of an expression, so that identical subexpressions
+ *  can be found without comparing each pair of them
+ */
+static uint32_t hash_expression(struct atto_expression *e)
+{
+  uint32_t hash = atto_hash_bytes(ATTO_HASH_SEED, &e->kind, sizeof(e->kind));
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+    return atto_hash_bytes(hash, &e->container.number_literal, sizeof(double));
+
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    return atto_hash_bytes(hash, &e->container.symbol_literal, sizeof(uint64_t));
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    return hash_string(hash, e->container.reference_identifier);
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      uint32_t element_hash = hash_expression(lle->elements[i]);
+      hash = atto_hash_bytes(hash, &element_hash, sizeof(uint32_t));
+    }
+    return hash;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    uint32_t hashes[3];
+    hashes[0] = hash_expression(ie->condition_expression);
+    hashes[1] = hash_expression(ie->true_evaluation_expression);
+    hashes[2] = hash_expression(ie->false_evaluation_expression);
+    return atto_hash_bytes(hash, hashes, sizeof(hashes));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    hash = hash_string(hash, ae->identifier);
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      uint32_t parameter_hash = hash_expression(ae->parameters[i]);
+      hash = atto_hash_bytes(hash, &parameter_hash, sizeof(uint32_t));
+    }
+    return hash;
+  }
+
+  default:
+    return hash;
+  }
+}
+
+/*
+ *  compares the structure of two expressions; lambdas and let expressions
+ *  are never considered equal, since they are never candidates
+ */
+static int expressions_equal(struct atto_expression *x, struct atto_expression *y)
+{
+  uint32_t i;
+
+  if (x->kind != y->kind) {
+    return 0;
+  }
+
+  switch (x->kind) {
+
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+    return (x->container.number_literal == y->container.number_literal);
+
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    return (x->container.symbol_literal == y->container.symbol_literal);
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    return (strcmp(x->container.reference_identifier, y->container.reference_identifier) == 0);
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *xl = x->container.list_literal_expression,
+                                        *yl = y->container.list_literal_expression;
+    if (xl->number_of_elements != yl->number_of_elements) {
+      return 0;
+    }
+    for (i = 0; i < xl->number_of_elements; i++) {
+      if (!expressions_equal(xl->elements[i], yl->elements[i])) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *xi = x->container.if_expression,
+                              *yi = y->container.if_expression;
+    return (expressions_equal(xi->condition_expression, yi->condition_expression) &&
+            expressions_equal(xi->true_evaluation_expression, yi->true_evaluation_expression) &&
+            expressions_equal(xi->false_evaluation_expression, yi->false_evaluation_expression));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *xa = x->container.application_expression,
+                                       *ya = y->container.application_expression;
+    if ((strcmp(xa->identifier, ya->identifier) != 0) ||
+        (xa->number_of_parameters != ya->number_of_parameters)) {
+      return 0;
+    }
+    for (i = 0; i < xa->number_of_parameters; i++) {
+      if (!expressions_equal(xa->parameters[i], ya->parameters[i])) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  returns whether an expression may be computed once and reused: it must
+ *  be a call, must not contain expressions which introduce names, and must
+ *  not refer to any name bound inside the region, so that it means the same
+ *  thing at the root of the region
+ */
+static int is_cse_candidate_part(struct atto_expression *e, struct bound_name *bound)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    return 1;
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    return !is_bound(bound, e->container.reference_identifier);
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      if (!is_cse_candidate_part(lle->elements[i], bound)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (is_cse_candidate_part(ie->condition_expression, bound) &&
+            is_cse_candidate_part(ie->true_evaluation_expression, bound) &&
+            is_cse_candidate_part(ie->false_evaluation_expression, bound));
+  }
+
+  /*  native functions which are not flagged as pure may give different
+   *  results every time, so their applications are never shared */
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    const struct atto_builtin *b = atto_find_builtin(ae->identifier);
+    if (is_bound(bound, ae->identifier) || ((b != NULL) && !(b->flags & ATTO_BUILTIN_FLAG_PURE))) {
+      return 0;
+    }
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      if (!is_cse_candidate_part(ae->parameters[i], bound)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+static void add_cse_candidate(struct cse_table *t, struct atto_expression *e, uint32_t hash, size_t count)
+{
+  size_t i;
+
+  for (i = 0; i < t->length; i++) {
+    if ((t->candidates[i].hash == hash) && expressions_equal(t->candidates[i].e, e)) {
+      t->candidates[i].count += count;
+      return;
+    }
+  }
+
+  if (t->length == t->allocated_length) {
+    t->allocated_length = t->allocated_length ? t->allocated_length * 2 : 16;
+    t->candidates = realloc(t->candidates, sizeof(struct cse_candidate) * t->allocated_length);
+    assert(t->candidates != NULL);
+  }
+
+  t->candidates[t->length].hash = hash;
+  t->candidates[t->length].e = e;
+  t->candidates[t->length].count = count;
+  t->length++;
+}
+
+static size_t find_cse_candidate(struct cse_table *t, struct cse_candidate *c)
+{
+  size_t i;
+
+  for (i = 0; i < t->length; i++) {
+    if ((t->candidates[i].hash == c->hash) && expressions_equal(t->candidates[i].e, c->e)) {
+      return t->candidates[i].count;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ *  counts the candidates which are computed every time an expression is;
+ *  a subexpression of an `if' branch only counts if the other branch
+ *  computes it as well, so that nothing is ever computed on a path which
+ *  did not compute it before, and nested lambdas are left for later, since
+ *  their bodies are regions of their own
+ */
+static void collect_cse_candidates(struct cse_table *t, struct atto_expression *e, struct bound_name *bound)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      collect_cse_candidates(t, lle->elements[i], bound);
+    }
+    return;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    struct cse_table true_table  = { 0, 0, NULL },
+                     false_table = { 0, 0, NULL };
+    size_t j;
+
+    collect_cse_candidates(t, ie->condition_expression, bound);
+    collect_cse_candidates(&true_table, ie->true_evaluation_expression, bound);
+    collect_cse_candidates(&false_table, ie->false_evaluation_expression, bound);
+
+    for (j = 0; j < true_table.length; j++) {
+      size_t false_count = find_cse_candidate(&false_table, &true_table.candidates[j]);
+      size_t true_count = true_table.candidates[j].count;
+
+      if (false_count > 0) {
+        add_cse_candidate(t, true_table.candidates[j].e, true_table.candidates[j].hash,
+          (true_count < false_count) ? true_count : false_count);
+      }
+    }
+
+    free(true_table.candidates);
+    free(false_table.candidates);
+    return;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      collect_cse_candidates(t, ae->parameters[i], bound);
+    }
+    if (is_cse_candidate_part(e, bound)) {
+      add_cse_candidate(t, e, hash_expression(e), 1);
+    }
+    return;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    struct bound_name *names = (struct bound_name *)malloc(sizeof(struct bound_name) * (le->number_of_bindings + 1));
+    struct bound_name *inner = bound;
+    assert(names != NULL);
+
+    for (i = 0; i < le->number_of_bindings; i++) {
+      collect_cse_candidates(t, le->binding_expressions[i], le->sequential ? inner : bound);
+      names[i].name = le->binding_names[i];
+      names[i].next = inner;
+      inner = &names[i];
+    }
+
+    collect_cse_candidates(t, le->body, inner);
+
+    free(names);
+    return;
+  }
+
+  default:
+    return;
+  }
+}
+
+static int refers_to(struct atto_expression *e, const char *name)
+{
+  size_t as_callee = 0;
+  return (count_uses(e, name, &as_callee) > 0);
+}
+
+/*
+ *  replaces every occurrence of a candidate with a reference to the name its
+ *  value is bound to, as long as the names it refers to are not shadowed
+ */
+static struct atto_expression *replace_cse_candidate(struct atto_expression *e,
+  struct atto_expression *candidate, uint32_t hash, const char *name)
+{
+  uint32_t i;
+
+  if ((e->kind == ATTO_EXPRESSION_KIND_APPLICATION) &&
+      (hash_expression(e) == hash) && expressions_equal(e, candidate)) {
+    destroy_expression(e);
+    return make_reference(name);
+  }
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      lle->elements[i] = replace_cse_candidate(lle->elements[i], candidate, hash, name);
+    }
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    ie->condition_expression        = replace_cse_candidate(ie->condition_expression, candidate, hash, name);
+    ie->true_evaluation_expression  = replace_cse_candidate(ie->true_evaluation_expression, candidate, hash, name);
+    ie->false_evaluation_expression = replace_cse_candidate(ie->false_evaluation_expression, candidate, hash, name);
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      ae->parameters[i] = replace_cse_candidate(ae->parameters[i], candidate, hash, name);
+    }
+    return e;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    int shadowed = 0;
+
+    for (i = 0; i < le->number_of_bindings; i++) {
+      if (!(le->sequential && shadowed)) {
+        le->binding_expressions[i] = replace_cse_candidate(le->binding_expressions[i], candidate, hash, name);
+      }
+      if (refers_to(candidate, le->binding_names[i])) {
+        shadowed = 1;
+      }
+    }
+
+    if (!shadowed) {
+      le->body = replace_cse_candidate(le->body, candidate, hash, name);
+    }
+    return e;
+  }
+
+  default:
+    return e;
+  }
+}
+
+/*
+ *  returns whether a let expression within an expression binds a name
+ */
+static int binds_name(struct atto_expression *e, const char *name)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      if (binds_name(lle->elements[i], name)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    return (binds_name(ie->condition_expression, name) ||
+            binds_name(ie->true_evaluation_expression, name) ||
+            binds_name(ie->false_evaluation_expression, name));
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      if (binds_name(ae->parameters[i], name)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    for (i = 0; i < le->number_of_bindings; i++) {
+      if ((strcmp(le->binding_names[i], name) == 0) || binds_name(le->binding_expressions[i], name)) {
+        return 1;
+      }
+    }
+    return binds_name(le->body, name);
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/*
+ *  computes the candidate which saves the most work once, at the root of a
+ *  region, and reuses its value everywhere else in it; returns the region
+ *  unchanged if there is nothing to share
+ */
+static struct atto_expression *share_common_subexpression(struct atto_expression *region, size_t *counter)
+{
+  struct cse_table t = { 0, 0, NULL };
+  struct cse_candidate *best = NULL;
+  struct atto_expression *candidate = NULL, *result = NULL;
+  struct atto_let_expression *le = NULL;
+  char name[32];
+  size_t i;
+
+  collect_cse_candidates(&t, region, NULL);
+
+  for (i = 0; i < t.length; i++) {
+    if ((t.candidates[i].count > 1) &&
+        ((best == NULL) || (atto_expression_cost(t.candidates[i].e) > atto_expression_cost(best->e)))) {
+      best = &t.candidates[i];
+    }
+  }
+
+  if (best == NULL) {
+    free(t.candidates);
+    return region;
+  }
+
+  /*  the name cannot be written in source code, so it can only clash with
+   *  names given by this pass, such as those of inlined bodies */
+  do {
+    sprintf(name, "%%cse%lu", (unsigned long)*counter);
+    (*counter)++;
+  } while (binds_name(region, name));
+
+  candidate = copy_expression(best->e);
+  region = replace_cse_candidate(region, candidate, best->hash, name);
+  free(t.candidates);
+
+  le = (struct atto_let_expression *)malloc(sizeof(struct atto_let_expression));
+  assert(le != NULL);
+
+  le->number_of_bindings = 1;
+  le->sequential = 1;
+  le->binding_names = (char **)malloc(sizeof(char *));
+  assert(le->binding_names != NULL);
+  le->binding_names[0] = (char *)malloc(sizeof(char) * (strlen(name) + 1));
+  assert(le->binding_names[0] != NULL);
+  strcpy(le->binding_names[0], name);
+  le->binding_expressions = (struct atto_expression **)malloc(sizeof(struct atto_expression *));
+  assert(le->binding_expressions != NULL);
+  le->binding_expressions[0] = candidate;
+  le->body = region;
+
+  result = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  assert(result != NULL);
+  result->kind = ATTO_EXPRESSION_KIND_LET;
+  result->container.let_expression = le;
+
+  return result;
+}
+
+static struct atto_expression *eliminate_in_region(struct atto_expression *e, size_t *counter);
+
+/*
+ *  finds the regions nested in an expression: the bodies of lambdas, the
+ *  branches of `if's and the bodies of let expressions
+ */
+static void eliminate_in_subregions(struct atto_expression *e, int in_lambda, size_t *counter)
+{
+  uint32_t i;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    for (i = 0; i < lle->number_of_elements; i++) {
+      eliminate_in_subregions(lle->elements[i], in_lambda, counter);
+    }
+    return;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      eliminate_in_subregions(ae->parameters[i], in_lambda, counter);
+    }
+    return;
+  }
+
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+    le->body = eliminate_in_region(le->body, counter);
+    return;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    eliminate_in_subregions(ie->condition_expression, in_lambda, counter);
+    if (in_lambda) {
+      ie->true_evaluation_expression  = eliminate_in_region(ie->true_evaluation_expression, counter);
+      ie->false_evaluation_expression = eliminate_in_region(ie->false_evaluation_expression, counter);
+    } else {
+      eliminate_in_subregions(ie->true_evaluation_expression, in_lambda, counter);
+      eliminate_in_subregions(ie->false_evaluation_expression, in_lambda, counter);
+    }
+    return;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    for (i = 0; i < le->number_of_bindings; i++) {
+      eliminate_in_subregions(le->binding_expressions[i], in_lambda, counter);
+    }
+    if (in_lambda) {
+      le->body = eliminate_in_region(le->body, counter);
+    } else {
+      eliminate_in_subregions(le->body, in_lambda, counter);
+    }
+    return;
+  }
+
+  default:
+    return;
+  }
+}
+
+static struct atto_expression *eliminate_in_region(struct atto_expression *e, size_t *counter)
+{
+  struct atto_expression *shared = NULL;
+
+  while ((shared = share_common_subexpression(e, counter)) != e) {
+    e = shared;
+  }
+
+  eliminate_in_subregions(e, 1, counter);
+
+  return e;
+}
+
+/*
+ *  computes subexpressions which appear more than once in a lambda body
+ *  only once, binding their values to frame-local slots; since expressions
+ *  are pure, this changes nothing but the amount of work done
+ */
+struct atto_expression *atto_eliminate_common_subexpressions(struct atto_expression *e)
+{
+  size_t counter = 0;
+
+  eliminate_in_subregions(e, 0, &counter);
+
+  return e;
+}
+
+/*
+ *  runs the optimization passes over an expression about to be compiled in
+ *  a given environment, returning the expression which should be compiled
+ *  in its place
+ */
+struct atto_expression *atto_optimize_expression(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e)
+{
+  e = atto_inline_applications(a, env, e, 0);
+  e = atto_fold_constants(e);
+  e = atto_eliminate_common_subexpressions(e);
+
+  return e;
+}
+
@@ -0,0 +1,26 @@
+/*
+ *  optimizer.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include "state.h"
+#include "parser.h"
+
+#pragma once
+
+struct atto_expression *atto_optimize_expression(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e);
+
+struct atto_expression *atto_inline_applications(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, size_t depth);
+
+struct atto_expression *atto_fuse_traversals(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, const char *defined_name);
+
+struct atto_expression *atto_specialize_applications(struct atto_state *a, struct atto_environment *env,
+  struct atto_expression *e, const char *defined_name);
+
+struct atto_expression *atto_fold_constants(struct atto_expression *e);
+
+struct atto_expression *atto_eliminate_common_subexpressions(struct atto_expression *e);
+
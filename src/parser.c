@@ -13,129 +13,201 @@
 #include "parser.h"
 
 /*
- *  parses a token list and produces an abstract syntax tree based on it;
- *  a pointer to the first unconsumed token will be put in `left'
+ *  lists which are still being parsed are kept on an explicit stack, so
+ *  that deeply nested forms do not exhaust the C stack
  */
-struct atto_ast_node *atto_parse_token_list(struct atto_state *a, struct atto_token *root, struct atto_token **left)
+struct parse_frame {
+  struct atto_ast_node *first;
+  struct atto_ast_node *last;
+  struct atto_ast_node *list;
+};
+
+static void append_node(struct parse_frame *frame, struct atto_ast_node *node)
+{
+  if (frame->first == NULL) {
+    frame->first = node;
+  } else {
+    frame->last->next = node;
+  }
+
+  frame->last = node;
+}
+
+/*
+ *  parses a token array and produces an abstract syntax tree based on it,
+ *  starting with the token at `left', and stopping at the end of the
+ *  tokens, or at a closed paranthesis which closes no list; the index of
+ *  the first unconsumed token will be put in `left'. the nodes, and the
+ *  names they hold, are allocated from `arena', and released along with it.
+ *  if no state is given, symbols are not interned, but keep their names;
+ *  this way, forms may be parsed on several threads at once
+ */
+struct atto_ast_node *atto_parse_token_array(struct atto_state *a, struct atto_token_array *ta,
+  struct atto_arena *arena, size_t *left)
 {
-  struct atto_ast_node *ast_root     = NULL;
-  struct atto_ast_node *current_node = NULL;
-
-  *left = root;
-
-  while (*left) {
-    if ((*left)->kind == ATTO_TOKEN_OPEN_PAREN) {
-      struct atto_ast_node *temp = atto_parse_token_list(a, (*left)->next, left);
-      struct atto_ast_node *list = (struct atto_ast_node *)malloc(sizeof(struct atto_ast_node));
-      assert(list != NULL);
-
-      list->kind = ATTO_AST_NODE_LIST;
-      list->container.list = temp;
-      list->next = NULL;
-
-      if (ast_root == NULL) {
-        ast_root     = list;
-        current_node = list;
-      } else {
-        current_node->next = list;
-        current_node       = list;
+  size_t depth = 0, allocated_depth = ATTO_PARSER_MIN_STACK_DEPTH;
+  struct parse_frame *stack = (struct parse_frame *)malloc(sizeof(struct parse_frame) * allocated_depth);
+  struct atto_ast_node *ast_root = NULL;
+
+  assert(stack != NULL);
+
+  stack[0].first = NULL;
+  stack[0].last  = NULL;
+  stack[0].list  = NULL;
+
+  while (*left < ta->number_of_tokens) {
+    struct atto_token *t = &ta->tokens[*left];
+    struct atto_ast_node *temp = NULL;
+
+    *left += 1;
+
+    if (t->kind == ATTO_TOKEN_OPEN_PAREN) {
+      temp = (struct atto_ast_node *)atto_arena_allocate(arena, sizeof(struct atto_ast_node));
+
+      temp->kind = ATTO_AST_NODE_LIST;
+      temp->container.list = NULL;
+      temp->next = NULL;
+
+      append_node(&stack[depth], temp);
+
+      if (++depth == allocated_depth) {
+        allocated_depth *= 2;
+        stack = (struct parse_frame *)realloc(stack, sizeof(struct parse_frame) * allocated_depth);
+        assert(stack != NULL);
       }
 
+      stack[depth].first = NULL;
+      stack[depth].last  = NULL;
+      stack[depth].list  = temp;
+
       continue;
     }
 
-    if ((*left)->kind == ATTO_TOKEN_CLOSED_PAREN) {
-      *left = (*left)->next;
-      return ast_root;
+    if (t->kind == ATTO_TOKEN_CLOSED_PAREN) {
+      if (depth == 0) {
+        break;
+      }
+
+      stack[depth].list->container.list = stack[depth].first;
+      depth--;
+
+      continue;
     }
 
-    if ((*left)->kind == ATTO_TOKEN_IDENTIFIER) {
-      struct atto_ast_node *temp = (struct atto_ast_node *)malloc(sizeof(struct atto_ast_node));
-      assert(temp != NULL);
+    temp = (struct atto_ast_node *)atto_arena_allocate(arena, sizeof(struct atto_ast_node));
+    temp->next = NULL;
 
+    if (t->kind == ATTO_TOKEN_IDENTIFIER) {
       temp->kind = ATTO_AST_NODE_IDENTIFIER;
-      temp->container.identifier = (char *)malloc(sizeof(char) * (strlen((*left)->token) + 1));
-      strcpy(temp->container.identifier, (*left)->token);
-      temp->next = NULL;
-
-      if (ast_root == NULL) {
-        ast_root     = temp;
-        current_node = temp;
-      } else {
-        current_node->next = temp;
-        current_node       = temp;
-      }
+      temp->container.identifier = atto_arena_copy_string(arena, ta->source + t->offset, t->length);
     }
 
-    if ((*left)->kind == ATTO_TOKEN_NUMBER) {
-      struct atto_ast_node *temp = NULL;
+    /*  a number literal always ends before whitespace or a closed
+     *  paranthesis, so it can be read straight out of the source */
+    if (t->kind == ATTO_TOKEN_NUMBER) {
+      const char *text = ta->source + t->offset;
       char *endptr = NULL;
 
-      temp = (struct atto_ast_node *)malloc(sizeof(struct atto_ast_node));
-      assert(temp != NULL);
-
       temp->kind = ATTO_AST_NODE_NUMBER;
-      temp->container.number = strtod((*left)->token, &endptr);
-      temp->next = NULL;
+      temp->container.number = strtod(text, &endptr);
 
-      if ((*left)->token == endptr) {
+      if (text == endptr) {
         printf("syntax error: unable to parse number literal\n");
+        free(stack);
         return NULL;
       }
+    }
 
-      if (ast_root == NULL) {
-        ast_root     = temp;
-        current_node = temp;
-      } else {
-        current_node->next = temp;
-        current_node       = temp;
-      }
+    if ((t->kind == ATTO_TOKEN_SYMBOL) && (a == NULL)) {
+      temp->kind = ATTO_AST_NODE_SYMBOL_NAME;
+      temp->container.identifier = atto_arena_copy_string(arena, ta->source + t->offset, t->length);
+    } else if (t->kind == ATTO_TOKEN_SYMBOL) {
+      temp->kind = ATTO_AST_NODE_SYMBOL;
+      temp->container.symbol = atto_intern_symbol(a, ta->source + t->offset, t->length);
     }
 
-    if ((*left)->kind == ATTO_TOKEN_SYMBOL) {
-      struct atto_ast_node *temp = NULL;
-      uint64_t symbol = a->number_of_symbols;
+    append_node(&stack[depth], temp);
+  }
 
-      uint32_t i;
-      for (i = 0; i < a->number_of_symbols; i++) {
-        if (strcmp((*left)->token, a->symbol_names[i]) == 0) {
-          symbol = i;
-        }
-      }
+  /*  lists left open at the end of the tokens end there */
+  while (depth > 0) {
+    stack[depth].list->container.list = stack[depth].first;
+    depth--;
+  }
 
-      if (symbol == a->number_of_symbols) {
-        symbol = atto_save_symbol(a, (*left)->token);
-      }
+  ast_root = stack[0].first;
+  free(stack);
 
-      temp = (struct atto_ast_node *)malloc(sizeof(struct atto_ast_node));
-      assert(temp != NULL);
+  return ast_root;
+}
 
-      temp->kind = ATTO_AST_NODE_SYMBOL;
-      temp->container.symbol = symbol;
-      temp->next = NULL;
-      
-      if (ast_root == NULL) {
-        ast_root     = temp;
-        current_node = temp;
-      } else {
-        current_node->next = temp;
-        current_node       = temp;
-      }
+/*
+ *  interns the symbols of a tree which was parsed without a state, in the
+ *  order in which they were written
+ */
+void atto_intern_ast_symbols(struct atto_state *a, struct atto_ast_node *root)
+{
+  struct atto_ast_node *current = root;
+
+  while (current) {
+    if (current->kind == ATTO_AST_NODE_SYMBOL_NAME) {
+      uint64_t symbol = atto_intern_symbol(a, current->container.identifier, strlen(current->container.identifier));
+
+      current->kind = ATTO_AST_NODE_SYMBOL;
+      current->container.symbol = symbol;
     }
 
-    *left = (*left)->next;
+    if (current->kind == ATTO_AST_NODE_LIST) {
+      atto_intern_ast_symbols(a, current->container.list);
+    }
+
+    current = current->next;
   }
+}
 
-  return ast_root;
+/*
+ *  `let' also names the less-or-equal builtin, so `(let ...)' is only taken
+ *  as the let form when it has the shape of one: a list of bindings, each a
+ *  list of an identifier and an expression, followed by a single body.
+ *  anything else is an application of the builtin, as it always was
+ */
+static int is_let_form(struct atto_ast_node *head)
+{
+  struct atto_ast_node *binding = NULL;
+
+  if (strcmp(head->container.identifier, "let*") == 0) {
+    return 1;
+  }
+
+  if ((strcmp(head->container.identifier, "let") != 0) ||
+      (head->next == NULL) ||
+      (head->next->kind != ATTO_AST_NODE_LIST) ||
+      (head->next->next == NULL) ||
+      (head->next->next->next != NULL)) {
+    return 0;
+  }
+
+  for (binding = head->next->container.list; binding != NULL; binding = binding->next) {
+    if ((binding->kind != ATTO_AST_NODE_LIST) ||
+        (binding->container.list == NULL) ||
+        (binding->container.list->kind != ATTO_AST_NODE_IDENTIFIER) ||
+        (binding->container.list->next == NULL) ||
+        (binding->container.list->next->next != NULL)) {
+      return 0;
+    }
+  }
+
+  return 1;
 }
 
 /*
- *  parses an expression from its AST root node
+ *  parses an expression from its AST root node; returns NULL, having
+ *  reported why, if the expression or any part of it is not well formed
  *
  *  <expression> ::=  <number_literal> | <symbol_literal> |
  *                    <variable_reference> | <application_expression> |
  *                    <lambda_expression> | <if_expression> |
- *                    <list_literal_expression>
+ *                    <list_literal_expression> | <let_expression>
  */
 struct atto_expression *parse_expression(struct atto_ast_node *e)
 {
@@ -179,6 +251,12 @@ struct atto_expression *parse_expression(struct atto_ast_node *e)
   if (e->kind == ATTO_AST_NODE_LIST) {
     struct atto_ast_node *head = e->container.list;
 
+    if (head == NULL) {
+      printf("syntax error: empty expression\n");
+      free(expression);
+      return NULL;
+    }
+
     /*  if the first element of the list is an identifier, the expression can
      *  be either a function application, or, if the identifier is a keyword,
      *  the expression is a syntactic form */
@@ -189,6 +267,11 @@ struct atto_expression *parse_expression(struct atto_ast_node *e)
         expression->kind = ATTO_EXPRESSION_KIND_LAMBDA;
         expression->container.lambda_expression = parse_lambda_expression(head);
 
+        if (expression->container.lambda_expression == NULL) {
+          free(expression);
+          return NULL;
+        }
+
         return expression;
       }
 
@@ -197,6 +280,24 @@ struct atto_expression *parse_expression(struct atto_ast_node *e)
         expression->kind = ATTO_EXPRESSION_KIND_IF;
         expression->container.if_expression = parse_if_expression(head);
 
+        if (expression->container.if_expression == NULL) {
+          free(expression);
+          return NULL;
+        }
+
+        return expression;
+      }
+
+      /*  let expression */
+      if (is_let_form(head)) {
+        expression->kind = ATTO_EXPRESSION_KIND_LET;
+        expression->container.let_expression = parse_let_expression(head);
+
+        if (expression->container.let_expression == NULL) {
+          free(expression);
+          return NULL;
+        }
+
         return expression;
       }
 
@@ -205,6 +306,11 @@ struct atto_expression *parse_expression(struct atto_ast_node *e)
         expression->kind = ATTO_EXPRESSION_KIND_LIST_LITERAL;
         expression->container.list_literal_expression = parse_list_literal_expression(head);
 
+        if (expression->container.list_literal_expression == NULL) {
+          free(expression);
+          return NULL;
+        }
+
         return expression;
       }
 
@@ -213,6 +319,11 @@ struct atto_expression *parse_expression(struct atto_ast_node *e)
       expression->kind = ATTO_EXPRESSION_KIND_APPLICATION;
       expression->container.application_expression = parse_application_expression(head);
 
+      if (expression->container.application_expression == NULL) {
+        free(expression);
+        return NULL;
+      }
+
       return expression;
     }
 
@@ -223,15 +334,18 @@ struct atto_expression *parse_expression(struct atto_ast_node *e)
       struct atto_lambda_expression *child_lambda_expression = NULL;
 
       /*  the list must represent a valid lambda expression */
-      if ((child->kind != ATTO_AST_NODE_IDENTIFIER) ||
+      if ((child == NULL) ||
+          (child->kind != ATTO_AST_NODE_IDENTIFIER) ||
           (strcmp(child->container.identifier, "lambda") != 0)) {
         printf("syntax error: invalid expression in anonymous function application\n");
+        free(expression);
         return NULL;
       }
 
       child_lambda_expression = parse_lambda_expression(child);
       if (child_lambda_expression == NULL) {
         printf("syntax error: invalid expression in anonymous function application\n");
+        free(expression);
         return NULL;
       }
 
@@ -245,11 +359,14 @@ struct atto_expression *parse_expression(struct atto_ast_node *e)
      *  list literals must be expresses through the `list' syntactic form */ 
     if (head->kind == ATTO_AST_NODE_NUMBER) {
       printf("syntax error: invalid expression; for quoted lists use the `list' form\n");
+      free(expression);
       return NULL;
     }
   }
 
-  /*  this point should be unreachable */
+  /*  lists starting with a symbol are not expressions */
+  printf("syntax error: invalid expression\n");
+  free(expression);
   return NULL;
 }
 
@@ -292,6 +409,15 @@ struct atto_if_expression *parse_if_expression(struct atto_ast_node *head)
   true_evaluation_expression  = parse_expression(true_branch);
   false_evaluation_expression = parse_expression(false_branch);
 
+  if ((condition_expression == NULL) ||
+      (true_evaluation_expression == NULL) ||
+      (false_evaluation_expression == NULL)) {
+    destroy_expression(condition_expression);
+    destroy_expression(true_evaluation_expression);
+    destroy_expression(false_evaluation_expression);
+    return NULL;
+  }
+
   if_expression = (struct atto_if_expression *)malloc(sizeof(struct atto_if_expression));
 
   if_expression->condition_expression        = condition_expression;
@@ -347,6 +473,17 @@ struct atto_application_expression *parse_application_expression(struct atto_ast
   while (current) {
     application_expression->parameters[current_parameter_index] = parse_expression(current);
 
+    if (application_expression->parameters[current_parameter_index] == NULL) {
+      while (current_parameter_index--) {
+        destroy_expression(application_expression->parameters[current_parameter_index]);
+      }
+
+      free(application_expression->parameters);
+      free(application_expression->identifier);
+      free(application_expression);
+      return NULL;
+    }
+
     current_parameter_index++;
     current = current->next;
   }
@@ -384,7 +521,17 @@ struct atto_list_literal_expression *parse_list_literal_expression(struct atto_a
   current = head->next;
   while (current) {
     list_literal_expression->elements[current_element_index] = parse_expression(current);
-    
+
+    if (list_literal_expression->elements[current_element_index] == NULL) {
+      while (current_element_index--) {
+        destroy_expression(list_literal_expression->elements[current_element_index]);
+      }
+
+      free(list_literal_expression->elements);
+      free(list_literal_expression);
+      return NULL;
+    }
+
     current_element_index++;
     current = current->next;
   }
@@ -470,6 +617,102 @@ struct atto_lambda_expression *parse_lambda_expression(struct atto_ast_node *hea
   return lambda;
 }
 
+/*
+ *  parse a let expression from its AST root node
+ *
+ *  <let_expression> ::= let ( {( <identifier> <expression> )}* ) <expression> |
+ *                       let* ( {( <identifier> <expression> )}* ) <expression>
+ */
+struct atto_let_expression *parse_let_expression(struct atto_ast_node *head)
+{
+  struct atto_ast_node *binding_list = NULL;
+  struct atto_ast_node *body         = NULL;
+  struct atto_ast_node *current      = NULL;
+
+  struct atto_let_expression *let_expression = NULL;
+
+  uint32_t number_of_bindings    = 0;
+  uint32_t current_binding_index = 0;
+
+  struct atto_expression *body_expression = NULL;
+
+  /*  the first argument of the let form is a list of bindings */
+  binding_list = head->next;
+  if ((binding_list == NULL) ||
+      (binding_list->kind != ATTO_AST_NODE_LIST)) {
+    printf("syntax error: expected binding list in `let' form\n");
+    return NULL;
+  }
+
+  /*  the second argument of the let form is the expression in which the
+   *  bindings are visible */
+  body = head->next->next;
+  if (body == NULL) {
+    printf("syntax error: expected expression in `let' form\n");
+    return NULL;
+  }
+
+  /*  every binding must be a list of an identifier and an expression */
+  current = binding_list->container.list;
+  while (current) {
+    if ((current->kind != ATTO_AST_NODE_LIST) ||
+        (current->container.list == NULL) ||
+        (current->container.list->kind != ATTO_AST_NODE_IDENTIFIER) ||
+        (current->container.list->next == NULL) ||
+        (current->container.list->next->next != NULL)) {
+      printf("syntax error: expected (identifier expression) binding in `let' form\n");
+      return NULL;
+    }
+
+    number_of_bindings++;
+    current = current->next;
+  }
+
+  body_expression = parse_expression(body);
+  if (body_expression == NULL) {
+    printf("syntax error: unable to parse `let' form; giving up\n");
+    return NULL;
+  }
+
+  let_expression = (struct atto_let_expression *)malloc(sizeof(struct atto_let_expression));
+  assert(let_expression != NULL);
+
+  let_expression->number_of_bindings = number_of_bindings;
+  let_expression->binding_names = (char **)malloc(sizeof(char *) * number_of_bindings);
+  let_expression->binding_expressions = (struct atto_expression **)malloc(sizeof(struct atto_expression *) * number_of_bindings);
+  let_expression->body = body_expression;
+  let_expression->sequential = (strcmp(head->container.identifier, "let*") == 0);
+
+  current = binding_list->container.list;
+  while (current) {
+    struct atto_ast_node *identifier = current->container.list;
+
+    let_expression->binding_names[current_binding_index] = (char *)malloc(sizeof(char) * (strlen(identifier->container.identifier) + 1));
+    strcpy(let_expression->binding_names[current_binding_index], identifier->container.identifier);
+    let_expression->binding_expressions[current_binding_index] = parse_expression(identifier->next);
+
+    if (let_expression->binding_expressions[current_binding_index] == NULL) {
+      free(let_expression->binding_names[current_binding_index]);
+
+      while (current_binding_index--) {
+        free(let_expression->binding_names[current_binding_index]);
+        destroy_expression(let_expression->binding_expressions[current_binding_index]);
+      }
+
+      free(let_expression->binding_names);
+      free(let_expression->binding_expressions);
+      destroy_expression(let_expression->body);
+      free(let_expression);
+      return NULL;
+    }
+
+    current_binding_index++;
+    current = current->next;
+  }
+
+  return let_expression;
+}
+
 /*
  *  parses a definition from its AST root node
  *
@@ -509,36 +752,11 @@ struct atto_definition *parse_definition(struct atto_ast_node *head)
   definition->identifier = (char *)malloc(sizeof(char) * (strlen(identifier->container.identifier) + 1));
   strcpy(definition->identifier, identifier->container.identifier);
   definition->body = expression;
+  definition->memoize = (strcmp(head->container.identifier, "define-memo") == 0);
 
   return definition;
 }
 
-/*
- *  recursively deallocates an AST
- */
-void destroy_ast(struct atto_ast_node *root)
-{
-  struct atto_ast_node *current = root;
-
-  while (current) {
-    struct atto_ast_node *temp = current->next;
-
-    /*  if the token is an identifier, also free its string storage */
-    if (current->kind == ATTO_AST_NODE_IDENTIFIER) {
-      free(current->container.identifier);
-    }
-
-    /*  if the token is a list, recurse and continue deallocating */
-    if (current->kind == ATTO_AST_NODE_LIST) {
-      destroy_ast(current->container.list);
-    }
-
-    free(current);
-
-    current = temp;
-  }
-}
-
 void puts_times(const char *what, size_t times)
 {
   size_t i;
@@ -637,6 +855,24 @@ void pretty_print_application_expression(struct atto_application_expression *e,
   }
 }
 
+void pretty_print_let_expression(struct atto_let_expression *e, int level)
+{
+  uint32_t i;
+
+  puts_times("  ", level);
+  printf("number of bindings: %i%s\n", e->number_of_bindings, e->sequential ? " (sequential)" : "");
+
+  for (i = 0; i < e->number_of_bindings; i++) {
+    puts_times("  ", level);
+    printf("binding %s:\n", e->binding_names[i]);
+    pretty_print_expression(e->binding_expressions[i], level + 1);
+  }
+
+  puts_times("  ", level);
+  printf("body:\n");
+  pretty_print_expression(e->body, level + 1);
+}
+
 void pretty_print_expression(struct atto_expression *e, int level)
 {
   int i;
@@ -678,6 +914,11 @@ void pretty_print_expression(struct atto_expression *e, int level)
     pretty_print_application_expression(e->container.application_expression, level + 1);
     return;
 
+  case ATTO_EXPRESSION_KIND_LET:
+    printf("let expression:\n");
+    pretty_print_let_expression(e->container.let_expression, level + 1);
+    return;
+
   default:
     printf("unknown expression kind: %i\n", e->kind);
 
@@ -696,6 +937,10 @@ void destroy_expression(struct atto_expression *e)
 {
   uint32_t i;
 
+  if (e == NULL) {
+    return;
+  }
+
   switch (e->kind) {
   
   case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
@@ -745,6 +990,19 @@ void destroy_expression(struct atto_expression *e)
     break;
   }
 
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    for (i = 0; i < le->number_of_bindings; i++) {
+      free(le->binding_names[i]);
+      destroy_expression(le->binding_expressions[i]);
+    }
+    free(le->binding_names);
+    free(le->binding_expressions);
+    destroy_expression(le->body);
+    free(le);
+    break;
+  }
+
   default:
     break;
   }
@@ -752,3 +1010,124 @@ void destroy_expression(struct atto_expression *e)
   free(e);
 }
 
+
+static char *copy_identifier(const char *identifier)
+{
+  char *temp = (char *)malloc(sizeof(char) * (strlen(identifier) + 1));
+  assert(temp != NULL);
+  strcpy(temp, identifier);
+
+  return temp;
+}
+
+/*
+ *  recursively copies an expression, so that the copy may be transformed or
+ *  kept around independently of the original
+ */
+struct atto_expression *copy_expression(struct atto_expression *e)
+{
+  struct atto_expression *copy = (struct atto_expression *)malloc(sizeof(struct atto_expression));
+  uint32_t i;
+
+  assert(copy != NULL);
+  copy->kind = e->kind;
+
+  switch (e->kind) {
+
+  case ATTO_EXPRESSION_KIND_NUMBER_LITERAL:
+    copy->container.number_literal = e->container.number_literal;
+    break;
+
+  case ATTO_EXPRESSION_KIND_SYMBOL_LITERAL:
+    copy->container.symbol_literal = e->container.symbol_literal;
+    break;
+
+  case ATTO_EXPRESSION_KIND_LIST_LITERAL: {
+    struct atto_list_literal_expression *lle = e->container.list_literal_expression;
+    struct atto_list_literal_expression *lle_copy = (struct atto_list_literal_expression *)malloc(sizeof(struct atto_list_literal_expression));
+    assert(lle_copy != NULL);
+
+    lle_copy->number_of_elements = lle->number_of_elements;
+    lle_copy->elements = (struct atto_expression **)malloc(sizeof(struct atto_expression *) * lle->number_of_elements);
+    for (i = 0; i < lle->number_of_elements; i++) {
+      lle_copy->elements[i] = copy_expression(lle->elements[i]);
+    }
+
+    copy->container.list_literal_expression = lle_copy;
+    break;
+  }
+
+  case ATTO_EXPRESSION_KIND_REFERENCE:
+    copy->container.reference_identifier = copy_identifier(e->container.reference_identifier);
+    break;
+
+  case ATTO_EXPRESSION_KIND_LAMBDA: {
+    struct atto_lambda_expression *le = e->container.lambda_expression;
+    struct atto_lambda_expression *le_copy = (struct atto_lambda_expression *)malloc(sizeof(struct atto_lambda_expression));
+    assert(le_copy != NULL);
+
+    le_copy->number_of_parameters = le->number_of_parameters;
+    le_copy->parameter_names = (char **)malloc(sizeof(char *) * le->number_of_parameters);
+    for (i = 0; i < le->number_of_parameters; i++) {
+      le_copy->parameter_names[i] = copy_identifier(le->parameter_names[i]);
+    }
+    le_copy->body = copy_expression(le->body);
+
+    copy->container.lambda_expression = le_copy;
+    break;
+  }
+
+  case ATTO_EXPRESSION_KIND_IF: {
+    struct atto_if_expression *ie = e->container.if_expression;
+    struct atto_if_expression *ie_copy = (struct atto_if_expression *)malloc(sizeof(struct atto_if_expression));
+    assert(ie_copy != NULL);
+
+    ie_copy->condition_expression        = copy_expression(ie->condition_expression);
+    ie_copy->true_evaluation_expression  = copy_expression(ie->true_evaluation_expression);
+    ie_copy->false_evaluation_expression = copy_expression(ie->false_evaluation_expression);
+
+    copy->container.if_expression = ie_copy;
+    break;
+  }
+
+  case ATTO_EXPRESSION_KIND_APPLICATION: {
+    struct atto_application_expression *ae = e->container.application_expression;
+    struct atto_application_expression *ae_copy = (struct atto_application_expression *)malloc(sizeof(struct atto_application_expression));
+    assert(ae_copy != NULL);
+
+    ae_copy->identifier = copy_identifier(ae->identifier);
+    ae_copy->number_of_parameters = ae->number_of_parameters;
+    ae_copy->parameters = (struct atto_expression **)malloc(sizeof(struct atto_expression *) * ae->number_of_parameters);
+    for (i = 0; i < ae->number_of_parameters; i++) {
+      ae_copy->parameters[i] = copy_expression(ae->parameters[i]);
+    }
+
+    copy->container.application_expression = ae_copy;
+    break;
+  }
+
+  case ATTO_EXPRESSION_KIND_LET: {
+    struct atto_let_expression *le = e->container.let_expression;
+    struct atto_let_expression *le_copy = (struct atto_let_expression *)malloc(sizeof(struct atto_let_expression));
+    assert(le_copy != NULL);
+
+    le_copy->number_of_bindings = le->number_of_bindings;
+    le_copy->binding_names = (char **)malloc(sizeof(char *) * le->number_of_bindings);
+    le_copy->binding_expressions = (struct atto_expression **)malloc(sizeof(struct atto_expression *) * le->number_of_bindings);
+    for (i = 0; i < le->number_of_bindings; i++) {
+      le_copy->binding_names[i] = copy_identifier(le->binding_names[i]);
+      le_copy->binding_expressions[i] = copy_expression(le->binding_expressions[i]);
+    }
+    le_copy->body = copy_expression(le->body);
+    le_copy->sequential = le->sequential;
+
+    copy->container.let_expression = le_copy;
+    break;
+  }
+
+  default:
+    break;
+  }
+
+  return copy;
+}
@@ -9,14 +9,20 @@
 
 #include "state.h"
 #include "lexer.h"
+#include "arena.h"
 
 #pragma once
 
+#define ATTO_PARSER_MIN_STACK_DEPTH (size_t)16
+
 struct atto_ast_node {
   #define ATTO_AST_NODE_IDENTIFIER  0
   #define ATTO_AST_NODE_NUMBER      1
   #define ATTO_AST_NODE_SYMBOL      2
   #define ATTO_AST_NODE_LIST        3
+
+  /*  a symbol which was not interned yet, and is still known by name */
+  #define ATTO_AST_NODE_SYMBOL_NAME 4
   uint32_t kind;
 
   union {
@@ -32,6 +38,9 @@ struct atto_ast_node {
 struct atto_definition {
   char *identifier;
   struct atto_expression *body;
+
+  /*  set for `define-memo' forms, whose lambdas remember their results */
+  uint8_t memoize;
 };
 
 struct atto_lambda_expression {
@@ -52,6 +61,17 @@ struct atto_application_expression {
   struct atto_expression **parameters;
 };
 
+struct atto_let_expression {
+  uint32_t number_of_bindings;
+  char **binding_names;
+  struct atto_expression **binding_expressions;
+  struct atto_expression *body;
+
+  /*  in a sequential (`let*') form, every binding can see the ones before
+   *  it; otherwise, they are all evaluated in the enclosing scope */
+  uint8_t sequential;
+};
+
 struct atto_list_literal_expression {
   uint32_t number_of_elements;
   struct atto_expression **elements;
@@ -65,6 +85,7 @@ struct atto_expression {
   #define ATTO_EXPRESSION_KIND_LAMBDA           4
   #define ATTO_EXPRESSION_KIND_IF               5
   #define ATTO_EXPRESSION_KIND_APPLICATION      6
+  #define ATTO_EXPRESSION_KIND_LET              7
   uint32_t kind;
 
   union {
@@ -75,18 +96,21 @@ struct atto_expression {
     struct atto_lambda_expression *lambda_expression;
     struct atto_if_expression *if_expression;
     struct atto_application_expression *application_expression;
+    struct atto_let_expression *let_expression;
   } container;
 };
 
-struct atto_ast_node *atto_parse_token_list(struct atto_state *a, struct atto_token *root, struct atto_token **left);
+struct atto_ast_node *atto_parse_token_array(struct atto_state *a, struct atto_token_array *ta,
+  struct atto_arena *arena, size_t *left);
+void atto_intern_ast_symbols(struct atto_state *a, struct atto_ast_node *root);
 struct atto_expression *parse_expression(struct atto_ast_node *e);
 struct atto_if_expression *parse_if_expression(struct atto_ast_node *head);
 struct atto_application_expression *parse_application_expression(struct atto_ast_node *head);
 struct atto_list_literal_expression *parse_list_literal_expression(struct atto_ast_node *head);
 struct atto_lambda_expression *parse_lambda_expression(struct atto_ast_node *head);
+struct atto_let_expression *parse_let_expression(struct atto_ast_node *head);
 struct atto_definition *parse_definition(struct atto_ast_node *head);
 
-void destroy_ast(struct atto_ast_node *root);
 
 void puts_times(const char *what, size_t times);
 void pretty_print_ast(struct atto_ast_node *root, size_t level);
@@ -94,8 +118,10 @@ void pretty_print_list_literal_expression(struct atto_list_literal_expression *e
 void pretty_print_lambda_expression(struct atto_lambda_expression *e, int level);
 void pretty_print_if_expression(struct atto_if_expression *e, int level);
 void pretty_print_application_expression(struct atto_application_expression *e, int level);
+void pretty_print_let_expression(struct atto_let_expression *e, int level);
 void pretty_print_expression(struct atto_expression *e, int level);
 void pretty_print_definition(struct atto_definition *d);
 
 void destroy_expression(struct atto_expression *e);
+struct atto_expression *copy_expression(struct atto_expression *e);
 
@@ -0,0 +1,14 @@
+/*
+ *  prelude.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+
+#pragma once
+
+/*  the image of `prelude.atto', compiled when atto is built, and linked
+ *  into the executable; see `embed.c' */
+extern const unsigned char atto_prelude_image[];
+extern const size_t atto_prelude_image_length;
+
@@ -0,0 +1,300 @@
+/*
+ *  prepared.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "state.h"
+#include "lexer.h"
+#include "prepared.h"
+
+/*
+ *  top-level expressions which are evaluated over and over are compiled
+ *  only once, and are kept in a cache of fixed capacity, indexed by their
+ *  text; running them again creates no new instruction streams
+ */
+struct atto_prepared_cache *atto_allocate_prepared_cache(size_t capacity)
+{
+  struct atto_prepared_cache *c = (struct atto_prepared_cache *)malloc(sizeof(struct atto_prepared_cache));
+  assert(c != NULL);
+
+  c->entries = (struct atto_prepared_expression *)malloc(sizeof(struct atto_prepared_expression) * capacity);
+  assert(c->entries != NULL);
+  c->number_of_entries = 0;
+  c->capacity = capacity;
+  c->free_entries = NULL;
+
+  /*  buckets are kept at least twice as many as entries */
+  c->number_of_buckets = 1;
+  while (c->number_of_buckets < 2 * capacity) {
+    c->number_of_buckets *= 2;
+  }
+
+  c->buckets = (struct atto_prepared_expression **)calloc(c->number_of_buckets, sizeof(struct atto_prepared_expression *));
+  assert(c->buckets != NULL);
+
+  c->newest = NULL;
+  c->oldest = NULL;
+
+  c->hits = 0;
+  c->misses = 0;
+  c->evictions = 0;
+  c->invalidations = 0;
+
+  return c;
+}
+
+static void release_entry(struct atto_prepared_expression *e)
+{
+  free(e->text);
+  free(e->names);
+  free(e->objects);
+}
+
+void atto_destroy_prepared_cache(struct atto_prepared_cache *c)
+{
+  struct atto_prepared_expression *e = NULL;
+
+  for (e = c->newest; e != NULL; e = e->older) {
+    release_entry(e);
+  }
+
+  free(c->entries);
+  free(c->buckets);
+  free(c);
+}
+
+static void unlink_entry(struct atto_prepared_cache *c, struct atto_prepared_expression *e)
+{
+  if (e->newer != NULL) {
+    e->newer->older = e->older;
+  } else {
+    c->newest = e->older;
+  }
+
+  if (e->older != NULL) {
+    e->older->newer = e->newer;
+  } else {
+    c->oldest = e->newer;
+  }
+}
+
+static void make_newest(struct atto_prepared_cache *c, struct atto_prepared_expression *e)
+{
+  e->newer = NULL;
+  e->older = c->newest;
+
+  if (c->newest != NULL) {
+    c->newest->newer = e;
+  } else {
+    c->oldest = e;
+  }
+
+  c->newest = e;
+}
+
+/*
+ *  takes an entry out of the cache altogether
+ */
+static void remove_entry(struct atto_prepared_cache *c, struct atto_prepared_expression *e)
+{
+  struct atto_prepared_expression **current = &c->buckets[e->hash & (c->number_of_buckets - 1)];
+
+  while (*current != e) {
+    current = &(*current)->bucket_next;
+  }
+  *current = e->bucket_next;
+
+  unlink_entry(c, e);
+  release_entry(e);
+}
+
+/*
+ *  checks whether the names an entry refers to still refer to the same
+ *  globals; only needed once globals have been defined since the last check
+ */
+static int is_still_valid(struct atto_prepared_expression *e, struct atto_environment *globals)
+{
+  char *name = e->names;
+  size_t i;
+
+  if (e->number_of_globals == globals->number_of_objects) {
+    return 1;
+  }
+
+  for (i = 0; i < e->number_of_names; i++) {
+    if (atto_find_in_environment(globals, name) != e->objects[i]) {
+      return 0;
+    }
+
+    name += strlen(name) + 1;
+  }
+
+  e->number_of_globals = globals->number_of_objects;
+
+  return 1;
+}
+
+/*
+ *  looks up a top-level expression by its text, counting the lookup as
+ *  either a hit or a miss; returns whether it was found, in which case
+ *  `instruction_stream_index' is set to the stream it was compiled into.
+ *  entries which refer to a name which has since been defined again are
+ *  dropped, and the expression has to be compiled anew
+ */
+int atto_find_prepared_expression(struct atto_prepared_cache *c, struct atto_environment *globals,
+  const char *text, size_t *instruction_stream_index)
+{
+  uint32_t hash = atto_hash_name(text);
+  struct atto_prepared_expression *e = c->buckets[hash & (c->number_of_buckets - 1)];
+
+  while ((e != NULL) && ((e->hash != hash) || (strcmp(e->text, text) != 0))) {
+    e = e->bucket_next;
+  }
+
+  if (e == NULL) {
+    c->misses++;
+    return 0;
+  }
+
+  if (!is_still_valid(e, globals)) {
+    remove_entry(c, e);
+    e->bucket_next = c->free_entries;
+    c->free_entries = e;
+
+    c->invalidations++;
+    c->misses++;
+    return 0;
+  }
+
+  unlink_entry(c, e);
+  make_newest(c, e);
+
+  c->hits++;
+  *instruction_stream_index = e->instruction_stream_index;
+
+  return 1;
+}
+
+/*
+ *  finds the names an expression refers to; each is listed once, and
+ *  whether it is a global, a builtin or a local is sorted out when the
+ *  entry is checked
+ */
+static int find_names(struct atto_prepared_expression *e, struct atto_environment *globals, const char *text)
+{
+  struct atto_token_array *tokens = atto_lex_string(text);
+  size_t i, length = 0;
+
+  if (tokens == NULL) {
+    return 0;
+  }
+
+  e->names = (char *)malloc(sizeof(char) * (strlen(text) + 1));
+  assert(e->names != NULL);
+  e->objects = (struct atto_environment_object **)malloc(sizeof(struct atto_environment_object *) * (tokens->number_of_tokens + 1));
+  assert(e->objects != NULL);
+  e->number_of_names = 0;
+
+  for (i = 0; i < tokens->number_of_tokens; i++) {
+    struct atto_token *t = &tokens->tokens[i];
+    char *name = e->names, *end = e->names + length;
+
+    if (t->kind != ATTO_TOKEN_IDENTIFIER) {
+      continue;
+    }
+
+    while ((name < end) && ((strncmp(name, text + t->offset, t->length) != 0) || (name[t->length] != 0))) {
+      name += strlen(name) + 1;
+    }
+
+    if (name < end) {
+      continue;
+    }
+
+    memcpy(end, text + t->offset, t->length);
+    end[t->length] = 0;
+    length += t->length + 1;
+
+    e->objects[e->number_of_names++] = atto_find_in_environment(globals, end);
+  }
+
+  destroy_token_array(tokens);
+
+  return 1;
+}
+
+/*
+ *  remembers the instruction stream a top-level expression was compiled
+ *  into; once the cache is full, the entry which was used the longest time
+ *  ago makes room for it. the stream of an evicted entry stays where it is,
+ *  since the values the expression made may still refer to it
+ */
+void atto_prepare_expression(struct atto_prepared_cache *c, struct atto_environment *globals,
+  const char *text, size_t instruction_stream_index)
+{
+  struct atto_prepared_expression *e = NULL;
+
+  if (c->capacity == 0) {
+    return;
+  }
+
+  if (c->free_entries != NULL) {
+    e = c->free_entries;
+    c->free_entries = e->bucket_next;
+  } else if (c->number_of_entries < c->capacity) {
+    e = &c->entries[c->number_of_entries++];
+  } else {
+    e = c->oldest;
+    remove_entry(c, e);
+    c->evictions++;
+  }
+
+  if (!find_names(e, globals, text)) {
+    e->bucket_next = c->free_entries;
+    c->free_entries = e;
+    return;
+  }
+
+  e->text = (char *)malloc(sizeof(char) * (strlen(text) + 1));
+  assert(e->text != NULL);
+  strcpy(e->text, text);
+
+  e->hash = atto_hash_name(text);
+  e->instruction_stream_index = instruction_stream_index;
+  e->number_of_globals = globals->number_of_objects;
+
+  e->bucket_next = c->buckets[e->hash & (c->number_of_buckets - 1)];
+  c->buckets[e->hash & (c->number_of_buckets - 1)] = e;
+
+  make_newest(c, e);
+}
+
+/*
+ *  drops every entry; this is done when the compiler settings change, since
+ *  the expressions might then compile to something else
+ */
+void atto_forget_prepared_expressions(struct atto_prepared_cache *c)
+{
+  while (c->newest != NULL) {
+    struct atto_prepared_expression *e = c->newest;
+
+    remove_entry(c, e);
+    e->bucket_next = c->free_entries;
+    c->free_entries = e;
+
+    c->invalidations++;
+  }
+}
+
+void pretty_print_prepared_cache_usage(struct atto_prepared_cache *c)
+{
+  printf("prepared: %lu/%lu entries, %lu hits, %lu misses, %lu evictions, %lu invalidations\n",
+    c->number_of_entries, c->capacity, c->hits, c->misses, c->evictions, c->invalidations);
+}
+
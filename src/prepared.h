@@ -0,0 +1,72 @@
+/*
+ *  prepared.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "state.h"
+
+#pragma once
+
+#define ATTO_PREPARED_DEFAULT_CAPACITY (size_t)64
+
+/*
+ *  a top-level expression which was compiled before, along with the globals
+ *  it refers to by name; it is only run again as long as those names still
+ *  refer to the same globals
+ */
+struct atto_prepared_expression {
+  char *text;
+  uint32_t hash;
+  size_t instruction_stream_index;
+
+  /*  the names, one after the other, and the objects they referred to,
+   *  which are null for names which were not globals */
+  char *names;
+  struct atto_environment_object **objects;
+  size_t number_of_names;
+
+  /*  the number of globals there were when the names were last checked */
+  size_t number_of_globals;
+
+  struct atto_prepared_expression *bucket_next;
+
+  /*  entries are listed from the most recently used one, so that the least
+   *  recently used one is the first to go once the cache is full */
+  struct atto_prepared_expression *newer;
+  struct atto_prepared_expression *older;
+};
+
+struct atto_prepared_cache {
+  struct atto_prepared_expression *entries;
+  size_t number_of_entries;
+  size_t capacity;
+
+  /*  entries which were invalidated, linked through `bucket_next' */
+  struct atto_prepared_expression *free_entries;
+
+  struct atto_prepared_expression **buckets;
+  size_t number_of_buckets;
+
+  struct atto_prepared_expression *newest;
+  struct atto_prepared_expression *oldest;
+
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+  size_t invalidations;
+};
+
+struct atto_prepared_cache *atto_allocate_prepared_cache(size_t capacity);
+void atto_destroy_prepared_cache(struct atto_prepared_cache *c);
+
+int atto_find_prepared_expression(struct atto_prepared_cache *c, struct atto_environment *globals,
+  const char *text, size_t *instruction_stream_index);
+void atto_prepare_expression(struct atto_prepared_cache *c, struct atto_environment *globals,
+  const char *text, size_t instruction_stream_index);
+void atto_forget_prepared_expressions(struct atto_prepared_cache *c);
+
+void pretty_print_prepared_cache_usage(struct atto_prepared_cache *c);
+
@@ -0,0 +1,177 @@
+/*
+ *  reader.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "reader.h"
+
+static int is_whitespace(char c)
+{
+  return ((c == ' ') || (c == '\n') || (c == '\t'));
+}
+
+struct atto_reader *atto_allocate_reader(void)
+{
+  struct atto_reader *r = (struct atto_reader *)malloc(sizeof(struct atto_reader));
+  assert(r != NULL);
+
+  r->pending_length = 0;
+  r->consumed = 0;
+  r->allocated_pending_length = ATTO_READER_MIN_BUFFER_SIZE;
+  r->pending = (char *)malloc(sizeof(char) * r->allocated_pending_length);
+  assert(r->pending != NULL);
+
+  r->scanned = 0;
+  r->depth = 0;
+
+  r->allocated_form_length = ATTO_READER_MIN_BUFFER_SIZE;
+  r->form = (char *)malloc(sizeof(char) * r->allocated_form_length);
+  assert(r->form != NULL);
+
+  r->finished = 0;
+
+  return r;
+}
+
+void atto_destroy_reader(struct atto_reader *r)
+{
+  free(r->pending);
+  free(r->form);
+  free(r);
+}
+
+void atto_reader_feed(struct atto_reader *r, const char *text, size_t length)
+{
+  memmove(r->pending, r->pending + r->consumed, r->pending_length - r->consumed);
+  r->pending_length -= r->consumed;
+  r->consumed = 0;
+
+  if (r->pending_length + length > r->allocated_pending_length) {
+    while (r->pending_length + length > r->allocated_pending_length) {
+      r->allocated_pending_length *= 2;
+    }
+
+    r->pending = (char *)realloc(r->pending, sizeof(char) * r->allocated_pending_length);
+    assert(r->pending != NULL);
+  }
+
+  memcpy(r->pending + r->pending_length, text, length);
+  r->pending_length += length;
+}
+
+/*
+ *  marks the end of the input, so that a form which is cut short by it is
+ *  handed back as it is, and left to the parser to complain about
+ */
+void atto_reader_finish(struct atto_reader *r)
+{
+  r->finished = 1;
+}
+
+/*
+ *  returns whether a form was started, but not yet completed
+ */
+int atto_reader_is_inside_form(struct atto_reader *r)
+{
+  size_t i;
+
+  for (i = r->consumed; i < r->pending_length; i++) {
+    if (!is_whitespace(r->pending[i])) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ *  copies the next `length' characters of the pending text out as the
+ *  current form
+ */
+static const char *take_form(struct atto_reader *r, size_t length)
+{
+  if (length + 1 > r->allocated_form_length) {
+    while (length + 1 > r->allocated_form_length) {
+      r->allocated_form_length *= 2;
+    }
+
+    r->form = (char *)realloc(r->form, sizeof(char) * r->allocated_form_length);
+    assert(r->form != NULL);
+  }
+
+  memcpy(r->form, r->pending + r->consumed, length);
+  r->form[length] = 0;
+
+  r->consumed += length;
+  r->scanned = 0;
+  r->depth = 0;
+
+  return r->form;
+}
+
+/*
+ *  returns the next complete top-level form, or NULL if more text is
+ *  needed to complete it; the form stays valid until the next call. a
+ *  list ends with the parenthesis which closes it, and anything else ends
+ *  with the first whitespace or parenthesis after it. scanning picks up
+ *  where the previous call left off, so text is only looked at once
+ */
+const char *atto_reader_next_form(struct atto_reader *r)
+{
+  const char *form = NULL;
+  size_t length = 0;
+
+  /*  whitespace between forms is dropped */
+  if (r->scanned == 0) {
+    while ((r->consumed < r->pending_length) && is_whitespace(r->pending[r->consumed])) {
+      r->consumed++;
+    }
+  }
+
+  form = r->pending + r->consumed;
+  length = r->pending_length - r->consumed;
+
+  if (length == 0) {
+    return NULL;
+  }
+
+  /*  a parenthesis which closes nothing is a form of its own, and is left
+   *  to the parser to reject */
+  if (form[0] == ')') {
+    return take_form(r, 1);
+  }
+
+  if (form[0] != '(') {
+    while (r->scanned < length) {
+      char c = form[r->scanned];
+
+      if (is_whitespace(c) || (c == '(') || (c == ')')) {
+        return take_form(r, r->scanned);
+      }
+
+      r->scanned++;
+    }
+  } else {
+    while (r->scanned < length) {
+      char c = form[r->scanned++];
+
+      if (c == '(') {
+        r->depth++;
+      } else if ((c == ')') && (--r->depth == 0)) {
+        return take_form(r, r->scanned);
+      }
+    }
+  }
+
+  if (r->finished) {
+    return take_form(r, length);
+  }
+
+  return NULL;
+}
+
@@ -0,0 +1,47 @@
+/*
+ *  reader.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#pragma once
+
+#define ATTO_READER_MIN_BUFFER_SIZE (size_t)256
+#define ATTO_READER_CHUNK_SIZE      (size_t)4096
+
+/*
+ *  the reader takes source text in chunks of any size, and hands it back
+ *  one complete top-level form at a time; only the text of the form being
+ *  read is kept around, so memory use is bounded by the largest form
+ */
+struct atto_reader {
+  /*  text which was fed, of which the first `consumed' characters were
+   *  already handed back; those are only dropped when more text is fed */
+  char *pending;
+  size_t pending_length;
+  size_t allocated_pending_length;
+  size_t consumed;
+
+  /*  how much of the current form was scanned, and the nesting depth of
+   *  parantheses at that point */
+  size_t scanned;
+  size_t depth;
+
+  /*  the last form handed back, as a null terminated string */
+  char *form;
+  size_t allocated_form_length;
+
+  /*  set once no more text will be fed */
+  uint8_t finished;
+};
+
+struct atto_reader *atto_allocate_reader(void);
+void atto_destroy_reader(struct atto_reader *r);
+
+void atto_reader_feed(struct atto_reader *r, const char *text, size_t length);
+void atto_reader_finish(struct atto_reader *r);
+const char *atto_reader_next_form(struct atto_reader *r);
+int atto_reader_is_inside_form(struct atto_reader *r);
+
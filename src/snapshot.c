@@ -0,0 +1,575 @@
+/*
+ *  snapshot.c
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "state.h"
+#include "vm.h"
+#include "compiler.h"
+#include "image.h"
+#include "snapshot.h"
+
+/*
+ *  a snapshot is the whole of a state, laid out so that it can be mapped
+ *  into memory and used as it is: the heap, the data stack, the capture
+ *  pool, the shared object table and the instructions only ever refer to
+ *  each other by index, so they are used straight from the mapping, which
+ *  is private, and only copied a page at a time as they are written to.
+ *  only the small tables which point into them are built when loading: the
+ *  instruction streams, the symbol names and the global environment, along
+ *  with the expressions kept for the optimizer, which are read last
+ */
+struct snapshot_header {
+  uint32_t magic;
+  uint32_t format_version;
+  uint32_t compiler_version;
+  uint32_t byte_order;
+
+  /*  the layout of what is used as it is, which must match the one of the
+   *  build loading the snapshot */
+  uint64_t object_size;
+  uint64_t instruction_size;
+  uint64_t max_heap_objects;
+  uint64_t max_data_stack_size;
+  uint64_t max_captures;
+  uint64_t shared_object_table_size;
+
+  uint64_t heap_size;
+  uint64_t data_stack_size;
+  uint64_t number_of_captures;
+  uint64_t number_of_shared_allocations;
+  uint64_t vm_flags;
+
+  uint64_t number_of_instruction_streams;
+  uint64_t number_of_instructions;
+  uint64_t number_of_symbols;
+  uint64_t symbol_table_size;
+  uint64_t symbol_names_length;
+  uint64_t number_of_globals;
+  uint64_t global_names_length;
+
+  /*  where each section starts, from the start of the file */
+  uint64_t heap;
+  uint64_t data_stack;
+  uint64_t captures;
+  uint64_t shared_objects;
+  uint64_t instruction_streams;
+  uint64_t instructions;
+  uint64_t symbol_names;
+  uint64_t symbol_hashes;
+  uint64_t symbol_table;
+  uint64_t globals;
+  uint64_t global_names;
+  uint64_t expressions;
+  uint64_t length;
+};
+
+struct snapshot_instruction_stream {
+  uint64_t first_instruction;
+  uint64_t length;
+  uint64_t number_of_captures;
+  uint64_t number_of_arguments;
+  uint64_t memoize;
+};
+
+struct snapshot_global {
+  uint64_t name;
+  uint64_t offset;
+  uint64_t strict_parameters;
+  uint64_t kind;
+  uint64_t flags;
+
+  /*  whether an expression of the global is kept in the last section */
+  uint64_t has_expression;
+};
+
+/*  sections start at multiples of this, which suits every type in them */
+#define SECTION_ALIGNMENT 16
+
+/*
+ *  writes a section, starting it at the next suitably aligned position,
+ *  and returns where it starts; `position' is kept past its end
+ */
+static uint64_t write_section(FILE *f, uint64_t *position, const void *data, size_t size, int *written)
+{
+  static const char padding[SECTION_ALIGNMENT] = { 0 };
+  size_t length = (SECTION_ALIGNMENT - (*position % SECTION_ALIGNMENT)) % SECTION_ALIGNMENT;
+  uint64_t start = *position + length;
+
+  if ((fwrite(padding, 1, length, f) != length) || (fwrite(data, 1, size, f) != size)) {
+    *written = 0;
+  }
+
+  *position = start + size;
+
+  return start;
+}
+
+/*
+ *  lists the global environment from the object added first
+ */
+static struct atto_environment_object **list_globals(struct atto_state *a)
+{
+  size_t i = a->global_environment->number_of_objects;
+  struct atto_environment_object **globals = (struct atto_environment_object **)malloc(sizeof(struct atto_environment_object *) * (i + 1));
+  struct atto_environment_object *eo = NULL;
+  assert(globals != NULL);
+
+  for (eo = a->global_environment->head; i > 0; i--, eo = eo->next) {
+    globals[i - 1] = eo;
+  }
+
+  return globals;
+}
+
+/*
+ *  saves the whole of a state to a snapshot, which can be mapped back into
+ *  a new state in place of running anything; the bodies of lambdas which
+ *  were not called yet are compiled first. returns whether the snapshot was
+ *  saved
+ */
+int atto_save_snapshot(struct atto_state *a, const char *path)
+{
+  struct atto_vm_state *vm = a->vm_state;
+  struct snapshot_header header;
+  struct snapshot_instruction_stream *streams = NULL;
+  struct snapshot_global *globals = NULL;
+  struct atto_environment_object **environment = NULL;
+  struct atto_instruction *instructions = NULL;
+  char *names = NULL;
+  size_t i, length, number_of_instructions = 0, global_names_length = 0, symbol_names_length = 0;
+  uint64_t position = sizeof(struct snapshot_header);
+  FILE *f = fopen(path, "wb");
+  int written = 1;
+
+  if (f == NULL) {
+    printf("error: unable to open `%s'\n", path);
+    return 0;
+  }
+
+  atto_compile_pending_lambdas(a, 0);
+
+  memset(&header, 0, sizeof(struct snapshot_header));
+  header.magic = ATTO_SNAPSHOT_MAGIC;
+  header.format_version = ATTO_SNAPSHOT_FORMAT_VERSION;
+  header.compiler_version = ATTO_COMPILER_VERSION;
+  header.byte_order = ATTO_IMAGE_BYTE_ORDER;
+
+  header.object_size = sizeof(struct atto_object);
+  header.instruction_size = sizeof(struct atto_instruction);
+  header.max_heap_objects = ATTO_VM_MAX_HEAP_OBJECTS;
+  header.max_data_stack_size = ATTO_VM_MAX_DATA_STACK_SIZE;
+  header.max_captures = ATTO_VM_MAX_CAPTURES;
+  header.shared_object_table_size = ATTO_VM_SHARED_OBJECT_TABLE_SIZE;
+
+  header.heap_size = vm->heap_size;
+  header.data_stack_size = vm->data_stack_size;
+  header.number_of_captures = vm->number_of_captures;
+  header.number_of_shared_allocations = vm->number_of_shared_allocations;
+  header.vm_flags = vm->flags & ATTO_VM_FLAG_HASH_CONS;
+
+  if (fwrite(&header, sizeof(struct snapshot_header), 1, f) != 1) {
+    written = 0;
+  }
+
+  /*  the arrays the vm uses as they are are written whole, so that they
+   *  can grow into the rest of the mapping */
+  header.heap = write_section(f, &position, vm->heap, sizeof(struct atto_object) * ATTO_VM_MAX_HEAP_OBJECTS, &written);
+  header.data_stack = write_section(f, &position, vm->data_stack, sizeof(size_t) * ATTO_VM_MAX_DATA_STACK_SIZE, &written);
+  header.captures = write_section(f, &position, vm->captures, sizeof(size_t) * ATTO_VM_MAX_CAPTURES, &written);
+  header.shared_objects = write_section(f, &position, vm->shared_objects, sizeof(size_t) * ATTO_VM_SHARED_OBJECT_TABLE_SIZE, &written);
+
+  /*  the instructions of all streams are written one after the other */
+  header.number_of_instruction_streams = vm->number_of_instruction_streams;
+  streams = (struct snapshot_instruction_stream *)malloc(sizeof(struct snapshot_instruction_stream) * (vm->number_of_instruction_streams + 1));
+  assert(streams != NULL);
+
+  for (i = 0; i < vm->number_of_instruction_streams; i++) {
+    struct atto_instruction_stream *is = vm->instruction_streams[i];
+
+    streams[i].first_instruction = number_of_instructions;
+    streams[i].length = is->length;
+    streams[i].number_of_captures = is->number_of_captures;
+    streams[i].number_of_arguments = is->number_of_arguments;
+    streams[i].memoize = is->memoize;
+    number_of_instructions += is->length;
+  }
+
+  header.number_of_instructions = number_of_instructions;
+  instructions = (struct atto_instruction *)calloc(number_of_instructions + 1, sizeof(struct atto_instruction));
+  assert(instructions != NULL);
+
+  for (i = 0; i < vm->number_of_instruction_streams; i++) {
+    memcpy(&instructions[streams[i].first_instruction], vm->instruction_streams[i]->stream,
+      sizeof(struct atto_instruction) * streams[i].length);
+  }
+
+  header.instruction_streams = write_section(f, &position, streams, sizeof(struct snapshot_instruction_stream) * vm->number_of_instruction_streams, &written);
+  header.instructions = write_section(f, &position, instructions, sizeof(struct atto_instruction) * number_of_instructions, &written);
+  free(streams);
+  free(instructions);
+
+  /*  symbol names are written one after the other, each ending in a null */
+  header.number_of_symbols = a->number_of_symbols;
+  header.symbol_table_size = a->symbol_table_size;
+
+  for (i = 0; i < a->number_of_symbols; i++) {
+    symbol_names_length += strlen(a->symbol_names[i]) + 1;
+  }
+
+  names = (char *)malloc(sizeof(char) * (symbol_names_length + 1));
+  assert(names != NULL);
+
+  for (i = 0, length = 0; i < a->number_of_symbols; i++) {
+    strcpy(names + length, a->symbol_names[i]);
+    length += strlen(a->symbol_names[i]) + 1;
+  }
+
+  header.symbol_names_length = symbol_names_length;
+  header.symbol_names = write_section(f, &position, names, symbol_names_length, &written);
+  header.symbol_hashes = write_section(f, &position, a->symbol_hashes, sizeof(uint32_t) * a->number_of_symbols, &written);
+  header.symbol_table = write_section(f, &position, a->symbol_table, sizeof(uint32_t) * a->symbol_table_size, &written);
+  free(names);
+
+  /*  globals are written from the one added first, with their names kept
+   *  apart */
+  header.number_of_globals = a->global_environment->number_of_objects;
+  environment = list_globals(a);
+  globals = (struct snapshot_global *)malloc(sizeof(struct snapshot_global) * (header.number_of_globals + 1));
+  assert(globals != NULL);
+
+  for (i = 0; i < header.number_of_globals; i++) {
+    globals[i].name = global_names_length;
+    globals[i].offset = environment[i]->offset;
+    globals[i].strict_parameters = environment[i]->strict_parameters;
+    globals[i].kind = environment[i]->kind;
+    globals[i].flags = environment[i]->flags;
+    globals[i].has_expression = (environment[i]->expression != NULL);
+    global_names_length += strlen(environment[i]->name) + 1;
+  }
+
+  names = (char *)malloc(sizeof(char) * (global_names_length + 1));
+  assert(names != NULL);
+
+  for (i = 0; i < header.number_of_globals; i++) {
+    strcpy(names + globals[i].name, environment[i]->name);
+  }
+
+  header.globals = write_section(f, &position, globals, sizeof(struct snapshot_global) * header.number_of_globals, &written);
+  header.global_names_length = global_names_length;
+  header.global_names = write_section(f, &position, names, global_names_length, &written);
+
+  /*  kept expressions are written as images write them, one after the
+   *  other, right where the names end */
+  header.expressions = position;
+
+  for (i = 0; i < header.number_of_globals; i++) {
+    if ((environment[i]->expression != NULL) && !atto_write_expression(f, environment[i]->expression)) {
+      written = 0;
+    }
+  }
+
+  header.length = (uint64_t)ftell(f);
+  free(environment);
+  free(globals);
+  free(names);
+
+  if ((fseek(f, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(struct snapshot_header), 1, f) != 1)) {
+    written = 0;
+  }
+
+  if ((fclose(f) != 0) || !written) {
+    printf("error: unable to write `%s'\n", path);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int is_section_inside(struct snapshot_header *h, uint64_t start, uint64_t size)
+{
+  return ((start % SECTION_ALIGNMENT) == 0) && (start <= h->length) && (size <= h->length - start);
+}
+
+/*
+ *  checks that a section of names holds exactly `number_of_names' names,
+ *  each ending in a null
+ */
+static int are_names_valid(const char *names, uint64_t length, uint64_t number_of_names)
+{
+  uint64_t i, count = 0;
+
+  for (i = 0; i < length; i++) {
+    if (names[i] == 0) {
+      count++;
+    }
+  }
+
+  return (count == number_of_names) && ((length == 0) || (names[length - 1] == 0));
+}
+
+/*
+ *  checks that a snapshot was made by this build, and that its sections lie
+ *  inside of it
+ */
+static int is_valid_snapshot(struct snapshot_header *h, size_t length)
+{
+  const char *base = (const char *)h;
+  struct snapshot_global *globals = NULL;
+  uint64_t i;
+
+  if (!((h->magic == ATTO_SNAPSHOT_MAGIC) &&
+         (h->format_version == ATTO_SNAPSHOT_FORMAT_VERSION) &&
+         (h->compiler_version == ATTO_COMPILER_VERSION) &&
+         (h->byte_order == ATTO_IMAGE_BYTE_ORDER) &&
+         (h->object_size == sizeof(struct atto_object)) &&
+         (h->instruction_size == sizeof(struct atto_instruction)) &&
+         (h->max_heap_objects == ATTO_VM_MAX_HEAP_OBJECTS) &&
+         (h->max_data_stack_size == ATTO_VM_MAX_DATA_STACK_SIZE) &&
+         (h->max_captures == ATTO_VM_MAX_CAPTURES) &&
+         (h->shared_object_table_size == ATTO_VM_SHARED_OBJECT_TABLE_SIZE) &&
+         (h->length == length) &&
+         (h->heap_size <= ATTO_VM_MAX_HEAP_OBJECTS) &&
+         (h->data_stack_size <= ATTO_VM_MAX_DATA_STACK_SIZE) &&
+         (h->number_of_captures <= ATTO_VM_MAX_CAPTURES) &&
+         (h->number_of_symbols <= h->symbol_table_size / 2) &&
+         ((h->symbol_table_size & (h->symbol_table_size - 1)) == 0) &&
+         is_section_inside(h, h->heap, sizeof(struct atto_object) * ATTO_VM_MAX_HEAP_OBJECTS) &&
+         is_section_inside(h, h->data_stack, sizeof(size_t) * ATTO_VM_MAX_DATA_STACK_SIZE) &&
+         is_section_inside(h, h->captures, sizeof(size_t) * ATTO_VM_MAX_CAPTURES) &&
+         is_section_inside(h, h->shared_objects, sizeof(size_t) * ATTO_VM_SHARED_OBJECT_TABLE_SIZE) &&
+         is_section_inside(h, h->instruction_streams, sizeof(struct snapshot_instruction_stream) * h->number_of_instruction_streams) &&
+         is_section_inside(h, h->instructions, sizeof(struct atto_instruction) * h->number_of_instructions) &&
+         is_section_inside(h, h->symbol_names, h->symbol_names_length) &&
+         is_section_inside(h, h->symbol_hashes, sizeof(uint32_t) * h->number_of_symbols) &&
+         is_section_inside(h, h->symbol_table, sizeof(uint32_t) * h->symbol_table_size) &&
+         is_section_inside(h, h->globals, sizeof(struct snapshot_global) * h->number_of_globals) &&
+         is_section_inside(h, h->global_names, h->global_names_length) &&
+         (h->expressions == h->global_names + h->global_names_length))) {
+    return 0;
+  }
+
+  if (!are_names_valid(base + h->symbol_names, h->symbol_names_length, h->number_of_symbols) ||
+      !are_names_valid(base + h->global_names, h->global_names_length, h->number_of_globals)) {
+    return 0;
+  }
+
+  globals = (struct snapshot_global *)(base + h->globals);
+
+  for (i = 0; i < h->number_of_globals; i++) {
+    if (globals[i].name >= h->global_names_length) {
+      return 0;
+    }
+  }
+
+  for (i = 0; i < h->number_of_instruction_streams; i++) {
+    struct snapshot_instruction_stream *is = (struct snapshot_instruction_stream *)(base + h->instruction_streams) + i;
+
+    if ((is->first_instruction > h->number_of_instructions) || (is->length > h->number_of_instructions - is->first_instruction)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ *  reads the expressions kept for the globals of a valid snapshot, which
+ *  are not used from the mapping, since they are trees; returns NULL if
+ *  any of them is damaged, or if anything is left after the last one
+ */
+static struct atto_expression **read_expressions(struct snapshot_header *h, const char *path)
+{
+  struct snapshot_global *globals = (struct snapshot_global *)((char *)h + h->globals);
+  struct atto_expression **expressions = (struct atto_expression **)calloc(h->number_of_globals + 1, sizeof(struct atto_expression *));
+  FILE *f = fopen(path, "rb");
+  uint64_t i;
+  int damaged = (f == NULL) || (fseek(f, (long)h->expressions, SEEK_SET) != 0);
+  assert(expressions != NULL);
+
+  for (i = 0; (i < h->number_of_globals) && !damaged; i++) {
+    if (globals[i].has_expression && ((expressions[i] = atto_read_expression(f)) == NULL)) {
+      damaged = 1;
+    }
+  }
+
+  if (!damaged && (ftell(f) != (long)h->length)) {
+    damaged = 1;
+  }
+
+  if (f != NULL) {
+    fclose(f);
+  }
+
+  if (damaged) {
+    for (i = 0; i < h->number_of_globals; i++) {
+      destroy_expression(expressions[i]);
+    }
+
+    free(expressions);
+    return NULL;
+  }
+
+  return expressions;
+}
+
+/*
+ *  maps a snapshot into a state which was just allocated, and was given
+ *  nothing since; returns whether the snapshot was loaded
+ */
+int atto_load_snapshot(struct atto_state *a, const char *path)
+{
+  struct atto_vm_state *vm = a->vm_state;
+  struct snapshot_header *h = NULL;
+  struct snapshot_instruction_stream *streams = NULL;
+  struct snapshot_global *globals = NULL;
+  struct atto_expression **expressions = NULL;
+  char *base = NULL, *name = NULL;
+  struct stat s;
+  size_t i;
+  int fd;
+
+  if (!atto_is_new_state(a) || (vm->snapshot != NULL)) {
+    printf("error: `%s' can only be loaded into a new state\n", path);
+    return 0;
+  }
+
+  fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    printf("error: unable to open `%s'\n", path);
+    return 0;
+  }
+
+  if ((fstat(fd, &s) != 0) || ((size_t)s.st_size < sizeof(struct snapshot_header))) {
+    printf("error: `%s' is not a snapshot\n", path);
+    close(fd);
+    return 0;
+  }
+
+  base = (char *)mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (base == (char *)MAP_FAILED) {
+    printf("error: unable to map `%s'\n", path);
+    return 0;
+  }
+
+  h = (struct snapshot_header *)base;
+
+  if (!is_valid_snapshot(h, s.st_size)) {
+    printf("error: `%s' is not a snapshot made by this build of atto\n", path);
+    munmap(base, s.st_size);
+    return 0;
+  }
+
+  expressions = read_expressions(h, path);
+
+  if (expressions == NULL) {
+    printf("error: `%s' is damaged\n", path);
+    munmap(base, s.st_size);
+    return 0;
+  }
+
+  /*  the snapshot holds the prelude as well, so whatever the state was
+   *  given when it was allocated is dropped */
+  for (i = 0; i < vm->number_of_instruction_streams; i++) {
+    destroy_instruction_stream(vm->instruction_streams[i]);
+  }
+
+  vm->number_of_instruction_streams = 0;
+
+  atto_destroy_environment(a->global_environment);
+  a->global_environment = atto_allocate_global_environment();
+
+  /*  the arrays the vm had of its own make way for the mapped ones */
+  free(vm->heap);
+  free(vm->data_stack);
+  free(vm->captures);
+  free(vm->shared_objects);
+
+  vm->snapshot = base;
+  vm->snapshot_length = s.st_size;
+
+  vm->heap = (struct atto_object *)(base + h->heap);
+  vm->heap_size = h->heap_size;
+  vm->data_stack = (size_t *)(base + h->data_stack);
+  vm->data_stack_size = h->data_stack_size;
+  vm->captures = (size_t *)(base + h->captures);
+  vm->number_of_captures = h->number_of_captures;
+  vm->shared_objects = (size_t *)(base + h->shared_objects);
+  vm->number_of_shared_allocations = h->number_of_shared_allocations;
+  vm->flags = (vm->flags & ~(ATTO_VM_FLAG_HASH_CONS)) | (h->vm_flags & ATTO_VM_FLAG_HASH_CONS);
+
+  /*  streams refer to their instructions in the mapping; they are never
+   *  written to again, since their bodies were all compiled */
+  streams = (struct snapshot_instruction_stream *)(base + h->instruction_streams);
+
+  for (i = 0; i < h->number_of_instruction_streams; i++) {
+    struct atto_instruction_stream *is = (struct atto_instruction_stream *)malloc(sizeof(struct atto_instruction_stream));
+    assert(is != NULL);
+
+    is->length = streams[i].length;
+    is->allocated_length = streams[i].length;
+    is->stream = (struct atto_instruction *)(base + h->instructions) + streams[i].first_instruction;
+    is->stack_depth = 0;
+    is->number_of_captures = streams[i].number_of_captures;
+    is->number_of_arguments = streams[i].number_of_arguments;
+    is->memoize = streams[i].memoize;
+    is->stub = NULL;
+
+    atto_add_instruction_stream(vm, is);
+  }
+
+  /*  symbol names are used from the mapping, while the hashes and the
+   *  table, which grow along with the symbols, are copied */
+  while (a->number_of_allocated_symbol_slots < h->number_of_symbols) {
+    a->number_of_allocated_symbol_slots *= 2;
+  }
+
+  a->symbol_names = (char **)realloc(a->symbol_names, sizeof(char *) * a->number_of_allocated_symbol_slots);
+  a->symbol_hashes = (uint32_t *)realloc(a->symbol_hashes, sizeof(uint32_t) * a->number_of_allocated_symbol_slots);
+  a->symbol_table = (uint32_t *)realloc(a->symbol_table, sizeof(uint32_t) * h->symbol_table_size);
+  assert((a->symbol_names != NULL) && (a->symbol_hashes != NULL) && (a->symbol_table != NULL));
+
+  name = base + h->symbol_names;
+
+  for (i = 0; i < h->number_of_symbols; i++) {
+    a->symbol_names[i] = name;
+    name += strlen(name) + 1;
+  }
+
+  memcpy(a->symbol_hashes, base + h->symbol_hashes, sizeof(uint32_t) * h->number_of_symbols);
+  memcpy(a->symbol_table, base + h->symbol_table, sizeof(uint32_t) * h->symbol_table_size);
+  a->number_of_symbols = h->number_of_symbols;
+  a->symbol_table_size = h->symbol_table_size;
+
+  globals = (struct snapshot_global *)(base + h->globals);
+
+  for (i = 0; i < h->number_of_globals; i++) {
+    struct atto_environment_object *eo = atto_add_to_environment(a->global_environment,
+      base + h->global_names + globals[i].name, globals[i].kind, globals[i].offset);
+
+    eo->flags = globals[i].flags;
+    eo->strict_parameters = globals[i].strict_parameters;
+    eo->expression = expressions[i];
+  }
+
+  free(expressions);
+
+  return 1;
+}
+
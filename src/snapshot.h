@@ -0,0 +1,19 @@
+/*
+ *  snapshot.h
+ *  part of Atto :: https://github.com/deveah/atto
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "state.h"
+#include "vm.h"
+
+#pragma once
+
+#define ATTO_SNAPSHOT_MAGIC 0x73747461u  /*  "atts" */
+#define ATTO_SNAPSHOT_FORMAT_VERSION 2
+
+int atto_save_snapshot(struct atto_state *a, const char *path);
+int atto_load_snapshot(struct atto_state *a, const char *path);
+
@@ -11,6 +11,10 @@
 #include <stdio.h>
 
 #include "state.h"
+#include "parser.h"
+#include "prepared.h"
+#include "image.h"
+#include "prelude.h"
 
 struct atto_state *atto_allocate_state(void)
 {
@@ -20,56 +24,241 @@ struct atto_state *atto_allocate_state(void)
   a->number_of_symbols = 0;
   a->number_of_allocated_symbol_slots = ATTO_MINIMUM_ALLOCATED_SYMBOL_SLOTS;
   a->symbol_names = (char **)calloc(a->number_of_allocated_symbol_slots, sizeof(char *));
+  a->symbol_hashes = (uint32_t *)calloc(a->number_of_allocated_symbol_slots, sizeof(uint32_t));
+  assert((a->symbol_names != NULL) && (a->symbol_hashes != NULL));
 
-  a->global_environment = (struct atto_environment *)malloc(sizeof(struct atto_environment));
-  assert(a->global_environment != NULL);
-  a->global_environment->head = NULL;
-  a->global_environment->parent = NULL;
+  a->symbol_table_size = ATTO_MINIMUM_SYMBOL_TABLE_SIZE;
+  a->symbol_table = (uint32_t *)calloc(a->symbol_table_size, sizeof(uint32_t));
+  assert(a->symbol_table != NULL);
+  a->symbol_name_arena = atto_allocate_arena(ATTO_ARENA_DEFAULT_BLOCK_SIZE);
+
+  a->global_environment = atto_allocate_global_environment();
+
+  a->inline_size_limit = ATTO_DEFAULT_INLINE_SIZE_LIMIT;
+  a->inline_depth_limit = ATTO_DEFAULT_INLINE_DEPTH_LIMIT;
+
+  a->specialization_size_limit = ATTO_DEFAULT_SPECIALIZATION_SIZE_LIMIT;
+  a->specialization_depth_limit = ATTO_DEFAULT_SPECIALIZATION_DEPTH_LIMIT;
+  a->specialization_depth = 0;
+
+  a->use_fast_frontend = 0;
+  a->number_of_errors = 0;
+  a->prepared_expressions = atto_allocate_prepared_cache(ATTO_PREPARED_DEFAULT_CAPACITY);
+
+  a->parse_arena = atto_allocate_arena(ATTO_ARENA_DEFAULT_BLOCK_SIZE);
+
+  a->vm_state = atto_allocate_vm_state();
 
   /* 0 */ atto_save_symbol(a, "false");
   /* 1 */ atto_save_symbol(a, "true");
 
+  /*  the prelude was compiled when atto was built, and is linked into the
+   *  executable as an image, so it is loaded without being parsed */
+  if (atto_prelude_image_length > 0) {
+    atto_load_image_from_memory(a, atto_prelude_image, atto_prelude_image_length, "prelude");
+  }
+
   return a;
 }
 
 void atto_destroy_state(struct atto_state *a)
 {
-  uint32_t i;
-  struct atto_environment_object *current = a->global_environment->head;
+  atto_destroy_vm_state(a->vm_state);
+  atto_destroy_environment(a->global_environment);
+  atto_destroy_arena(a->parse_arena);
+  atto_destroy_prepared_cache(a->prepared_expressions);
 
-  for (i = 0; i < a->number_of_symbols; i++) {
-    free(a->symbol_names[i]);
-  }
+  free(a->symbol_names);
+  free(a->symbol_hashes);
+  free(a->symbol_table);
+  atto_destroy_arena(a->symbol_name_arena);
+  free(a);
+}
 
-  while (current) {
-    struct atto_environment_object *temp = current->next;
-    free(current->name);
-    free(current);
-    current = temp;
+/*
+ *  returns the slot of the symbol table which holds the symbol with the
+ *  given name, or the empty slot where it would go
+ */
+static uint32_t *find_symbol_slot(struct atto_state *a, const char *name, size_t length, uint32_t hash)
+{
+  uint32_t i = hash & (a->symbol_table_size - 1);
+
+  while (a->symbol_table[i] != 0) {
+    uint32_t symbol = a->symbol_table[i] - 1;
+
+    if ((a->symbol_hashes[symbol] == hash) &&
+        (strncmp(a->symbol_names[symbol], name, length) == 0) &&
+        (a->symbol_names[symbol][length] == 0)) {
+      break;
+    }
+
+    i = (i + 1) & (a->symbol_table_size - 1);
   }
 
-  free(a->symbol_names);
-  free(a);
+  return &a->symbol_table[i];
 }
 
-uint64_t atto_save_symbol(struct atto_state *a, char *name)
+static void grow_symbol_table(struct atto_state *a)
 {
-  char *temp = (char *)malloc(sizeof(char) * (strlen(name) + 1));
-  assert(temp != NULL);
-  strcpy(temp, name);
+  uint32_t i;
+
+  free(a->symbol_table);
 
+  a->symbol_table_size *= 2;
+  a->symbol_table = (uint32_t *)calloc(a->symbol_table_size, sizeof(uint32_t));
+  assert(a->symbol_table != NULL);
+
+  for (i = 0; i < a->number_of_symbols; i++) {
+    uint32_t j = a->symbol_hashes[i] & (a->symbol_table_size - 1);
+
+    while (a->symbol_table[j] != 0) {
+      j = (j + 1) & (a->symbol_table_size - 1);
+    }
+
+    a->symbol_table[j] = i + 1;
+  }
+}
+
+static uint64_t save_symbol(struct atto_state *a, const char *name, size_t length, uint32_t hash)
+{
   if (a->number_of_symbols == a->number_of_allocated_symbol_slots) {
     a->number_of_allocated_symbol_slots *= 2; /*  that should do it */
     a->symbol_names = (char**)realloc(a->symbol_names, a->number_of_allocated_symbol_slots * sizeof(char *));
+    assert(a->symbol_names != NULL);
+    a->symbol_hashes = (uint32_t *)realloc(a->symbol_hashes, a->number_of_allocated_symbol_slots * sizeof(uint32_t));
+    assert(a->symbol_hashes != NULL);
   }
 
-  a->symbol_names[a->number_of_symbols] = temp;
+  a->symbol_names[a->number_of_symbols] = atto_arena_copy_string(a->symbol_name_arena, name, length);
+  a->symbol_hashes[a->number_of_symbols] = hash;
   a->number_of_symbols++;
 
+  if (2 * a->number_of_symbols > a->symbol_table_size) {
+    grow_symbol_table(a);
+  } else {
+    *find_symbol_slot(a, name, length, hash) = a->number_of_symbols;
+  }
+
   return (a->number_of_symbols - 1);
 }
 
-void atto_add_to_environment(struct atto_environment *env, char *name, uint8_t kind, size_t offset)
+/*
+ *  saves a symbol which has not been seen before
+ */
+uint64_t atto_save_symbol(struct atto_state *a, char *name)
+{
+  size_t length = strlen(name);
+
+  return save_symbol(a, name, length, atto_hash_bytes(ATTO_HASH_SEED, name, length));
+}
+
+/*
+ *  returns the number of the symbol with the given name, which need not be
+ *  null terminated, saving it first if it has not been seen before
+ */
+uint64_t atto_intern_symbol(struct atto_state *a, const char *name, size_t length)
+{
+  uint32_t hash = atto_hash_bytes(ATTO_HASH_SEED, name, length);
+  uint32_t *slot = find_symbol_slot(a, name, length, hash);
+
+  if (*slot != 0) {
+    return *slot - 1;
+  }
+
+  return save_symbol(a, name, length, hash);
+}
+
+/*
+ *  hashes bytes with FNV-1a, going on from `hash', so that several pieces
+ *  may be hashed one after the other; the first piece starts from
+ *  ATTO_HASH_SEED. every hash in atto is built on this one
+ */
+uint32_t atto_hash_bytes(uint32_t hash, const void *bytes, size_t length)
+{
+  const unsigned char *current = (const unsigned char *)bytes;
+
+  while (length--) {
+    hash ^= *current++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+uint32_t atto_hash_name(const char *name)
+{
+  return atto_hash_bytes(ATTO_HASH_SEED, name, strlen(name));
+}
+
+struct atto_environment *atto_allocate_environment(struct atto_environment *parent)
+{
+  struct atto_environment *env = (struct atto_environment *)malloc(sizeof(struct atto_environment));
+  assert(env != NULL);
+
+  env->head = NULL;
+  env->parent = parent;
+  env->number_of_objects = 0;
+  env->buckets = NULL;
+  env->number_of_buckets = 0;
+  env->source = NULL;
+
+  return env;
+}
+
+struct atto_environment *atto_allocate_global_environment(void)
+{
+  struct atto_environment *env = atto_allocate_environment(NULL);
+
+  env->number_of_buckets = ATTO_ENVIRONMENT_MINIMUM_BUCKETS;
+  env->buckets = (struct atto_environment_object **)calloc(env->number_of_buckets, sizeof(struct atto_environment_object *));
+  assert(env->buckets != NULL);
+
+  return env;
+}
+
+struct atto_environment *atto_allocate_environment_view(struct atto_environment *source, struct atto_environment_object *head)
+{
+  struct atto_environment *env = atto_allocate_environment(NULL);
+
+  env->head = head;
+  env->source = source;
+
+  return env;
+}
+
+/*
+ *  doubles the number of buckets of an indexed environment; objects are
+ *  appended to their new buckets from the most recent one, which keeps
+ *  every bucket in that order
+ */
+static void grow_buckets(struct atto_environment *env)
+{
+  size_t number_of_buckets = env->number_of_buckets * 2;
+  struct atto_environment_object **buckets = (struct atto_environment_object **)calloc(number_of_buckets, sizeof(struct atto_environment_object *));
+  struct atto_environment_object ***tails = (struct atto_environment_object ***)malloc(sizeof(struct atto_environment_object **) * number_of_buckets);
+  struct atto_environment_object *current = NULL;
+  size_t i;
+  assert(buckets != NULL);
+  assert(tails != NULL);
+
+  for (i = 0; i < number_of_buckets; i++) {
+    tails[i] = &buckets[i];
+  }
+
+  for (current = env->head; current != NULL; current = current->next) {
+    i = current->hash & (number_of_buckets - 1);
+    current->bucket_next = NULL;
+    *tails[i] = current;
+    tails[i] = &current->bucket_next;
+  }
+
+  free(tails);
+  free(env->buckets);
+  env->buckets = buckets;
+  env->number_of_buckets = number_of_buckets;
+}
+
+struct atto_environment_object *atto_add_to_environment(struct atto_environment *env, char *name, uint8_t kind, size_t offset)
 {
   char *temp = (char *)malloc(sizeof(char) * (strlen(name) + 1));
   assert(temp != NULL);
@@ -80,28 +269,136 @@ void atto_add_to_environment(struct atto_environment *env, char *name, uint8_t k
 
   eo->name = temp;
   eo->kind = kind;
+  eo->flags = 0;
+  eo->strict_parameters = 0;
+  eo->expression = NULL;
   eo->offset = offset;
   eo->next = env->head;
+  eo->hash = atto_hash_name(name);
+  eo->bucket_next = NULL;
+  eo->sequence = env->number_of_objects;
   env->head = eo;
+  env->number_of_objects++;
+
+  if (env->buckets != NULL) {
+    size_t i;
+
+    if (env->number_of_objects > env->number_of_buckets) {
+      grow_buckets(env);
+    } else {
+      i = eo->hash & (env->number_of_buckets - 1);
+      eo->bucket_next = env->buckets[i];
+      env->buckets[i] = eo;
+    }
+  }
+
+  return eo;
 }
 
-struct atto_environment_object *atto_find_in_environment(struct atto_environment *env, char *name)
+/*
+ *  finds the most recent object of a given name in an indexed environment,
+ *  ignoring those added after `head'
+ */
+static struct atto_environment_object *find_in_buckets(struct atto_environment *env,
+  struct atto_environment_object *head, const char *name, uint32_t hash)
+{
+  struct atto_environment_object *current = env->buckets[hash & (env->number_of_buckets - 1)];
+
+  if (head == NULL) {
+    return NULL;
+  }
+
+  while (current) {
+    if ((current->sequence <= head->sequence) &&
+        (current->hash == hash) &&
+        (strcmp(current->name, name) == 0)) {
+      return current;
+    }
+
+    current = current->bucket_next;
+  }
+
+  return NULL;
+}
+
+static struct atto_environment_object *find_in_single_environment(struct atto_environment *env,
+  const char *name, uint32_t hash)
 {
   struct atto_environment_object *current = env->head;
 
+  if (env->source != NULL) {
+    return find_in_buckets(env->source, env->head, name, hash);
+  }
+
+  if (env->buckets != NULL) {
+    return find_in_buckets(env, env->head, name, hash);
+  }
+
   while (current) {
-    if (strcmp(current->name, name) == 0) {
+    if ((current->hash == hash) && (strcmp(current->name, name) == 0)) {
       return current;
     }
 
     current = current->next;
   }
 
-  if (env->parent == NULL) {
-    return NULL;
+  return NULL;
+}
+
+struct atto_environment_object *atto_find_in_environment(struct atto_environment *env, char *name)
+{
+  uint32_t hash = atto_hash_name(name);
+
+  while (env) {
+    struct atto_environment_object *eo = find_in_single_environment(env, name, hash);
+
+    if (eo != NULL) {
+      return eo;
+    }
+
+    env = env->parent;
+  }
+
+  return NULL;
+}
+
+/*
+ *  finds a global as it was when `head' was the most recently defined one;
+ *  `env' may be any environment nested in the global environment
+ */
+struct atto_environment_object *atto_find_in_scope(struct atto_environment *env, struct atto_environment_object *head, char *name)
+{
+  while (env->parent != NULL) {
+    env = env->parent;
+  }
+
+  if (env->source != NULL) {
+    env = env->source;
+  }
+
+  return find_in_buckets(env, head, name, atto_hash_name(name));
+}
+
+/*
+ *  deallocates a local environment, leaving its parents untouched; views
+ *  own none of the objects they show
+ */
+void atto_destroy_environment(struct atto_environment *env)
+{
+  struct atto_environment_object *current = env->head;
+
+  while (current && (env->source == NULL)) {
+    struct atto_environment_object *temp = current->next;
+    free(current->name);
+    if (current->expression != NULL) {
+      destroy_expression(current->expression);
+    }
+    free(current);
+    current = temp;
   }
 
-  return atto_find_in_environment(env->parent, name);
+  free(env->buckets);
+  free(env);
 }
 
 size_t atto_get_object(struct atto_state *a, struct atto_environment_object *eo)
@@ -7,12 +7,20 @@
 #include <stdint.h>
 
 #include "vm.h"
+#include "arena.h"
 
 #pragma once
 
 #define ATTO_MINIMUM_ALLOCATED_SYMBOL_SLOTS       16
+#define ATTO_MINIMUM_SYMBOL_TABLE_SIZE            32
 #define ATTO_MINIMUM_ALLOCATED_GLOBAL_TABLE_SLOTS 16
 
+#define ATTO_DEFAULT_INLINE_SIZE_LIMIT  12
+#define ATTO_DEFAULT_INLINE_DEPTH_LIMIT 4
+
+#define ATTO_DEFAULT_SPECIALIZATION_SIZE_LIMIT  256
+#define ATTO_DEFAULT_SPECIALIZATION_DEPTH_LIMIT 4
+
 struct atto_lambda {
   uint32_t number_of_instructions;
   uint8_t *instruction_stream;
@@ -24,26 +32,98 @@ struct atto_environment_object {
   #define ATTO_ENVIRONMENT_OBJECT_KIND_GLOBAL   0
   #define ATTO_ENVIRONMENT_OBJECT_KIND_LOCAL    1
   #define ATTO_ENVIRONMENT_OBJECT_KIND_ARGUMENT 2
+  #define ATTO_ENVIRONMENT_OBJECT_KIND_CAPTURE  3
   uint8_t kind;
 
+  /*  set when the object is known to never hold an unevaluated thunk */
+  #define ATTO_ENVIRONMENT_OBJECT_FLAG_EVALUATED (1<<0)
+  uint8_t flags;
+
+  /*  for lambdas, a bit mask of the parameters which are always forced */
+  uint32_t strict_parameters;
+
+  /*  for lambdas, the defining expression, kept around for inlining */
+  struct atto_expression *expression;
+
   size_t offset;
   struct atto_environment_object *next;
+
+  /*  the hash of the name, and, in environments indexed by name, the next
+   *  object in the same bucket */
+  uint32_t hash;
+  struct atto_environment_object *bucket_next;
+
+  /*  the number of objects added to the environment before this one */
+  size_t sequence;
 };
 
+#define ATTO_ENVIRONMENT_MINIMUM_BUCKETS 64
+
 struct atto_environment {
   struct atto_environment_object *head;
   struct atto_environment *parent;
+  size_t number_of_objects;
+
+  /*  the global environment is indexed by name, each bucket listing its
+   *  objects from the most recently added one; local environments are
+   *  small enough to be searched from their head */
+  struct atto_environment_object **buckets;
+  size_t number_of_buckets;
+
+  /*  an environment may also be a view of the global environment as it was
+   *  when `head' was its most recently added object; it owns no objects,
+   *  and looks them up through the index of `source' */
+  struct atto_environment *source;
 };
 
+struct atto_prepared_cache;
+
 struct atto_state {
   char **symbol_names;
+  uint32_t *symbol_hashes;
   uint32_t number_of_symbols;
   uint32_t number_of_allocated_symbol_slots;
 
+  /*  symbols are found by name through an open addressing table, kept at
+   *  most half full, whose slots hold symbol numbers plus one, so that zero
+   *  marks an empty slot; the names themselves are kept in an arena */
+  uint32_t *symbol_table;
+  uint32_t symbol_table_size;
+  struct atto_arena *symbol_name_arena;
+
   struct atto_vm_state *vm_state;
 
   struct atto_environment *global_environment;
   size_t global_object_count;
+
+  /*  global lambdas whose bodies are at most `inline_size_limit' expressions
+   *  large are inlined into their callers, and the bodies thus inlined are
+   *  themselves searched for calls to inline at most `inline_depth_limit'
+   *  times; a limit of zero disables inlining */
+  size_t inline_size_limit;
+  size_t inline_depth_limit;
+
+  /*  global lambdas whose bodies are at most `specialization_size_limit'
+   *  expressions large are specialized for the constants they are called
+   *  with; specializing a body may lead to specializing the lambdas it
+   *  calls, which is done at most `specialization_depth_limit' times */
+  size_t specialization_size_limit;
+  size_t specialization_depth_limit;
+  size_t specialization_depth;
+
+  /*  whether top-level expressions are first handed to the single pass
+   *  frontend, which compiles the forms it knows straight from source */
+  uint8_t use_fast_frontend;
+
+  /*  the number of errors the compiler has reported so far */
+  size_t number_of_errors;
+
+  /*  top-level expressions which were compiled before, by their text */
+  struct atto_prepared_cache *prepared_expressions;
+
+  /*  syntax trees only live as long as the top-level form they were read
+   *  from, and are allocated from an arena which is reset after each one */
+  struct atto_arena *parse_arena;
 };
 
 struct atto_state *atto_allocate_state(void);
@@ -52,9 +132,19 @@ void atto_destroy_object(struct atto_object *o);
 void atto_destroy_state(struct atto_state *a);
 
 uint64_t atto_save_symbol(struct atto_state *a, char *name);
+uint64_t atto_intern_symbol(struct atto_state *a, const char *name, size_t length);
+
+#define ATTO_HASH_SEED 2166136261u
+uint32_t atto_hash_bytes(uint32_t hash, const void *bytes, size_t length);
+uint32_t atto_hash_name(const char *name);
 
-void atto_add_to_environment(struct atto_environment *env, char *name, uint8_t kind, size_t offset);
+struct atto_environment *atto_allocate_environment(struct atto_environment *parent);
+struct atto_environment *atto_allocate_global_environment(void);
+struct atto_environment *atto_allocate_environment_view(struct atto_environment *source, struct atto_environment_object *head);
+struct atto_environment_object *atto_add_to_environment(struct atto_environment *env, char *name, uint8_t kind, size_t offset);
 struct atto_environment_object *atto_find_in_environment(struct atto_environment *env, char *name);
+struct atto_environment_object *atto_find_in_scope(struct atto_environment *env, struct atto_environment_object *head, char *name);
+void atto_destroy_environment(struct atto_environment *env);
 
 size_t atto_get_object(struct atto_state *a, struct atto_environment_object *eo);
 
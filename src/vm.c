@@ -4,12 +4,18 @@
  *  part of Atto :: https://github.com/deveah/atto
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
+#include "state.h"
 #include "compiler.h"
+#include "builtins.h"
+#include "memo.h"
 #include "vm.h"
 
 
@@ -37,19 +43,253 @@ struct atto_vm_state *atto_allocate_vm_state(void)
   vm->current_instruction_stream_index = 0;
   vm->current_instruction_stream_index = 0;
 
+  vm->number_of_captures = 0;
+  vm->captures = (size_t *)malloc(sizeof(size_t) * ATTO_VM_MAX_CAPTURES);
+  assert(vm->captures != NULL);
+  vm->current_captures = NULL;
+
+  vm->memo_cache = atto_allocate_memo_cache(ATTO_MEMO_DEFAULT_CAPACITY);
+
+  vm->shared_objects = (size_t *)calloc(ATTO_VM_SHARED_OBJECT_TABLE_SIZE, sizeof(size_t));
+  assert(vm->shared_objects != NULL);
+  vm->number_of_shared_allocations = 0;
+
   vm->flags = 0x00;
+  vm->failure = NULL;
+
+  vm->snapshot = NULL;
+  vm->snapshot_length = 0;
 
   return vm;
 }
 
 void atto_destroy_vm_state(struct atto_vm_state *vm)
 {
-  free(vm->data_stack);
+  size_t i;
+
+  /*  streams loaded from a snapshot keep their instructions in it */
+  for (i = 0; i < vm->number_of_instruction_streams; i++) {
+    struct atto_instruction_stream *is = vm->instruction_streams[i];
+    char *instructions = (char *)is->stream;
+
+    if ((vm->snapshot != NULL) && (instructions >= (char *)vm->snapshot) &&
+        (instructions < (char *)vm->snapshot + vm->snapshot_length)) {
+      free(is);
+    } else {
+      destroy_instruction_stream(is);
+    }
+  }
+
+  if (vm->snapshot != NULL) {
+    munmap(vm->snapshot, vm->snapshot_length);
+  } else {
+    free(vm->data_stack);
+    free(vm->heap);
+    free(vm->captures);
+    free(vm->shared_objects);
+  }
+
   free(vm->call_stack);
   free(vm->instruction_streams);
+  atto_destroy_memo_cache(vm->memo_cache);
   free(vm);
 }
 
+/*
+ *  claims room for the values captured by a lambda, returning where they
+ *  start in the capture pool; lambdas which capture nothing all start at
+ *  zero, so that they are told apart only by their bodies
+ */
+size_t atto_allocate_captures(struct atto_vm_state *vm, size_t number_of_captures)
+{
+  size_t captures = vm->number_of_captures;
+
+  if (number_of_captures == 0) {
+    return 0;
+  }
+
+  if (number_of_captures > ATTO_VM_MAX_CAPTURES - vm->number_of_captures) {
+    printf("vm: fatal: out of room for captured values\n");
+    exit(1);
+  }
+
+  vm->number_of_captures += number_of_captures;
+
+  return captures;
+}
+
+/*
+ *  makes sure that a top-level form can leave one more value at the bottom
+ *  of the data stack, without taking the room kept for evaluating
+ */
+void atto_claim_global_slot(struct atto_vm_state *vm)
+{
+  if (vm->data_stack_size >= ATTO_VM_MAX_GLOBALS) {
+    printf("vm: fatal: too many globals\n");
+    exit(1);
+  }
+}
+
+static int is_shareable(struct atto_object *o)
+{
+  return ((o->kind == ATTO_OBJECT_KIND_NULL) ||
+          (o->kind == ATTO_OBJECT_KIND_NUMBER) ||
+          (o->kind == ATTO_OBJECT_KIND_SYMBOL) ||
+          (o->kind == ATTO_OBJECT_KIND_LIST));
+}
+
+/*
+ *  numbers are told apart by their representation, so that `0' and `-0'
+ *  are never shared, since they print differently
+ */
+static int is_same_value(struct atto_object *a, struct atto_object *b)
+{
+  if (a->kind != b->kind) {
+    return 0;
+  }
+
+  switch (a->kind) {
+  case ATTO_OBJECT_KIND_NUMBER:
+    return (memcmp(&a->container.number, &b->container.number, sizeof(double)) == 0);
+  case ATTO_OBJECT_KIND_SYMBOL:
+    return (a->container.symbol == b->container.symbol);
+  case ATTO_OBJECT_KIND_LIST:
+    return ((a->container.list.car == b->container.list.car) &&
+            (a->container.list.cdr == b->container.list.cdr));
+  default:
+    return 1;
+  }
+}
+
+/*
+ *  returns the slot of the shared object table which holds the object
+ *  with the same value as `o', or the empty slot where it would go; slots
+ *  hold heap indices plus one, so that zero marks an empty slot. the table
+ *  has room for twice as many objects as the heap does, so it never fills
+ */
+static size_t *find_shared_slot(struct atto_vm_state *vm, struct atto_object *o)
+{
+  uint32_t hash = atto_hash_bytes(ATTO_HASH_SEED, &o->kind, sizeof(uint8_t));
+  size_t i;
+
+  if (o->kind == ATTO_OBJECT_KIND_NUMBER) {
+    hash = atto_hash_bytes(hash, &o->container.number, sizeof(double));
+  } else if (o->kind == ATTO_OBJECT_KIND_SYMBOL) {
+    hash = atto_hash_bytes(hash, &o->container.symbol, sizeof(uint64_t));
+  } else if (o->kind == ATTO_OBJECT_KIND_LIST) {
+    hash = atto_hash_bytes(hash, &o->container.list.car, sizeof(size_t));
+    hash = atto_hash_bytes(hash, &o->container.list.cdr, sizeof(size_t));
+  }
+
+  i = hash & (ATTO_VM_SHARED_OBJECT_TABLE_SIZE - 1);
+
+  while ((vm->shared_objects[i] != 0) &&
+         !is_same_value(&vm->heap[vm->shared_objects[i] - 1], o)) {
+    i = (i + 1) & (ATTO_VM_SHARED_OBJECT_TABLE_SIZE - 1);
+  }
+
+  return &vm->shared_objects[i];
+}
+
+/*
+ *  with hash-consing enabled, an object is only allocated if no object
+ *  with the same value was allocated before while hash-consing was enabled;
+ *  otherwise, that object is returned instead. this is safe because none of
+ *  the shareable kinds are ever written to once allocated, as only thunks
+ *  are replaced in place
+ */
+static size_t allocate_object(struct atto_vm_state *vm, struct atto_object *o)
+{
+  size_t *slot = NULL, index;
+
+  if (vm->flags & ATTO_VM_FLAG_HASH_CONS) {
+    slot = find_shared_slot(vm, o);
+
+    if (*slot != 0) {
+      vm->number_of_shared_allocations++;
+      return *slot - 1;
+    }
+  }
+
+  index = vm->heap_size++;
+  vm->heap[index] = *o;
+
+  if (slot != NULL) {
+    *slot = index + 1;
+  }
+
+  return index;
+}
+
+size_t atto_allocate_null(struct atto_vm_state *vm)
+{
+  struct atto_object o;
+
+  o.kind = ATTO_OBJECT_KIND_NULL;
+
+  return allocate_object(vm, &o);
+}
+
+size_t atto_allocate_number(struct atto_vm_state *vm, double number)
+{
+  struct atto_object o;
+
+  o.kind = ATTO_OBJECT_KIND_NUMBER;
+  o.container.number = number;
+
+  return allocate_object(vm, &o);
+}
+
+size_t atto_allocate_symbol(struct atto_vm_state *vm, uint64_t symbol)
+{
+  struct atto_object o;
+
+  o.kind = ATTO_OBJECT_KIND_SYMBOL;
+  o.container.symbol = symbol;
+
+  return allocate_object(vm, &o);
+}
+
+size_t atto_allocate_list(struct atto_vm_state *vm, size_t car, size_t cdr)
+{
+  struct atto_object o;
+
+  o.kind = ATTO_OBJECT_KIND_LIST;
+  o.container.list.car = car;
+  o.container.list.cdr = cdr;
+
+  return allocate_object(vm, &o);
+}
+
+/*
+ *  hash-conses an object which was filled in after being allocated, such
+ *  as the result of a native function; if an object with the same value is
+ *  found, that one is returned, and the given one is given back to the heap
+ *  if nothing was allocated after it
+ */
+size_t atto_share_object(struct atto_vm_state *vm, size_t index)
+{
+  size_t *slot = NULL;
+
+  if (!(vm->flags & ATTO_VM_FLAG_HASH_CONS) || !is_shareable(&vm->heap[index])) {
+    return index;
+  }
+
+  slot = find_shared_slot(vm, &vm->heap[index]);
+
+  if (*slot == 0) {
+    *slot = index + 1;
+    return index;
+  }
+
+  if (index == vm->heap_size - 1) {
+    vm->heap_size--;
+  }
+
+  vm->number_of_shared_allocations++;
+  return *slot - 1;
+}
+
 void atto_vm_perform_step(struct atto_vm_state *vm)
 {
   struct atto_instruction_stream *current_instruction_stream = vm->instruction_streams[vm->current_instruction_stream_index];
@@ -66,20 +306,51 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     break;
   }
 
+  /*  calls of memoized lambdas force their arguments, and are skipped if
+   *  they were made before with the same argument values */
   case ATTO_VM_OP_CALL: {
     size_t target_instruction_stream;
+    uint8_t memoize = 0;
 
     struct atto_object *fn = &vm->heap[vm->data_stack[vm->data_stack_size-1]];
 
     if (fn->kind != ATTO_OBJECT_KIND_LAMBDA) {
       printf("vm: fatal: attempting to call non-lambda object\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size--;
 
-    target_instruction_stream = fn->container.instruction_stream_index;
+    target_instruction_stream = fn->container.lambda.instruction_stream_index;
+
+    if (vm->instruction_streams[target_instruction_stream]->stub != NULL) {
+      compile_lambda_stub(vm->instruction_streams[target_instruction_stream]);
+    }
+
+    if (vm->instruction_streams[target_instruction_stream]->memoize) {
+      size_t number_of_arguments = vm->instruction_streams[target_instruction_stream]->number_of_arguments,
+             *arguments = &vm->data_stack[vm->data_stack_size - number_of_arguments],
+             result, i;
+
+      for (i = 0; i < number_of_arguments; i++) {
+        evaluate_thunk(vm, arguments[i]);
+      }
+
+      memoize = atto_memo_is_cacheable(vm->heap, arguments, number_of_arguments);
+
+      if (memoize && atto_memo_lookup(vm->memo_cache, vm->heap, target_instruction_stream, arguments, number_of_arguments, &result)) {
+        if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+          printf("vm: %04lu call (remembered)\n", vm->current_instruction_offset);
+        }
+
+        vm->data_stack[vm->data_stack_size] = result;
+        vm->data_stack_size++;
+
+        vm->current_instruction_offset++;
+        break;
+      }
+    }
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu call\n", vm->current_instruction_offset);
@@ -89,10 +360,13 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     vm->call_stack[vm->call_stack_size].instruction_stream_index = vm->current_instruction_stream_index;
     vm->call_stack[vm->call_stack_size].instruction_offset = vm->current_instruction_offset + sizeof(uint8_t);
     vm->call_stack[vm->call_stack_size].stack_offset_at_entrypoint = vm->data_stack_size;
+    vm->call_stack[vm->call_stack_size].captures = vm->current_captures;
+    vm->call_stack[vm->call_stack_size].memoize = memoize;
     vm->call_stack_size++;
 
     vm->current_instruction_stream_index = target_instruction_stream;
     vm->current_instruction_offset = 0;
+    vm->current_captures = &vm->captures[fn->container.lambda.captures];
     break;
   }
 
@@ -113,9 +387,20 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     }
 
     vm->call_stack_size--;
+
+    /*  the arguments are still right below the frame */
+    if (vm->call_stack[vm->call_stack_size].memoize) {
+      size_t number_of_arguments = vm->instruction_streams[vm->current_instruction_stream_index]->number_of_arguments;
+
+      atto_memo_store(vm->memo_cache, vm->heap, vm->current_instruction_stream_index,
+        &vm->data_stack[vm->call_stack[vm->call_stack_size].stack_offset_at_entrypoint - number_of_arguments],
+        number_of_arguments, vm->data_stack[vm->data_stack_size - 1]);
+    }
+
     vm->current_instruction_stream_index = vm->call_stack[vm->call_stack_size].instruction_stream_index;
     vm->current_instruction_offset = vm->call_stack[vm->call_stack_size].instruction_offset;
     vm->data_stack_size = vm->call_stack[vm->call_stack_size].stack_offset_at_entrypoint + 1;
+    vm->current_captures = vm->call_stack[vm->call_stack_size].captures;
     break;
   }
 
@@ -135,7 +420,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
 
     if (vm->heap[vm->data_stack[vm->data_stack_size-1]].kind != ATTO_OBJECT_KIND_SYMBOL) {
       printf("vm: fatal: attempting to conditionally branch, but no symbol is present.\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       break;
     }
 
@@ -156,7 +441,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
 
     if (vm->heap[vm->data_stack[vm->data_stack_size-1]].kind != ATTO_OBJECT_KIND_SYMBOL) {
       printf("vm: fatal: attempting to conditionally branch, but no symbol is present.\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       break;
     }
 
@@ -191,10 +476,67 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     break;
   }
 
+  case ATTO_VM_OP_FAIL: {
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu fail\n", vm->current_instruction_offset);
+    }
+
+    printf("vm: fatal: attempting to call a lambda whose body failed to compile\n");
+    atto_vm_fail(vm);
+    break;
+  }
+
+  case ATTO_VM_OP_EVAL: {
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu eval\n", vm->current_instruction_offset);
+    }
+
+    evaluate_thunk(vm, vm->data_stack[vm->data_stack_size - 1]);
+
+    vm->current_instruction_offset++;
+    break;
+  }
+
+  /*  native functions read their arguments straight off the stack, where
+   *  they were pushed in the order in which they were written */
+  case ATTO_VM_OP_CALLNATIVE: {
+    const struct atto_builtin *b = atto_get_native(current_instruction->container.offset);
+    size_t *arguments = &vm->data_stack[vm->data_stack_size - b->arity],
+           c = vm->heap_size++;
+    uint32_t i;
+
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu callnative %s\n", vm->current_instruction_offset, b->name);
+    }
+
+    for (i = 0; i < b->arity; i++) {
+      if (vm->heap[arguments[i]].kind == ATTO_OBJECT_KIND_THUNK) {
+        evaluate_thunk(vm, arguments[i]);
+      }
+    }
+
+    vm->heap[c].kind = ATTO_OBJECT_KIND_NULL;
+
+    if (!b->function(vm, arguments, &vm->heap[c])) {
+      printf("vm: fatal: native function `%s' failed\n", b->name);
+      atto_vm_fail(vm);
+      return;
+    }
+
+    c = atto_share_object(vm, c);
+
+    vm->data_stack_size -= b->arity;
+    vm->data_stack[vm->data_stack_size] = c;
+    vm->data_stack_size++;
+
+    vm->current_instruction_offset++;
+    break;
+  }
+
   case ATTO_VM_OP_ADD: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu add\n", vm->current_instruction_offset);
@@ -211,13 +553,12 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `add' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_NUMBER;
-    vm->heap[c].container.number = vm->heap[a].container.number + vm->heap[b].container.number;
+    c = atto_allocate_number(vm, vm->heap[a].container.number + vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
@@ -227,7 +568,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_SUB: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu sub\n", vm->current_instruction_offset);
@@ -244,13 +585,12 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `sub' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_NUMBER;
-    vm->heap[c].container.number = vm->heap[a].container.number - vm->heap[b].container.number;
+    c = atto_allocate_number(vm, vm->heap[a].container.number - vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
@@ -260,7 +600,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_MUL: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu mul\n", vm->current_instruction_offset);
@@ -277,13 +617,12 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `mul' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_NUMBER;
-    vm->heap[c].container.number = vm->heap[a].container.number * vm->heap[b].container.number;
+    c = atto_allocate_number(vm, vm->heap[a].container.number * vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
@@ -293,10 +632,10 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_DIV: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
-      printf("vm: %04lu mul\n", vm->current_instruction_offset);
+      printf("vm: %04lu div\n", vm->current_instruction_offset);
     }
 
     if (vm->heap[a].kind == ATTO_OBJECT_KIND_THUNK) {
@@ -310,13 +649,12 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `div' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_NUMBER;
-    vm->heap[c].container.number = vm->heap[a].container.number * vm->heap[b].container.number;
+    c = atto_allocate_number(vm, vm->heap[a].container.number / vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
@@ -326,7 +664,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_ISEQ: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu iseq\n", vm->current_instruction_offset);
@@ -343,13 +681,12 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `iseq' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_SYMBOL;
-    vm->heap[c].container.number = (vm->heap[a].container.number == vm->heap[b].container.number);
+    c = atto_allocate_symbol(vm, vm->heap[a].container.number == vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
@@ -359,7 +696,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_ISLT: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu islt\n", vm->current_instruction_offset);
@@ -376,13 +713,12 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `islt' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_SYMBOL;
-    vm->heap[c].container.number = (vm->heap[a].container.number < vm->heap[b].container.number);
+    c = atto_allocate_symbol(vm, vm->heap[a].container.number < vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
@@ -392,7 +728,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_ISLET: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu islt\n", vm->current_instruction_offset);
@@ -409,13 +745,12 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `islet' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_SYMBOL;
-    vm->heap[c].container.number = (vm->heap[a].container.number <= vm->heap[b].container.number);
+    c = atto_allocate_symbol(vm, vm->heap[a].container.number <= vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
@@ -425,7 +760,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_ISGT: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu isgt\n", vm->current_instruction_offset);
@@ -442,13 +777,12 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `isgt' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_SYMBOL;
-    vm->heap[c].container.number = (vm->heap[a].container.number > vm->heap[b].container.number);
+    c = atto_allocate_symbol(vm, vm->heap[a].container.number > vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
@@ -458,7 +792,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_ISGET: {
     size_t a = vm->data_stack[vm->data_stack_size-1],
            b = vm->data_stack[vm->data_stack_size-2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu isget\n", vm->current_instruction_offset);
@@ -475,45 +809,166 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     if ((vm->heap[a].kind != ATTO_OBJECT_KIND_NUMBER) ||
         (vm->heap[b].kind != ATTO_OBJECT_KIND_NUMBER)) {
       printf("vm: fatal: attempting to perform `isget' on non-numeric arguments\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
     vm->data_stack_size -= 1;
-    vm->heap[c].kind = ATTO_OBJECT_KIND_SYMBOL;
-    vm->heap[c].container.number = (vm->heap[a].container.number >= vm->heap[b].container.number);
+    c = atto_allocate_symbol(vm, vm->heap[a].container.number >= vm->heap[b].container.number);
     vm->data_stack[vm->data_stack_size - 1] = c;
 
     vm->current_instruction_offset++;
     break;
   }
 
-  case ATTO_VM_OP_ISSEQ:
+  /*  objects are the same if they are of the same kind and hold the same
+   *  value; lists are the same only if they share their cells, and lambdas
+   *  only if they share their code and their captured values. lists built
+   *  while hash-consing is enabled share their cells whenever they hold the
+   *  same values, so telling those apart takes a single comparison */
+  case ATTO_VM_OP_ISSEQ: {
+    size_t a = vm->data_stack[vm->data_stack_size-1],
+           b = vm->data_stack[vm->data_stack_size-2],
+           c;
+    uint64_t same;
+
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu isseq\n", vm->current_instruction_offset);
+    }
+
+    if (vm->heap[a].kind == ATTO_OBJECT_KIND_THUNK) {
+      evaluate_thunk(vm, a);
+    }
+
+    if (vm->heap[b].kind == ATTO_OBJECT_KIND_THUNK) {
+      evaluate_thunk(vm, b);
+    }
+
+    vm->data_stack_size -= 1;
+
+    if (a == b) {
+      same = 1;
+    } else if (vm->heap[a].kind != vm->heap[b].kind) {
+      same = 0;
+    } else if (vm->heap[a].kind == ATTO_OBJECT_KIND_NULL) {
+      same = 1;
+    } else if (vm->heap[a].kind == ATTO_OBJECT_KIND_NUMBER) {
+      same = (vm->heap[a].container.number == vm->heap[b].container.number);
+    } else if (vm->heap[a].kind == ATTO_OBJECT_KIND_SYMBOL) {
+      same = (vm->heap[a].container.symbol == vm->heap[b].container.symbol);
+    } else if (vm->heap[a].kind == ATTO_OBJECT_KIND_LAMBDA) {
+      same = (vm->heap[a].container.lambda.instruction_stream_index == vm->heap[b].container.lambda.instruction_stream_index) &&
+        (vm->heap[a].container.lambda.captures == vm->heap[b].container.lambda.captures);
+    } else {
+      same = (vm->heap[a].container.list.car == vm->heap[b].container.list.car) &&
+        (vm->heap[a].container.list.cdr == vm->heap[b].container.list.cdr);
+    }
+
+    c = atto_allocate_symbol(vm, same);
+    vm->data_stack[vm->data_stack_size - 1] = c;
+
+    vm->current_instruction_offset++;
     break;
+  }
+
+  case ATTO_VM_OP_NOT: {
+    size_t a = vm->data_stack[vm->data_stack_size-1],
+           c;
+
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu not\n", vm->current_instruction_offset);
+    }
+
+    if (vm->heap[a].kind == ATTO_OBJECT_KIND_THUNK) {
+      evaluate_thunk(vm, a);
+    }
+
+    if (vm->heap[a].kind != ATTO_OBJECT_KIND_SYMBOL) {
+      printf("vm: fatal: attempting to perform `not' on a non-symbolic argument\n");
+      atto_vm_fail(vm);
+      return;
+    }
+
+    c = atto_allocate_symbol(vm, vm->heap[a].container.symbol == 0);
+    vm->data_stack[vm->data_stack_size - 1] = c;
 
-  case ATTO_VM_OP_NOT:
+    vm->current_instruction_offset++;
     break;
+  }
+
+  case ATTO_VM_OP_OR: {
+    size_t a = vm->data_stack[vm->data_stack_size-1],
+           b = vm->data_stack[vm->data_stack_size-2],
+           c;
+
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu or\n", vm->current_instruction_offset);
+    }
+
+    if (vm->heap[a].kind == ATTO_OBJECT_KIND_THUNK) {
+      evaluate_thunk(vm, a);
+    }
+
+    if (vm->heap[b].kind == ATTO_OBJECT_KIND_THUNK) {
+      evaluate_thunk(vm, b);
+    }
+
+    if ((vm->heap[a].kind != ATTO_OBJECT_KIND_SYMBOL) ||
+        (vm->heap[b].kind != ATTO_OBJECT_KIND_SYMBOL)) {
+      printf("vm: fatal: attempting to perform `or' on non-symbolic arguments\n");
+      atto_vm_fail(vm);
+      return;
+    }
+
+    vm->data_stack_size -= 1;
+    c = atto_allocate_symbol(vm, (vm->heap[a].container.symbol != 0) || (vm->heap[b].container.symbol != 0));
+    vm->data_stack[vm->data_stack_size - 1] = c;
 
-  case ATTO_VM_OP_OR:
+    vm->current_instruction_offset++;
     break;
+  }
+
+  case ATTO_VM_OP_AND: {
+    size_t a = vm->data_stack[vm->data_stack_size-1],
+           b = vm->data_stack[vm->data_stack_size-2],
+           c;
+
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu and\n", vm->current_instruction_offset);
+    }
+
+    if (vm->heap[a].kind == ATTO_OBJECT_KIND_THUNK) {
+      evaluate_thunk(vm, a);
+    }
+
+    if (vm->heap[b].kind == ATTO_OBJECT_KIND_THUNK) {
+      evaluate_thunk(vm, b);
+    }
+
+    if ((vm->heap[a].kind != ATTO_OBJECT_KIND_SYMBOL) ||
+        (vm->heap[b].kind != ATTO_OBJECT_KIND_SYMBOL)) {
+      printf("vm: fatal: attempting to perform `and' on non-symbolic arguments\n");
+      atto_vm_fail(vm);
+      return;
+    }
 
-  case ATTO_VM_OP_AND:
+    vm->data_stack_size -= 1;
+    c = atto_allocate_symbol(vm, (vm->heap[a].container.symbol != 0) && (vm->heap[b].container.symbol != 0));
+    vm->data_stack[vm->data_stack_size - 1] = c;
+
+    vm->current_instruction_offset++;
     break;
+  }
 
   case ATTO_VM_OP_ISNULL: {
     size_t o   = vm->data_stack[vm->data_stack_size - 1],
-           res = vm->heap_size++;
+           res;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu isnull\n", vm->current_instruction_offset);
     }
     
-    vm->heap[res].kind = ATTO_OBJECT_KIND_SYMBOL;
-    if (vm->heap[o].kind == ATTO_OBJECT_KIND_NULL) {
-      vm->heap[res].container.symbol = 1;
-    } else {
-      vm->heap[res].container.symbol = 0;
-    }
+    res = atto_allocate_symbol(vm, vm->heap[o].kind == ATTO_OBJECT_KIND_NULL);
 
     vm->data_stack[vm->data_stack_size - 1] = res;
 
@@ -530,7 +985,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
 
     if (vm->heap[list].kind != ATTO_OBJECT_KIND_LIST) {
       printf("fatal: attempting to perform `car' on an invalid operand\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
@@ -549,7 +1004,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
 
     if (vm->heap[list].kind != ATTO_OBJECT_KIND_LIST) {
       printf("fatal: attempting to perform `cdr' on an invalid operand\n");
-      vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
+      atto_vm_fail(vm);
       return;
     }
 
@@ -562,15 +1017,13 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_CONS: {
     size_t a = vm->data_stack[vm->data_stack_size - 1],
            b = vm->data_stack[vm->data_stack_size - 2],
-           c = vm->heap_size++;
+           c;
 
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu cons\n", vm->current_instruction_offset);
     }
 
-    vm->heap[c].kind = ATTO_OBJECT_KIND_LIST;
-    vm->heap[c].container.list.car = a;
-    vm->heap[c].container.list.cdr = b;
+    c = atto_allocate_list(vm, a, b);
 
     vm->data_stack_size--;
     vm->data_stack[vm->data_stack_size - 1] = c;
@@ -584,11 +1037,7 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
       printf("vm: %04lu push_number %lf\n", vm->current_instruction_offset, current_instruction->container.number);
     }
 
-    vm->heap[vm->heap_size].kind = ATTO_OBJECT_KIND_NUMBER;
-    vm->heap[vm->heap_size].container.number = current_instruction->container.number;
-    vm->heap_size++;
-
-    vm->data_stack[vm->data_stack_size] = vm->heap_size - 1;
+    vm->data_stack[vm->data_stack_size] = atto_allocate_number(vm, current_instruction->container.number);
     vm->data_stack_size++;
 
     vm->current_instruction_offset++;
@@ -600,24 +1049,29 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
       printf("vm: %04lu push_symbol %lu\n", vm->current_instruction_offset, current_instruction->container.symbol);
     }
 
-    vm->heap[vm->heap_size].kind = ATTO_OBJECT_KIND_SYMBOL;
-    vm->heap[vm->heap_size].container.symbol = current_instruction->container.symbol;
-    vm->heap_size++;
-
-    vm->data_stack[vm->data_stack_size] = vm->heap_size - 1;
+    vm->data_stack[vm->data_stack_size] = atto_allocate_symbol(vm, current_instruction->container.symbol);
     vm->data_stack_size++;
 
     vm->current_instruction_offset++;
     break;
   }
 
+  /*  the values captured by the lambda were pushed right before, in the
+   *  order in which the lambda body refers to them */
   case ATTO_VM_OP_PUSHL: {
+    size_t number_of_captures = vm->instruction_streams[current_instruction->container.offset]->number_of_captures;
+    size_t captures = atto_allocate_captures(vm, number_of_captures);
+
     if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
       printf("vm: %04lu push_lambda %lu\n", vm->current_instruction_offset, current_instruction->container.offset);
     }
 
+    vm->data_stack_size -= number_of_captures;
+    memcpy(&vm->captures[captures], &vm->data_stack[vm->data_stack_size], sizeof(size_t) * number_of_captures);
+
     vm->heap[vm->heap_size].kind = ATTO_OBJECT_KIND_LAMBDA;
-    vm->heap[vm->heap_size].container.instruction_stream_index = current_instruction->container.offset;
+    vm->heap[vm->heap_size].container.lambda.instruction_stream_index = current_instruction->container.offset;
+    vm->heap[vm->heap_size].container.lambda.captures = captures;
     vm->heap_size++;
 
     vm->data_stack[vm->data_stack_size] = vm->heap_size - 1;
@@ -627,11 +1081,22 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     break;
   }
 
-  case ATTO_VM_OP_PUSHZ: {
-    size_t empty_list = vm->heap_size++;
-    vm->heap[empty_list].kind = ATTO_OBJECT_KIND_NULL;
+  /*  pushes an object built at compile time, which is shared by every
+   *  evaluation of the expression it stands for */
+  case ATTO_VM_OP_PUSHK: {
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu push_constant %lu\n", vm->current_instruction_offset, current_instruction->container.offset);
+    }
 
-    vm->data_stack[vm->data_stack_size++] = empty_list;
+    vm->data_stack[vm->data_stack_size] = current_instruction->container.offset;
+    vm->data_stack_size++;
+
+    vm->current_instruction_offset++;
+    break;
+  }
+
+  case ATTO_VM_OP_PUSHZ: {
+    vm->data_stack[vm->data_stack_size++] = atto_allocate_null(vm);
 
     vm->current_instruction_offset += 1;
     break;
@@ -640,8 +1105,16 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
   case ATTO_VM_OP_DUP:
     break;
 
-  case ATTO_VM_OP_DROP:
+  case ATTO_VM_OP_DROP: {
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu drop\n", vm->current_instruction_offset);
+    }
+
+    vm->data_stack_size--;
+
+    vm->current_instruction_offset++;
     break;
+  }
 
   case ATTO_VM_OP_SWAP:
     break;
@@ -682,6 +1155,18 @@ void atto_vm_perform_step(struct atto_vm_state *vm)
     break;
   }
 
+  case ATTO_VM_OP_GETCAP: {
+    if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
+      printf("vm: %04lu getcap %lu\n", vm->current_instruction_offset, current_instruction->container.offset);
+    }
+
+    vm->data_stack[vm->data_stack_size] = vm->current_captures[current_instruction->container.offset];
+    vm->data_stack_size++;
+
+    vm->current_instruction_offset++;
+    break;
+  }
+
   default:
     printf("vm: fatal: unknown opcode (0x%02x)\n", current_instruction->opcode);
     exit(1);
@@ -700,8 +1185,11 @@ void atto_run_vm(struct atto_vm_state *vm)
     printf("vm: run is=%lu, o=%lu\n", vm->current_instruction_stream_index, vm->current_instruction_offset);
   }
 
+  /*  streams which failed to compile may well be empty */
   while (vm->flags & ATTO_VM_FLAG_RUNNING) {
-    atto_vm_perform_step(vm);
+    if (vm->current_instruction_offset < vm->instruction_streams[vm->current_instruction_stream_index]->length) {
+      atto_vm_perform_step(vm);
+    }
 
     if (vm->current_instruction_offset >= vm->instruction_streams[vm->current_instruction_stream_index]->length) {
       vm->flags &= ~(ATTO_VM_FLAG_RUNNING);
@@ -763,23 +1251,52 @@ void pretty_print_stack(struct atto_vm_state *vm)
 void pretty_print_heap_usage(struct atto_vm_state *vm)
 {
   printf("heap: %lu/%lu objects\n", vm->heap_size, ATTO_VM_MAX_HEAP_OBJECTS);
+
+  if (vm->flags & ATTO_VM_FLAG_HASH_CONS) {
+    printf("heap: %lu allocations shared an existing object\n", vm->number_of_shared_allocations);
+  }
 }
 
+/*
+ *  forces a thunk, replacing it in place with the object it evaluates to;
+ *  the state of the running computation is left untouched
+ */
 void evaluate_thunk(struct atto_vm_state *vm, size_t index)
 {
-  if (vm->heap[index].kind != ATTO_OBJECT_KIND_THUNK) {
-    return;
-  }
+  while (vm->heap[index].kind == ATTO_OBJECT_KIND_THUNK) {
+    size_t result;
 
-  atto_run_instruction_stream(vm, vm->heap[index].container.instruction_stream_index);
+    atto_run_instruction_stream(vm, vm->heap[index].container.instruction_stream_index);
 
-  /*  TODO: free linked instruction stream */
+    /*  TODO: free linked instruction stream */
 
-  vm->heap[index].kind = vm->heap[vm->data_stack[vm->data_stack_size - 1]].kind;
-  vm->heap[index].container = vm->heap[vm->data_stack[vm->data_stack_size - 1]].container;
+    vm->data_stack_size--;
+    result = vm->data_stack[vm->data_stack_size];
+
+    /*  thunks whose computation failed are left to fail again */
+    if (vm->flags & ATTO_VM_FLAG_FAILED) {
+      return;
+    }
+
+    vm->heap[index].kind = vm->heap[result].kind;
+    vm->heap[index].container = vm->heap[result].container;
+  }
 }
 
-void atto_run_instruction_stream(struct atto_vm_state *vm, size_t index)
+/*
+ *  gives up on the computation being run, once a fatal error was reported
+ *  for it; the vm goes back to where the computation was started from
+ *  outside of it, and the thunks it was forcing are left as they were
+ */
+void atto_vm_fail(struct atto_vm_state *vm)
+{
+  assert(vm->failure != NULL);
+
+  vm->flags |= ATTO_VM_FLAG_FAILED;
+  longjmp(*vm->failure, 1);
+}
+
+static void run_in_frame(struct atto_vm_state *vm, size_t index)
 {
   if (vm->flags & ATTO_VM_FLAG_VERBOSE) {
     pretty_print_instruction_stream(vm->instruction_streams[index]);
@@ -788,10 +1305,78 @@ void atto_run_instruction_stream(struct atto_vm_state *vm, size_t index)
   vm->call_stack[vm->call_stack_size].instruction_stream_index = vm->current_instruction_stream_index;
   vm->call_stack[vm->call_stack_size].instruction_offset = vm->current_instruction_offset;
   vm->call_stack[vm->call_stack_size].stack_offset_at_entrypoint = vm->data_stack_size;
+  vm->call_stack[vm->call_stack_size].captures = vm->current_captures;
+  vm->call_stack[vm->call_stack_size].memoize = 0;
   vm->call_stack_size++;
 
+  /*  streams run this way are never lambda bodies, so they capture nothing */
   vm->current_instruction_stream_index = index;
   vm->current_instruction_offset = 0;
+  vm->current_captures = NULL;
   atto_run_vm(vm);
 }
 
+/*
+ *  runs an instruction stream to completion in a frame of its own, leaving
+ *  its result on top of the data stack; this may be done while another
+ *  stream is running, since the interrupted computation is resumed
+ *  afterwards. a computation started from outside of the vm which fails
+ *  is left with the empty list for a result, and with the failed flag set
+ */
+void atto_run_instruction_stream(struct atto_vm_state *vm, size_t index)
+{
+  size_t previous_instruction_stream_index = vm->current_instruction_stream_index,
+         previous_instruction_offset       = vm->current_instruction_offset,
+         previous_call_stack_size          = vm->call_stack_size,
+         previous_data_stack_size          = vm->data_stack_size;
+  size_t *previous_captures = vm->current_captures;
+  uint8_t previous_running_flag = vm->flags & ATTO_VM_FLAG_RUNNING;
+  jmp_buf failure;
+
+  if (previous_running_flag) {
+    run_in_frame(vm, index);
+  } else {
+    vm->failure = &failure;
+    vm->flags &= ~(ATTO_VM_FLAG_FAILED);
+
+    if (setjmp(failure) == 0) {
+      run_in_frame(vm, index);
+    } else {
+      vm->data_stack_size = previous_data_stack_size;
+      vm->data_stack[vm->data_stack_size] = atto_allocate_null(vm);
+      vm->data_stack_size++;
+    }
+
+    vm->failure = NULL;
+  }
+
+  /*  only the result is kept, in case the stream left anything else behind */
+  vm->data_stack[previous_data_stack_size] = vm->data_stack[vm->data_stack_size - 1];
+  vm->data_stack_size = previous_data_stack_size + 1;
+
+  vm->call_stack_size = previous_call_stack_size;
+  vm->current_instruction_stream_index = previous_instruction_stream_index;
+  vm->current_instruction_offset = previous_instruction_offset;
+  vm->current_captures = previous_captures;
+  vm->flags = (vm->flags & ~(ATTO_VM_FLAG_RUNNING)) | previous_running_flag;
+}
+
+/*
+ *  appends an instruction stream to the table of streams, returning its
+ *  index
+ */
+size_t atto_add_instruction_stream(struct atto_vm_state *vm, struct atto_instruction_stream *is)
+{
+  if (vm->number_of_instruction_streams == vm->number_of_allocated_instruction_streams) {
+    vm->number_of_allocated_instruction_streams *= 2;
+    vm->instruction_streams = (struct atto_instruction_stream **)realloc(vm->instruction_streams,
+      sizeof(struct atto_instruction_stream *) * vm->number_of_allocated_instruction_streams);
+    assert(vm->instruction_streams != NULL);
+  }
+
+  vm->instruction_streams[vm->number_of_instruction_streams] = is;
+  vm->number_of_instruction_streams++;
+
+  return vm->number_of_instruction_streams - 1;
+}
+
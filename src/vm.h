@@ -6,6 +6,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <setjmp.h>
 
 #include "ops.h"
 
@@ -28,6 +29,14 @@ struct atto_object {
       size_t cdr;
     } list;
     size_t instruction_stream_index;
+
+    /*  lambdas carry the values of the variables they capture, copied out
+     *  of the frames they were created in into the capture pool of the vm;
+     *  `captures' is where the values start in the pool */
+    struct {
+      size_t instruction_stream_index;
+      size_t captures;
+    } lambda;
   } container;
 };
 
@@ -41,20 +50,48 @@ struct atto_instruction {
   } container;
 };
 
+struct atto_lambda_stub;
+struct atto_memo_cache;
+
 struct atto_instruction_stream {
   size_t length;
   size_t allocated_length;
   struct atto_instruction *stream;
+
+  /*  used by the compiler to keep track of the number of values the
+   *  instructions written so far leave in the current frame */
+  size_t stack_depth;
+
+  /*  the number of values a lambda body captures; they are taken off the
+   *  stack when the lambda is created */
+  size_t number_of_captures;
+
+  /*  the number of arguments a lambda body takes, and whether the results
+   *  of calling it are remembered */
+  size_t number_of_arguments;
+  uint8_t memoize;
+
+  /*  set for lambda bodies which have not been compiled yet; they are
+   *  compiled the first time they are called */
+  struct atto_lambda_stub *stub;
 };
 
 struct atto_vm_call_stack_entry {
   size_t instruction_stream_index;
   size_t instruction_offset;
   size_t stack_offset_at_entrypoint;
+  size_t *captures;
+
+  /*  set if the result of the call is to be remembered once it returns */
+  uint8_t memoize;
 };
 
 struct atto_vm_state {
-  #define ATTO_VM_MAX_DATA_STACK_SIZE (size_t)256
+  /*  globals, and the values of top-level expressions, stay at the bottom
+   *  of the data stack for good, and may take all of it but the room kept
+   *  for evaluating expressions */
+  #define ATTO_VM_MAX_DATA_STACK_SIZE (size_t)4096
+  #define ATTO_VM_MAX_GLOBALS (ATTO_VM_MAX_DATA_STACK_SIZE - (size_t)256)
   size_t *data_stack;
   size_t data_stack_size;
 
@@ -74,9 +111,38 @@ struct atto_vm_state {
   size_t current_instruction_stream_index;
   size_t current_instruction_offset;
 
-  #define ATTO_VM_FLAG_RUNNING (1<<0)
-  #define ATTO_VM_FLAG_VERBOSE (1<<1)
+  /*  the values captured by the lambdas created so far, one after the
+   *  other; like the heap, the pool only ever grows */
+  #define ATTO_VM_MAX_CAPTURES (4 * ATTO_VM_MAX_HEAP_OBJECTS)
+  size_t *captures;
+  size_t number_of_captures;
+
+  /*  the values captured by the lambda being run, if any */
+  size_t *current_captures;
+
+  struct atto_memo_cache *memo_cache;
+
+  /*  heap objects which may be shared, by value, while hash-consing is
+   *  enabled; see `allocate_object' */
+  #define ATTO_VM_SHARED_OBJECT_TABLE_SIZE (2 * ATTO_VM_MAX_HEAP_OBJECTS)
+  size_t *shared_objects;
+  size_t number_of_shared_allocations;
+
+  #define ATTO_VM_FLAG_RUNNING   (1<<0)
+  #define ATTO_VM_FLAG_VERBOSE   (1<<1)
+  #define ATTO_VM_FLAG_HASH_CONS (1<<2)
+  #define ATTO_VM_FLAG_FAILED    (1<<3)
   uint8_t flags;
+
+  /*  where a computation started from outside of the vm goes back to once
+   *  it fails; see `atto_vm_fail' */
+  jmp_buf *failure;
+
+  /*  set if the heap, the data stack, the capture pool and the shared
+   *  object table live in a snapshot mapped into memory, rather than in
+   *  memory of their own; see `atto_load_snapshot' */
+  void *snapshot;
+  size_t snapshot_length;
 };
 
 struct atto_vm_state *atto_allocate_vm_state(void);
@@ -87,4 +153,14 @@ void pretty_print_stack(struct atto_vm_state *vm);
 void pretty_print_heap_usage(struct atto_vm_state *vm);
 void evaluate_thunk(struct atto_vm_state *vm, size_t index);
 void atto_run_instruction_stream(struct atto_vm_state *vm, size_t index);
+size_t atto_add_instruction_stream(struct atto_vm_state *vm, struct atto_instruction_stream *is);
+
+size_t atto_allocate_null(struct atto_vm_state *vm);
+size_t atto_allocate_number(struct atto_vm_state *vm, double number);
+size_t atto_allocate_symbol(struct atto_vm_state *vm, uint64_t symbol);
+size_t atto_allocate_list(struct atto_vm_state *vm, size_t car, size_t cdr);
+size_t atto_share_object(struct atto_vm_state *vm, size_t index);
+size_t atto_allocate_captures(struct atto_vm_state *vm, size_t number_of_captures);
+void atto_claim_global_slot(struct atto_vm_state *vm);
+void atto_vm_fail(struct atto_vm_state *vm);
 
@@ -0,0 +1,271 @@
+#!/bin/sh
+#
+#  run.sh
+#  part of Atto :: https://github.com/deveah/atto
+#
+#  runs each test case through atto, and compares what it prints with the
+#  matching `.expected' file; cases are fed to the REPL, so they may use
+#  REPL commands as well. with UPDATE=1, the `.expected' files are written
+#  instead of being compared with
+#
+
+tests=$(cd "$(dirname "$0")" && pwd)
+atto=${ATTO:-$tests/../atto}
+atto=$(cd "$(dirname "$atto")" && pwd)/$(basename "$atto")
+scratch=$(mktemp -d)
+passed=0
+failed=0
+
+trap 'rm -rf "$scratch"' EXIT
+
+#  prompts, colors, the compiler's tracing and the contents of the stack
+#  are left out, and so are the numbers of instruction streams, all of which
+#  change whenever the prelude does
+normalize()
+{
+  esc=$(printf '\033')
+
+  sed -e "s/$esc\[[0-9;]*m//g" \
+      -e '/^atto alpha -- /d' \
+      -e '/^type -help /d' \
+      -e '/^atto> /d' \
+      -e '/^\.\.\.\.> /d' \
+      -e '/^running instruction stream /d' \
+      -e '/branch length=/d' \
+      -e '/^stack: /d' \
+      -e '/^instruction stream size=/d' \
+      -e '/^0x/d' \
+      -e '/^$/d' \
+      -e 's/^vm: run is=[0-9]*/vm: run is=/' \
+      -e 's/ ret ([0-9]*:/ ret (:/' \
+      -e 's/lambda#[0-9]*/lambda#/g' \
+      -e 's/thunk#[0-9]*/thunk#/g'
+}
+
+#  run <case> <input> [arguments...]: runs atto from the scratch directory
+#  with the given arguments, feeding it `input', which is looked for in the
+#  tests directory unless its path is absolute
+run()
+{
+  name=$1
+  input=$2
+  shift 2
+
+  case "$input" in
+    /*) ;;
+    *) input=$tests/$input ;;
+  esac
+
+  (cd "$scratch" && TERM=dumb "$atto" "$@" < "$input" 2>&1) | normalize > "$scratch/$name.out"
+}
+
+#  compare <case> <expected case>: compares what a case printed with the
+#  `.expected' file of the given case
+compare()
+{
+  if [ -n "$UPDATE" ] && [ "$1" = "$2" ]; then
+    cp "$scratch/$1.out" "$tests/$2.expected"
+  elif cmp -s "$tests/$2.expected" "$scratch/$1.out"; then
+    passed=$((passed + 1))
+  else
+    echo "FAIL: $1"
+    diff "$tests/$2.expected" "$scratch/$1.out" | head -20
+    failed=$((failed + 1))
+  fi
+}
+
+#  check <case> <input> [arguments...]: runs a case, and compares what it
+#  printed with its own `.expected' file
+check()
+{
+  run "$@"
+  compare "$1" "$1"
+}
+
+#  check_same <case> <expected case> <input> [arguments...]: runs a case
+#  which must print the same as another one
+check_same()
+{
+  expected=$2
+  name=$1
+  shift 2
+  run "$name" "$@"
+  compare "$name" "$expected"
+}
+
+check strictness strictness.atto
+check inlining inlining.atto
+check let let.atto
+#  files hold no REPL commands, and syntax errors found by the worker threads
+#  are not ordered with the results, so the file loaded on threads has none
+grep -v '^-' "$tests/let.atto" > "$scratch/let.atto"
+check let-parallel /dev/null -j 2 let.atto
+check cse cse.atto
+check fusion fusion.atto
+check specialization specialization.atto
+
+#  the prelude is loaded from an image, which keeps what the optimizer needs
+#  to fuse and specialize calls to its lambdas
+check prelude prelude.atto
+check lazy lazy.atto
+check constants constants.atto
+check environment environment.atto
+
+#  more globals than the data stack once held
+i=0
+while [ $i -lt 300 ]; do
+  echo "(define g$i $i)"
+  i=$((i + 1))
+done > "$scratch/globals.atto"
+check globals globals.atto globals.atto
+check natives natives.atto
+check natives-image natives-image.atto -image natives.attob
+
+#  an image naming a native this build does not have must be turned away
+LC_ALL=C sed 's/floor/flour/' "$scratch/natives.attob" > "$scratch/natives-renamed.attob"
+check natives-renamed natives-image.atto -image natives-renamed.attob
+
+check closures closures.atto
+
+#  the single pass frontend must give the same results as the full pipeline,
+#  both for the forms it compiles and for those it leaves to the pipeline
+check frontend frontend.atto
+{ echo -fast-frontend-on; cat "$tests/frontend.atto"; } > "$scratch/frontend-fast.atto"
+check_same frontend-fast frontend "$scratch/frontend-fast.atto"
+check frontend-trace frontend-trace.atto
+
+check memo memo.atto
+
+#  numbers are hash-consed, so that keys which are equal are found; the
+#  sums call for more keys than fit, and the least recently used go first
+check memo-eviction memo-eviction.atto
+
+check hash-cons hash-cons.atto
+
+check lexer lexer.atto
+
+#  runs of each class around the 16 and 32 byte widths the lexer measures
+#  them in, both from a file read in chunks and from one lexed on threads
+check lexer-runs /dev/null "$tests/lexer-runs.atto"
+check_same lexer-runs-parallel lexer-runs /dev/null -j 2 "$tests/lexer-runs.atto"
+
+check arena arena.atto
+
+#  symbols are interned by both frontends, into a table which grows as they
+#  are added
+check symbols symbols.atto
+{ echo -fast-frontend-on; cat "$tests/symbols.atto"; } > "$scratch/symbols-fast.atto"
+check_same symbols-fast symbols "$scratch/symbols-fast.atto"
+
+#  forms and atoms which straddle the chunks files are read in, and lists
+#  nested deeper than the parser would once have recursed
+check reader /dev/null "$tests/reader.atto"
+check reader-repl reader-repl.atto
+
+#  forms loaded on threads are compiled and run in source order, whatever
+#  the number of threads, including more threads than forms
+check parallel parallel-repl.atto "$tests/parallel.atto"
+for threads in 1 2 4 0 64; do
+  check_same parallel-$threads parallel parallel-repl.atto -j $threads "$tests/parallel.atto"
+done
+
+#  the compile cache: entries are found again when their forms are only
+#  reindented, and an edited form, or other compiler settings, make the
+#  entries of all forms after it stale, even those from other files
+cached()
+{
+  name=$1
+  shift
+  check "$name" cache-repl.atto "$@" "$tests/cache-b.atto"
+}
+
+cached cache-cold -cache cache "$tests/cache-a.atto"
+cached cache-warm -cache cache "$tests/cache-a.atto"
+check_same cache-reindented cache-warm cache-repl.atto -cache cache "$tests/cache-a-reindented.atto" "$tests/cache-b.atto"
+cached cache-edited -cache cache "$tests/cache-a-edited.atto"
+check_same cache-settings cache-cold cache-repl.atto -inline-size 0 -cache cache "$tests/cache-a.atto" "$tests/cache-b.atto"
+
+#  entries which are not entries, or which are cut short before they change
+#  anything, are compiled again; those cut short after that are fatal, as
+#  what they changed cannot be undone
+for entry in "$scratch"/cache/*.attoc; do
+  printf 'junk' > "$entry"
+done
+cached cache-corrupt -cache cache "$tests/cache-a.atto"
+
+for entry in "$scratch"/cache/*.attoc; do
+  head -c 48 "$entry" > "$entry.cut"
+  mv "$entry.cut" "$entry"
+done
+cached cache-truncated -cache cache "$tests/cache-a.atto"
+
+for entry in "$scratch"/cache/*.attoc; do
+  head -c $(($(wc -c < "$entry") - 8)) "$entry" > "$entry.cut"
+  mv "$entry.cut" "$entry"
+done
+cached cache-damaged -cache cache "$tests/cache-a.atto"
+
+#  keys only cover the prelude and the forms looked up, so nothing is cached
+#  once the state was changed by anything else, such as a file loaded without
+#  the cache, or on threads; entries stored before are then left alone
+cached cache-outside "$tests/cache-a.atto" -cache outside
+cached cache-outside-edited "$tests/cache-a-edited.atto" -cache outside
+cached cache-between-cold -cache between "$tests/cache-a.atto"
+cached cache-between -cache between "$tests/cache-a.atto" -j 2 "$tests/cache-a-edited.atto" -j 1
+
+check prepared prepared.atto
+
+#  images saved from the REPL hold everything the state was given, and load
+#  into a new state, from which they can be saved again
+check image image.atto
+check image-load image-load.atto -image image.attob
+check image-again image-again.atto -image image-again.attob
+check prelude-image prelude-image.atto -image image.attob
+
+#  images which cannot be loaded, or only partly
+check image-missing image-broken.atto -image missing.attob
+check image-not-first image-broken.atto "$tests/image-again.atto" -image image.attob
+
+printf 'junk' > "$scratch/image-junk.attob"
+check image-junk image-broken.atto -image image-junk.attob
+
+cp "$scratch/image.attob" "$scratch/image-version.attob"
+printf '\177' | dd of="$scratch/image-version.attob" bs=1 seek=4 conv=notrunc 2> /dev/null
+check image-version image-broken.atto -image image-version.attob
+
+cp "$scratch/image.attob" "$scratch/image-byte-order.attob"
+printf '\177' | dd of="$scratch/image-byte-order.attob" bs=1 seek=12 conv=notrunc 2> /dev/null
+check image-byte-order image-broken.atto -image image-byte-order.attob
+
+head -c 24 "$scratch/image.attob" > "$scratch/image-short.attob"
+check image-short image-broken.atto -image image-short.attob
+
+head -c $(($(wc -c < "$scratch/image.attob") - 8)) "$scratch/image.attob" > "$scratch/image-cut.attob"
+check image-cut image-broken.atto -image image-cut.attob
+
+#  snapshots hold the whole state, which keeps growing once mapped, and can
+#  be saved again
+check snapshot snapshot.atto
+check snapshot-load snapshot-load.atto -snapshot snapshot.atts
+check snapshot-again snapshot-again.atto -snapshot snapshot-again.atts
+
+#  snapshots which are not, or were not made by this build, are turned away
+#  before any of the state is touched
+check snapshot-missing image-broken.atto -snapshot missing.atts
+check snapshot-not-first image-broken.atto "$tests/image-again.atto" -snapshot snapshot.atts
+
+printf 'junk' > "$scratch/snapshot-junk.atts"
+check snapshot-junk image-broken.atto -snapshot snapshot-junk.atts
+
+cp "$scratch/snapshot.atts" "$scratch/snapshot-version.atts"
+printf '\177' | dd of="$scratch/snapshot-version.atts" bs=1 seek=4 conv=notrunc 2> /dev/null
+check snapshot-version image-broken.atto -snapshot snapshot-version.atts
+
+head -c $(($(wc -c < "$scratch/snapshot.atts") - 8)) "$scratch/snapshot.atts" > "$scratch/snapshot-cut.atts"
+check snapshot-cut image-broken.atto -snapshot snapshot-cut.atts
+
+#  snapshots keep the expressions of lambdas as images do
+check_same prelude-snapshot prelude-image prelude-image.atto -snapshot snapshot.atts
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]